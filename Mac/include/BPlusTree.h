@@ -1,21 +1,243 @@
 #ifndef BPLUSTREE_H
 #define BPLUSTREE_H
 
+#include <array>
 #include <vector>
 #include <memory>
 #include <fstream>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <type_traits>
+#include <cstdint>
+#include <cstring>
+#include <optional>
 #include "Storage.h"
 
-class BPlusTreeNode {
+// Multi-column key, compared lexicographically: first column, then second
+template <typename First, typename Second>
+struct CompositeKey {
+    First first;
+    Second second;
+
+    bool operator<(const CompositeKey& other) const {
+        return first < other.first || (!(other.first < first) && second < other.second);
+    }
+    bool operator==(const CompositeKey& other) const {
+        return first == other.first && second == other.second;
+    }
+};
+
+template <typename Key>
+struct IsCompositeKey : std::false_type {};
+
+template <typename First, typename Second>
+struct IsCompositeKey<CompositeKey<First, Second>> : std::true_type {};
+
+// Order-preserving encoding of a key into an unsigned integer, so nodes only ever compare integers:
+// a < b exactly when encode(a) < encode(b). The tree normalizes keys on the way in and decodes them
+// only for printing.
+template <typename Key>
+struct KeyCodec;
+
+template <>
+struct KeyCodec<uint8_t> {
+    using Encoded = uint8_t;
+    static Encoded encode(uint8_t key) { return key; }
+    static uint8_t decode(Encoded encoded) { return encoded; }
+};
+
+template <>
+struct KeyCodec<int> {
+    using Encoded = uint32_t;
+    // Flipping the sign bit maps INT_MIN..INT_MAX onto 0..UINT32_MAX in order
+    static Encoded encode(int key) { return static_cast<uint32_t>(key) ^ 0x80000000u; }
+    static int decode(Encoded encoded) { return static_cast<int>(encoded ^ 0x80000000u); }
+};
+
+template <>
+struct KeyCodec<float> {
+    using Encoded = uint32_t;
+    // IEEE bits: negatives have every bit flipped so they sort in reverse, non-negatives only the sign bit
+    static Encoded encode(float key) {
+        if (key == 0.0f) key = 0.0f;   // -0.0f and 0.0f are the same key
+        uint32_t bits;
+        std::memcpy(&bits, &key, sizeof(bits));
+        return (bits & 0x80000000u) ? ~bits : bits ^ 0x80000000u;
+    }
+    static float decode(Encoded encoded) {
+        uint32_t bits = (encoded & 0x80000000u) ? encoded ^ 0x80000000u : ~encoded;
+        float key;
+        std::memcpy(&key, &bits, sizeof(key));
+        return key;
+    }
+};
+
+template <typename First, typename Second>
+struct KeyCodec<CompositeKey<First, Second>> {
+    static_assert(sizeof(typename KeyCodec<First>::Encoded) == 4 && sizeof(typename KeyCodec<Second>::Encoded) == 4,
+                  "Composite keys pack two 4-byte columns into one 8-byte key");
+    using Encoded = uint64_t;
+    // First column in the high half, so integer order is the lexicographic column order
+    static Encoded encode(const CompositeKey<First, Second>& key) {
+        return (static_cast<uint64_t>(KeyCodec<First>::encode(key.first)) << 32) | KeyCodec<Second>::encode(key.second);
+    }
+    static CompositeKey<First, Second> decode(Encoded encoded) {
+        return {KeyCodec<First>::decode(static_cast<uint32_t>(encoded >> 32)),
+                KeyCodec<Second>::decode(static_cast<uint32_t>(encoded))};
+    }
+};
+
+// Leaf flag, key count and one 4-byte link, at the head of every stored node
+constexpr size_t nodeHeaderSize = sizeof(bool) + sizeof(uint16_t) + sizeof(uint32_t);
+
+// Largest order whose internal node still fits in one index page (child links are stored as 4-byte page numbers).
+// A leaf entry also carries its posting list and payload, so leaves are further split by their encoded size
+template <typename Key, typename Value>
+constexpr int pageOrder() {
+    constexpr size_t entrySize = sizeof(typename KeyCodec<Key>::Encoded) + std::max(sizeof(Value), sizeof(uint32_t));
+    return static_cast<int>((INDEX_PAGE_SIZE - nodeHeaderSize) / entrySize);
+}
+
+// Sorted values of one key, stored as varint-encoded gaps between consecutive values
+template <typename Value>
+class PostingList {
 public:
+    static_assert(std::is_unsigned<Value>::value, "Posting lists hold unsigned record ids");
+
+    uint32_t size() const { return count; }
+    const std::vector<uint8_t>& bytes() const { return data; }
+
+    // Returns the position the value took in the list
+    uint32_t insert(Value value) {
+        if (count == 0 || last <= value) {
+            // Common case, ids arrive in ascending order: append one gap
+            appendGap(value - (count == 0 ? 0 : last));
+            last = value;
+            return count++;
+        }
+        std::vector<Value> values = decode();
+        auto position = std::upper_bound(values.begin(), values.end(), value);
+        uint32_t index = static_cast<uint32_t>(position - values.begin());
+        values.insert(position, value);
+        *this = encode(values);
+        return index;
+    }
+
+    template <typename Visitor>
+    void forEach(Visitor visit) const {
+        Value value = 0;
+        size_t offset = 0;
+        for (uint32_t i = 0; i < count; ++i) {
+            value += readGap(offset);
+            visit(value);
+        }
+    }
+
+    std::vector<Value> decode() const {
+        std::vector<Value> values;
+        values.reserve(count);
+        forEach([&values](Value value) { values.push_back(value); });
+        return values;
+    }
+
+    static PostingList encode(const std::vector<Value>& sortedValues) {
+        PostingList list;
+        for (Value value : sortedValues) list.insert(value);
+        return list;
+    }
+
+    // Sequential decoder, for callers that may stop part-way through the list
+    class Reader {
+    public:
+        explicit Reader(const PostingList* list = nullptr) : list(list) {}
+
+        bool next(Value& value) {
+            if (!list || index == list->count) return false;
+            current += list->readGap(offset);
+            index++;
+            value = current;
+            return true;
+        }
+
+    private:
+        const PostingList* list;
+        size_t offset = 0;
+        uint32_t index = 0;
+        Value current = 0;
+    };
+
+    Reader reader() const { return Reader(this); }
+
+    static PostingList fromBytes(uint32_t count, std::vector<uint8_t> bytes) {
+        PostingList list;
+        list.count = count;
+        list.data = std::move(bytes);
+        list.forEach([&list](Value value) { list.last = value; });
+        return list;
+    }
+
+private:
+    uint32_t count = 0;
+    Value last = 0;
+    std::vector<uint8_t> data;
+
+    void appendGap(Value gap) {
+        while (gap >= 0x80) {
+            data.push_back(static_cast<uint8_t>(gap | 0x80));
+            gap >>= 7;
+        }
+        data.push_back(static_cast<uint8_t>(gap));
+    }
+
+    Value readGap(size_t& offset) const {
+        Value gap = 0;
+        int shift = 0;
+        uint8_t byte;
+        do {
+            byte = data[offset++];
+            gap |= static_cast<Value>(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        return gap;
+    }
+};
+
+template <typename Key, typename Value, int Order>
+struct BPlusTreeNode {
     bool isLeaf;
-    std::vector<float> keys;
-    std::vector<std::shared_ptr<BPlusTreeNode>> children;
-    std::vector<uint32_t> recordIds;
+    uint16_t keyCount = 0;
+
+    // Holds at most Order - 1 keys; the spare slot takes the overflowing key right before a split
+    std::array<Key, Order> keys;
     std::weak_ptr<BPlusTreeNode> parent;
-    std::shared_ptr<BPlusTreeNode> nextLeaf;
 
-    BPlusTreeNode(bool leaf = false) : isLeaf(leaf) {}
+    explicit BPlusTreeNode(bool leaf) : isLeaf(leaf) {}
+};
+
+template <typename Key, typename Value, int Order>
+struct BPlusTreeLeafNode : BPlusTreeNode<Key, Value, Order> {
+    // Keys in a leaf are distinct; every record id stored under a key lives in its posting list
+    std::array<PostingList<Value>, Order> postings;
+    std::array<double, Order> sums{};   // measure summed over each key's posting list
+    // Covered column values of every posting entry, one row per entry with each column in its stored width:
+    // key by key, in posting order within a key. Empty for non-covering trees
+    std::vector<uint8_t> payloadRows;
+    std::shared_ptr<BPlusTreeLeafNode> nextLeaf;
+    std::weak_ptr<BPlusTreeLeafNode> prevLeaf;   // weak, so the doubly linked chain does not keep itself alive
+
+    BPlusTreeLeafNode() : BPlusTreeNode<Key, Value, Order>(true) {}
+};
+
+template <typename Key, typename Value, int Order>
+struct BPlusTreeInternalNode : BPlusTreeNode<Key, Value, Order> {
+    std::array<std::shared_ptr<BPlusTreeNode<Key, Value, Order>>, Order + 1> children;
+
+    // Entry count and measure sum of each child's subtree, so range aggregates stop at the node
+    std::array<uint32_t, Order + 1> childCounts{};
+    std::array<double, Order + 1> childSums{};
+
+    BPlusTreeInternalNode() : BPlusTreeNode<Key, Value, Order>(false) {}
 };
 
 struct SearchResult {
@@ -26,37 +248,280 @@ struct SearchResult {
     std::vector<Record> found_records;
 };
 
+// One probe of a batched lookup: its matches are numberOfResults positions in BatchSearchResult::matches,
+// starting at firstMatch
+struct BatchProbeResult {
+    int indexNodesAccessed;
+    int dataBlocksAccessed;
+    int numberOfResults;
+    size_t firstMatch;
+};
+
+// Per-probe results of a batched lookup, in probe order, plus what the whole batch cost. Each record any probe
+// matches is fetched once into records; probes refer to it by position rather than holding a copy.
+struct BatchSearchResult {
+    std::vector<Record> records;            // in block order
+    std::vector<uint32_t> matches;          // probe after probe, each probe's records in key order, as positions in records
+    std::vector<BatchProbeResult> results;
+    int indexNodesAccessed;   // internal nodes visited by all descents together
+    int descents;             // root-to-leaf descents; a probe starting inside the current leaf reuses it
+    int dataBlocksAccessed;   // distinct blocks read for the whole batch, each read once
+
+    const Record& record(size_t probe, size_t i) const { return records[matches[results[probe].firstMatch + i]]; }
+};
+
+// COUNT / SUM / AVG of a tree's measure column over a key range, answered from the index alone
+struct AggregateResult {
+    int indexNodesAccessed;
+    uint32_t count;
+    double sum;
+    float average;
+};
+
+// Index of the first key in [keys, keys + count) that is not less than key.
+// Branch-free, so with a compile-time Order the loop has a short, predictable trip count.
+template <typename Key>
+int nodeLowerBound(const Key* keys, int count, const Key& key) {
+    if (count == 0) return 0;
+    const Key* base = keys;
+    while (count > 1) {
+        int half = count / 2;
+        base = (base[half] < key) ? base + half : base;
+        count -= half;
+    }
+    return static_cast<int>(base - keys) + (*base < key);
+}
+
+// Index of the first key in [keys, keys + count) that is greater than key, used to pick the child to descend into
+template <typename Key>
+int nodeUpperBound(const Key* keys, int count, const Key& key) {
+    if (count == 0) return 0;
+    const Key* base = keys;
+    while (count > 1) {
+        int half = count / 2;
+        base = (key < base[half]) ? base : base + half;
+        count -= half;
+    }
+    return static_cast<int>(base - keys) + !(key < *base);
+}
+
+template <typename Key, typename Value = uint32_t, int Order = pageOrder<Key, Value>()>
 class BPlusTree {
 public:
-    BPlusTree(int order, const std::string& indexFilename);
+    static_assert(Order >= 4, "B+ tree order must be at least 4");
+
+    using KeyType = Key;
+    using ValueType = Value;
+    using Codec = KeyCodec<Key>;
+    using StoredKey = typename Codec::Encoded;   // what nodes hold and compare
+    using Node = BPlusTreeNode<StoredKey, Value, Order>;
+    using LeafNode = BPlusTreeLeafNode<StoredKey, Value, Order>;
+    using InternalNode = BPlusTreeInternalNode<StoredKey, Value, Order>;
+
+    // Maps a record to the key it is indexed under
+    using KeyExtractor = Key (*)(const Record&);
+
+    struct Entry {
+        Key key;
+        Value value;
+        double measure;               // the record's measure column value, 0 when the tree has no measure
+        std::vector<uint8_t> payload;  // the record's covered columns in their stored widths, in payload column order
+    };
+
+    static constexpr int order = Order;
+
+    // Record ids a RecordCursor pulls and fetches at a time
+    static constexpr size_t cursorBatchSize = 256;
+
+    // Lazy cursor over the entries with lower <= key <= upper, in key order and record id order within a key.
+    // It holds one leaf and one posting list position, so it runs in constant memory and can stop at any point.
+    class Cursor {
+    public:
+        bool valid() const { return leaf != nullptr; }
+        Key key() const { return Codec::decode(leaf->keys[slot]); }
+        Value value() const { return current; }
+        int indexNodesAccessed() const { return nodesAccessed; }
+        void next();
+
+    private:
+        friend class BPlusTree;
+
+        std::shared_ptr<LeafNode> leaf;
+        int slot = 0;
+        StoredKey upper{};
+        typename PostingList<Value>::Reader reader;
+        Value current = 0;
+        int nodesAccessed = 0;
+
+        void settle();
+    };
+
+    // Cursor over the same entries in descending order: keys from upper down to lower, and record ids descending
+    // within a key. Holds one leaf and the decoded posting list of one key.
+    class ReverseCursor {
+    public:
+        bool valid() const { return leaf != nullptr; }
+        Key key() const { return Codec::decode(leaf->keys[slot]); }
+        Value value() const { return values[remaining - 1]; }
+        int indexNodesAccessed() const { return nodesAccessed; }
+        void next();
+
+    private:
+        friend class BPlusTree;
+
+        std::shared_ptr<LeafNode> leaf;
+        int slot = 0;
+        StoredKey lower{};
+        std::vector<Value> values;
+        size_t remaining = 0;
+        int nodesAccessed = 0;
+
+        void settle();
+    };
+
+    // Streams the records of a range: record ids come from a Cursor one batch at a time and each batch is
+    // read block by block, so memory is bounded by the batch whatever the width of the range. Batches follow
+    // key order; records within a batch come in block order. The block a batch ends on is still at hand for the
+    // next one, so a block straddling two batches counts as one read, as in rangeSearch.
+    class RecordCursor {
+    public:
+        bool valid() const { return position < buffer.size(); }
+        const Record& record() const { return buffer[position]; }
+        void next();
+        int indexNodesAccessed() const { return cursor.indexNodesAccessed(); }
+        int dataBlocksAccessed() const { return blocksRead; }
+
+    private:
+        friend class BPlusTree;
+
+        RecordCursor(Cursor cursor, Storage& storage);
+
+        Cursor cursor;
+        Storage* storage;
+        std::vector<Record> buffer;
+        size_t position = 0;
+        int blocksRead = 0;
+        int heldBlock = -1;   // the block the previous batch ended on, still at hand for the next one
+
+        void refill();
+    };
+
+    // measure is the column whose per-subtree sums are kept for rangeAggregate; without one only counts are kept.
+    // payload columns are copied into the leaves so queries reading only them never touch a data block.
+    BPlusTree(const std::string& indexFilename, KeyExtractor keyOf, std::optional<Column> measure = std::nullopt,
+              std::vector<Column> payload = {});
 
     void buildFromStorage(const Storage& storage);
-    void insert(float key, uint32_t recordId);
-    SearchResult rangeSearch(float lower, float upper, Storage& storage);
+    void bulkLoad(std::vector<Entry> entries);
+    void insert(Key key, Value value, double measureValue = 0.0, const std::vector<uint8_t>& payloadRow = {});
+    void insertRecord(const Record& record) { insert(keyOf(record), record.recordId, measureOf(record), payloadOf(record)); }
+    // Sorted insertion of many entries: one descent and at most one split per leaf that receives keys, and
+    // one update per parent per level, instead of a descent and possible split chain per entry
+    void insertBatch(std::vector<Entry> entries);
+    void insertRecords(const std::vector<Record>& records);
+    uint32_t count(Key key);
+    // count for many independent keys, descended groupSize at a time in lockstep: each probe prefetches the
+    // node it moves to and the rest of the group is searched while that miss is in flight
+    std::vector<uint32_t> countBatch(const std::vector<Key>& keys, size_t groupSize = 16);
+    SearchResult rangeSearch(Key lower, Key upper, Storage& storage);
+    // rangeSearch split into sub-ranges of about equal entry counts at separators (and, below the last inner
+    // level, leaf keys), each walked and fetched on its own pool thread. Records come back in key order when
+    // keyOrder is set, else in block order per sub-range; dataBlocksAccessed adds up every sub-range's reads.
+    SearchResult rangeSearchParallel(Key lower, Key upper, Storage& storage, bool keyOrder = false);
+    // Many ranges in one sorted sweep over the leaves, with every record fetched once for the whole batch. A
+    // range starting past the current leaf descends from the lowest node of the previous path that holds it.
+    BatchSearchResult rangeSearchBatch(const std::vector<std::pair<Key, Key>>& ranges, Storage& storage);
+    BatchSearchResult lookupBatch(const std::vector<Key>& keys, Storage& storage);
+    Cursor openCursor(Key lower, Key upper);
+    ReverseCursor openReverseCursor(Key lower, Key upper);
+    // ORDER BY key DESC (or ASC) LIMIT k over the whole index, in key order; stops after k entries
+    SearchResult topK(size_t k, Storage& storage, bool descending = true);
+    RecordCursor openRecordCursor(Key lower, Key upper, Storage& storage);
+    // Index-only scan: records carry their recordId and the payload columns only, no data block is read
+    SearchResult rangeSearchCovered(Key lower, Key upper);
+    bool covers(const std::vector<Column>& columns) const;
+    AggregateResult rangeAggregate(Key lower, Key upper);
     void printStatistics();
     void saveToFile();
     void loadFromFile();
     void verifyTree();
     std::vector<int> getNodeCounts() const;
+    int getTreeHeight() const { return tree_height; }
+    const std::string& getIndexFilename() const { return indexFilename; }
+    std::optional<Column> getMeasure() const { return measure; }
+    // How many leaves (and, within a leaf, posting lists) rangeSearch requests ahead of the scan; 0 turns it off
+    void setPrefetchDistance(int distance) { prefetchDistance = std::max(distance, 0); }
+    int getPrefetchDistance() const { return prefetchDistance; }
+    const std::vector<Column>& getPayload() const { return payload; }
 
 private:
-    std::shared_ptr<BPlusTreeNode> root;
-    int order;
+    std::shared_ptr<Node> root;
     std::string indexFilename;
-    int tree_height;
-    int totalNodes = 0;
-    int internalNodes = 0;
-    int leafNodes = 0;
-
-    std::shared_ptr<BPlusTreeNode> findLeaf(float key, int& indexNodeCounter);
-    void insertIntoLeaf(std::shared_ptr<BPlusTreeNode> leaf, float key, uint32_t recordId);
-    void splitLeafNode(std::shared_ptr<BPlusTreeNode> leaf, float newKey, uint32_t recordId);
-    void insertIntoParent(std::shared_ptr<BPlusTreeNode> leftChild, float key, std::shared_ptr<BPlusTreeNode> rightChild);
-    void splitNonLeafNode(std::shared_ptr<BPlusTreeNode> node, int index, float key, std::shared_ptr<BPlusTreeNode> rightChild);
-    int getHeight(std::shared_ptr<BPlusTreeNode> node);
-    void writeNode(std::ofstream& file, std::shared_ptr<BPlusTreeNode> node);
-    std::shared_ptr<BPlusTreeNode> readNode(std::ifstream& file);
-    void _getTotalNodes();
-};
-
-#endif // BPLUSTREE_H
\ No newline at end of file
+    KeyExtractor keyOf;
+    std::optional<Column> measure;
+    std::vector<Column> payload;
+    std::vector<std::pair<size_t, size_t>> payloadFields;   // (offset in Record, width) of each payload column
+    size_t payloadRowBytes = 0;
+    int tree_height = 0;
+    // Counted over the whole tree, so inserts only mark them stale and the next reader recounts them
+    mutable bool statsStale = false;
+    mutable int totalNodes = 0;
+    mutable int internalNodes = 0;
+    mutable int leafNodes = 0;
+    mutable size_t distinctKeys = 0;
+    mutable size_t totalEntries = 0;
+    mutable size_t postingBytes = 0;
+    mutable size_t payloadBytes = 0;
+    mutable size_t overflowPages = 0;   // pages beyond the first taken by leaves holding one oversized key
+    int prefetchDistance = 0;   // off: in Task 9 at -O2 no distance beats plain scanning by more than noise
+
+    std::shared_ptr<LeafNode> findLeaf(StoredKey key, int& indexNodeCounter);
+    Cursor cursorFrom(StoredKey lower, StoredKey upper);
+    ReverseCursor reverseCursorFrom(StoredKey lower, StoredKey upper);
+    void insertIntoLeaf(LeafNode& leaf, StoredKey key, Value value, double measureValue, const std::vector<uint8_t>& payloadRow);
+    void splitLeafNode(std::shared_ptr<LeafNode> leaf);
+    // Encoded size of one leaf entry, as writeNode stores it: key, posting list with its two lengths, sum, payload
+    size_t leafEntryBytes(const PostingList<Value>& posting) const;
+    size_t leafBytes(const LeafNode& leaf) const;
+    std::vector<size_t> leafSizes(const std::vector<size_t>& entryBytes) const;
+    // Byte offset in payloadRows of the first row of the key at index
+    size_t payloadOffset(const LeafNode& leaf, int index) const;
+    void insertIntoParent(std::shared_ptr<Node> leftChild, StoredKey key, std::shared_ptr<Node> rightChild);
+    void splitNonLeafNode(std::shared_ptr<InternalNode> node);
+    int getHeight(std::shared_ptr<Node> node);
+    void writeNode(std::ofstream& file, const std::shared_ptr<Node>& node);
+    std::shared_ptr<Node> readNode(std::ifstream& file);
+    void _getTotalNodes() const;
+
+    double measureOf(const Record& record) const { return measure ? columnValue(record, *measure) : 0.0; }
+    std::vector<uint8_t> payloadOf(const Record& record) const;
+    std::pair<uint32_t, double> nodeTotals(const Node& node) const;
+    std::pair<uint32_t, double> rebuildAggregates(const std::shared_ptr<Node>& node);
+    std::pair<uint32_t, double> prefixAggregate(StoredKey bound, bool inclusive, int& indexNodeCounter);
+};
+
+// Lower and upper keys of every entry that starts with prefix, for a single descent and one contiguous leaf walk
+template <typename First, typename Second>
+std::pair<CompositeKey<First, Second>, CompositeKey<First, Second>> prefixRange(First prefix) {
+    return {{prefix, std::numeric_limits<Second>::lowest()}, {prefix, std::numeric_limits<Second>::max()}};
+}
+
+float fgPctHomeKey(const Record& record);
+int gameDateKey(const Record& record);
+int teamIdKey(const Record& record);
+uint8_t ptsHomeKey(const Record& record);
+float ftPctHomeKey(const Record& record);
+float fg3PctHomeKey(const Record& record);
+uint8_t astHomeKey(const Record& record);
+uint8_t rebHomeKey(const Record& record);
+uint8_t homeTeamWinsKey(const Record& record);
+CompositeKey<int, int> teamDateKey(const Record& record);
+
+// Indexes share one engine; the key type picks the node layout at compile time
+using FgPctHomeIndex = BPlusTree<float, uint32_t>;
+using GameDateIndex = BPlusTree<int, uint32_t>;
+using TeamIdIndex = BPlusTree<int, uint32_t>;
+using PtsHomeIndex = BPlusTree<uint8_t, uint32_t>;
+using TeamDateIndex = BPlusTree<CompositeKey<int, int>, uint32_t>;
+
+#endif // BPLUSTREE_H
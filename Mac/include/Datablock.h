@@ -48,6 +48,9 @@ public:
     
     bool addRecord(uint16_t recordId, const std::vector<char>& recordData);
     std::vector<char> getRecord(uint16_t recordId) const;
+    // Same, for a caller that already knows the record's offset, so the per-block directory is skipped
+    std::vector<char> getRecordAt(uint16_t offset) const;
+    const char* recordAddress(uint16_t offset) const { return data.data() + offset; }
     
     uint16_t getId() const { return header.id; }
     uint16_t getSize() const { return header.currentSize; }
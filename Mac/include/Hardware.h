@@ -0,0 +1,39 @@
+#ifndef HARDWARE_H
+#define HARDWARE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+// Hint that the cache line holding address will be read soon; a no-op where the compiler has no builtin for it
+#if defined(__GNUC__) || defined(__clang__)
+#define PREFETCH(address) __builtin_prefetch(address)
+#else
+#define PREFETCH(address) ((void)(address))
+#endif
+
+// CPU cycles, instructions and last-level cache misses of this thread between start() and stop(), read through
+// perf_event_open on Linux. Elsewhere, or when the kernel grants no access, available() is false and counts are 0.
+class PerfCounters {
+public:
+    enum Event { Cycles, Instructions, CacheMisses, EventCount };
+
+    PerfCounters();
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    bool available() const { return isAvailable; }
+    void start();
+    void stop();
+    uint64_t count(Event event) const { return counts[event]; }
+    // "cycles ... instructions ... cache misses", or why no counts are available
+    std::string summary() const;
+
+private:
+    std::array<int, EventCount> fds;
+    std::array<uint64_t, EventCount> counts{};
+    bool isAvailable = false;
+};
+
+#endif // HARDWARE_H
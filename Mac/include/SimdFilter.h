@@ -0,0 +1,50 @@
+#ifndef SIMDFILTER_H
+#define SIMDFILTER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Filter kernels over one column's values, e.g. a block's worth read straight from its record bytes. A kernel
+// tests every value against a predicate and writes a selection bitmask: bit i % 64 of word i / 64 is set when
+// value i passes, and the bits past the last value are 0. Compaction then turns a mask into the positions or the
+// values that passed. Each kernel has an AVX-512, an AVX2 and a scalar version, picked at run time from what
+// the CPU supports; the vector versions are compiled for x86 with GCC or Clang only, elsewhere all run scalar.
+
+// Instruction sets the kernels can run with, in increasing order
+enum class SimdLevel { Scalar, AVX2, AVX512 };
+
+// The best level this CPU and build support
+SimdLevel detectedSimdLevel();
+// The level the kernels run with; the detected one unless lowered to compare them
+SimdLevel activeSimdLevel();
+// Capped at the detected level
+void setSimdLevel(SimdLevel level);
+std::string simdLevelName(SimdLevel level);
+
+inline size_t selectionWords(size_t count) { return (count + 63) / 64; }
+
+// lower <= values[i] <= upper
+void selectRange(const float* values, size_t count, float lower, float upper, uint64_t* mask);
+void selectRange(const int32_t* values, size_t count, int32_t lower, int32_t upper, uint64_t* mask);
+// values[i] == value
+void selectEqual(const float* values, size_t count, float value, uint64_t* mask);
+void selectEqual(const int32_t* values, size_t count, int32_t value, uint64_t* mask);
+// values[i] is one of the setSize values of set; meant for short lists, every value is compared against all of them
+void selectIn(const float* values, size_t count, const float* set, size_t setSize, uint64_t* mask);
+void selectIn(const int32_t* values, size_t count, const int32_t* set, size_t setSize, uint64_t* mask);
+
+// Every one of count values selected
+void selectAll(uint64_t* mask, size_t count);
+// mask &= other and mask |= other, over the words of count values
+void intersectSelection(uint64_t* mask, const uint64_t* other, size_t count);
+void uniteSelection(uint64_t* mask, const uint64_t* other, size_t count);
+size_t countSelected(const uint64_t* mask, size_t count);
+// Writes the positions of the selected values to out, in order, and returns how many there are. out must have
+// room for count entries, since the vector versions write whole registers.
+size_t compactSelected(const uint64_t* mask, size_t count, uint32_t* out);
+// Same with the selected values themselves; out may be values, which is then compacted in place
+size_t compactValues(const float* values, const uint64_t* mask, size_t count, float* out);
+size_t compactValues(const int32_t* values, const uint64_t* mask, size_t count, int32_t* out);
+
+#endif // SIMDFILTER_H
@@ -0,0 +1,130 @@
+#ifndef SNAPSHOTBPLUSTREE_H
+#define SNAPSHOTBPLUSTREE_H
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <utility>
+#include <vector>
+#include "BPlusTree.h"
+
+// Epoch-based reclamation. A reader announces the global epoch in its thread's slot while it holds pointers
+// into shared structures; something unlinked while the epoch was e is freed once every announced epoch is
+// past e, since no reader can still reach it. Slots are fixed, one per thread that ever reads.
+class EpochManager {
+public:
+    // Threads that may have used an epoch manager and still be running at once
+    static constexpr int maxThreads = 256;
+
+    // Pins the current epoch for this thread; calls nest, and only the outermost leave() unpins it
+    void enter();
+    void leave();
+    // Moves the epoch on and returns the one that was current, to retire what was just unlinked under
+    uint64_t advance() { return globalEpoch.fetch_add(1); }
+    // Every epoch some reader may still be in is at least this
+    uint64_t oldestActive() const;
+
+private:
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0};   // 0 when the thread holds nothing, else the pinned epoch
+        int depth = 0;                    // touched only by the owning thread
+    };
+
+    std::atomic<uint64_t> globalEpoch{1};
+    std::array<Slot, maxThreads> slots;
+
+    static int threadSlot();
+};
+
+// B+ tree whose published versions never change. Readers take a snapshot (a version's root) without any lock and
+// can scan it for as long as they like; a writer copies the nodes on the paths it changes, publishes the new
+// root with one atomic store, and retires the replaced nodes to the epoch manager. Writers are serialized among
+// themselves only, so long scans never hold up inserts and inserts never hold up scans. Leaves are not chained,
+// since a chain would force every copied leaf's neighbours to be copied too; scans walk down from the root.
+template <typename Key, typename Value = uint32_t, int Order = pageOrder<Key, Value>()>
+class SnapshotBPlusTree {
+public:
+    static_assert(Order >= 4, "B+ tree order must be at least 4");
+
+    using Codec = KeyCodec<Key>;
+    using StoredKey = typename Codec::Encoded;
+    using EntryKey = std::pair<StoredKey, Value>;   // what nodes hold and compare
+
+private:
+    struct Node {
+        bool isLeaf;
+        std::vector<EntryKey> keys;           // entries in a leaf, separators in an inner node; at most Order - 1
+        std::vector<const Node*> children;    // inner nodes only; separator i starts children[i + 1]
+
+        explicit Node(bool leaf) : isLeaf(leaf) {}
+    };
+
+    struct Version {
+        const Node* root;
+        uint64_t number;
+        size_t entries;
+    };
+
+public:
+    // One published version, kept reachable for as long as the snapshot lives
+    class Snapshot {
+    public:
+        Snapshot(Snapshot&& other) noexcept;
+        Snapshot(const Snapshot&) = delete;
+        Snapshot& operator=(const Snapshot&) = delete;
+        Snapshot& operator=(Snapshot&&) = delete;
+        ~Snapshot();
+
+        std::vector<Value> rangeSearch(Key lower, Key upper) const;
+        uint64_t version() const { return current->number; }
+        size_t size() const { return current->entries; }
+
+    private:
+        friend class SnapshotBPlusTree;
+
+        Snapshot(EpochManager* epochs, const Version* current) : epochs(epochs), current(current) {}
+
+        EpochManager* epochs;
+        const Version* current;
+    };
+
+    SnapshotBPlusTree();
+    SnapshotBPlusTree(const SnapshotBPlusTree&) = delete;
+    SnapshotBPlusTree& operator=(const SnapshotBPlusTree&) = delete;
+    ~SnapshotBPlusTree();
+
+    // Safe from any thread at any time, alongside writers
+    Snapshot snapshot() const;
+    std::vector<Value> rangeSearch(Key lower, Key upper) const { return snapshot().rangeSearch(lower, upper); }
+
+    // One new version per call; a node is copied at most once per call however many entries land in it
+    void insert(Key key, Value value);
+    void insertBatch(const std::vector<std::pair<Key, Value>>& entries);
+    // Frees what no reader can reach any more; writers also do this after every publish
+    void reclaimRetired();
+
+    int getTreeHeight() const;
+    size_t getRetiredNodes() const { return retiredNodes; }
+    size_t getReclaimedNodes() const { return reclaimedNodes; }
+
+private:
+    mutable EpochManager epochs;
+    std::atomic<const Version*> published;
+
+    // Writer state, guarded by writerMutex
+    std::mutex writerMutex;
+    struct Retired {
+        uint64_t epoch;
+        const Node* node;
+        const Version* version;
+    };
+    std::vector<Retired> limbo;
+    size_t retiredNodes = 0;
+    size_t reclaimedNodes = 0;
+
+    static void collect(const Node* node, const EntryKey& lower, const EntryKey& upper, std::vector<Value>& out);
+    static void freeTree(const Node* node);
+    void reclaim();
+};
+
+#endif // SNAPSHOTBPLUSTREE_H
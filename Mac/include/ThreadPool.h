@@ -0,0 +1,146 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TaskGroup;
+
+// Work-stealing scheduler. Every worker owns a deque: it pushes and pops its own tasks at the back, where the
+// work it split most recently is still in its cache, and once it runs dry it steals from the front of another
+// deque, where the oldest and usually largest pieces sit. Threads outside the pool hand tasks in through a shared
+// queue and run tasks themselves while they wait, so a pool of N threads is N - 1 workers plus the waiting caller.
+class ThreadPool {
+public:
+    // Timings of every task run under one label
+    struct TaskStats {
+        size_t tasks = 0;
+        size_t stolen = 0;                // run by another thread than the one that spawned them
+        double totalMicroseconds = 0;
+        double longestMicroseconds = 0;
+    };
+
+    explicit ThreadPool(size_t threads = std::thread::hardware_concurrency());
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool();
+
+    // The pool that ingest, index builds, loading and scans run on
+    static ThreadPool& shared();
+
+    // Threads that run tasks, counting the caller that waits; 1 runs everything on the caller
+    size_t threadCount() const { return queues.size(); }
+    // Restarts the pool with another thread count; nothing may be running on it
+    void resize(size_t threads);
+
+    // Runs body(chunkBegin, chunkEnd) over [begin, end) in chunks of at most grain items and returns once all are done
+    void parallelFor(const std::string& label, size_t begin, size_t end, size_t grain,
+                     const std::function<void(size_t, size_t)>& body);
+
+    std::map<std::string, TaskStats> stats() const;
+    void resetStats();
+    void printStats() const;
+
+private:
+    friend class TaskGroup;
+
+    struct Task {
+        std::function<void()> run;
+        TaskGroup* group;
+    };
+    struct alignas(64) TaskQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::thread> workers;
+    // One per worker, then the shared queue for threads outside the pool; set up before any worker starts
+    std::vector<std::unique_ptr<TaskQueue>> queues;
+    std::atomic<size_t> queued{0};
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool stopping = false;
+
+    mutable std::mutex statsMutex;
+    std::map<std::string, TaskStats> taskStats;
+
+    void start(size_t threads);
+    void stop();
+    // Queue the calling thread pushes to and pops from
+    size_t homeQueue() const;
+    void push(Task task);
+    // Runs one task, from the caller's own queue if it has any, else stolen; false when there was none
+    bool runOne();
+    void workerLoop(size_t index);
+};
+
+// Tasks spawned together and waited for together. wait() rethrows the first exception any of them threw.
+class TaskGroup {
+public:
+    explicit TaskGroup(std::string label, ThreadPool& pool = ThreadPool::shared());
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    ~TaskGroup();
+
+    void run(std::function<void()> task);
+    // Runs queued tasks, this group's or others', until every task of this group has finished
+    void wait();
+
+private:
+    friend class ThreadPool;
+
+    ThreadPool& pool;
+    std::string label;
+    std::atomic<size_t> pending{0};
+    std::mutex errorMutex;
+    std::exception_ptr error;
+};
+
+// Sorts one run per thread in parallel, then merges neighbouring runs pairwise, each round in parallel
+template <typename Iterator, typename Compare>
+void parallelSort(ThreadPool& pool, const std::string& label, Iterator first, Iterator last, Compare compare) {
+    const size_t minimumRun = 4096;
+    size_t size = static_cast<size_t>(last - first);
+    size_t runs = std::min(pool.threadCount(), std::max<size_t>(1, size / minimumRun));
+    if (runs <= 1) {
+        std::sort(first, last, compare);
+        return;
+    }
+
+    std::vector<size_t> bounds;
+    for (size_t i = 0; i <= runs; ++i) {
+        bounds.push_back(size * i / runs);
+    }
+    pool.parallelFor(label, 0, runs, 1, [&](size_t from, size_t to) {
+        for (size_t run = from; run < to; ++run) {
+            std::sort(first + bounds[run], first + bounds[run + 1], compare);
+        }
+    });
+    while (bounds.size() > 2) {
+        size_t pairs = (bounds.size() - 1) / 2;
+        pool.parallelFor(label, 0, pairs, 1, [&](size_t from, size_t to) {
+            for (size_t pair = from; pair < to; ++pair) {
+                std::inplace_merge(first + bounds[2 * pair], first + bounds[2 * pair + 1],
+                                   first + bounds[2 * pair + 2], compare);
+            }
+        });
+        std::vector<size_t> merged;
+        for (size_t i = 0; i < bounds.size(); i += 2) {
+            merged.push_back(bounds[i]);
+        }
+        if (merged.back() != bounds.back()) merged.push_back(bounds.back());
+        bounds = std::move(merged);
+    }
+}
+
+#endif // THREADPOOL_H
@@ -0,0 +1,279 @@
+#include "ConcurrentBPlusTree.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <thread>
+
+// A failed attempt usually means a writer holds a latch; giving up the time slice lets it finish, which
+// matters once there are more threads than cores
+static void backOff(int attempt) {
+    if (attempt > 0) std::this_thread::yield();
+}
+
+template <typename Key, typename Value, int Order>
+ConcurrentBPlusTree<Key, Value, Order>::ConcurrentBPlusTree() {
+    root.store(newLeaf(), std::memory_order_release);
+}
+
+template <typename Key, typename Value, int Order>
+typename ConcurrentBPlusTree<Key, Value, Order>::LeafNode* ConcurrentBPlusTree<Key, Value, Order>::newLeaf() {
+    std::lock_guard<std::mutex> guard(nodesMutex);
+    leaves.push_back(std::make_unique<LeafNode>());
+    return leaves.back().get();
+}
+
+template <typename Key, typename Value, int Order>
+typename ConcurrentBPlusTree<Key, Value, Order>::InnerNode* ConcurrentBPlusTree<Key, Value, Order>::newInner() {
+    std::lock_guard<std::mutex> guard(nodesMutex);
+    inners.push_back(std::make_unique<InnerNode>());
+    return inners.back().get();
+}
+
+template <typename Key, typename Value, int Order>
+void ConcurrentBPlusTree<Key, Value, Order>::insert(Key rawKey, Value value) {
+    const EntryKey entry{Codec::encode(rawKey), value};
+
+    // Every pass is one attempt from the root; a latch that is taken or a version that moved ends the pass
+    for (int attempt = 0;; ++attempt) {
+        backOff(attempt);
+        Node* node = root.load(std::memory_order_acquire);
+        uint64_t version;
+        if (!node->latch.readLock(version) || node != root.load(std::memory_order_acquire)) continue;
+        InnerNode* parent = nullptr;
+        uint64_t parentVersion = 0;
+
+        while (true) {
+            if (node->count == Order - 1) {
+                // Split a full node right away, while its parent is known to have room for one more separator
+                if (parent && !parent->latch.upgradeToWriteLock(parentVersion)) break;
+                if (!node->latch.upgradeToWriteLock(version)) {
+                    if (parent) parent->latch.writeUnlock();
+                    break;
+                }
+                if (!parent && node != root.load(std::memory_order_acquire)) {
+                    node->latch.writeUnlock();
+                    break;
+                }
+
+                auto [separator, sibling] = split(node);
+                if (parent) {
+                    insertIntoInner(parent, separator, sibling);
+                } else {
+                    InnerNode* newRoot = newInner();
+                    newRoot->keys[0] = separator;
+                    newRoot->children[0] = node;
+                    newRoot->children[1] = sibling;
+                    newRoot->count = 1;
+                    root.store(newRoot, std::memory_order_release);
+                    treeHeight.fetch_add(1, std::memory_order_relaxed);
+                }
+                node->latch.writeUnlock();
+                if (parent) parent->latch.writeUnlock();
+                break;
+            }
+
+            if (node->isLeaf) {
+                auto leaf = static_cast<LeafNode*>(node);
+                if (!leaf->latch.upgradeToWriteLock(version)) break;
+                auto end = leaf->entries.begin() + leaf->count;
+                auto position = std::lower_bound(leaf->entries.begin(), end, entry);
+                // The same (key, value) pair is stored once
+                if (position == end || *position != entry) {
+                    std::copy_backward(position, end, end + 1);
+                    *position = entry;
+                    leaf->count++;
+                }
+                leaf->latch.writeUnlock();
+                return;
+            }
+
+            // The child pointer is only trusted once the parent is shown unchanged after the child's version is read
+            auto inner = static_cast<InnerNode*>(node);
+            int index = static_cast<int>(std::upper_bound(inner->keys.begin(), inner->keys.begin() + inner->count, entry) -
+                                         inner->keys.begin());
+            Node* child = inner->children[index];
+            uint64_t childVersion;
+            if (!child || !child->latch.readLock(childVersion) || !inner->latch.validate(version)) break;
+            parent = inner;
+            parentVersion = version;
+            node = child;
+            version = childVersion;
+        }
+    }
+}
+
+template <typename Key, typename Value, int Order>
+std::pair<typename ConcurrentBPlusTree<Key, Value, Order>::EntryKey, typename ConcurrentBPlusTree<Key, Value, Order>::Node*>
+ConcurrentBPlusTree<Key, Value, Order>::split(Node* node) {
+    int mid = node->count / 2;
+    if (node->isLeaf) {
+        auto leaf = static_cast<LeafNode*>(node);
+        LeafNode* sibling = newLeaf();
+        std::copy(leaf->entries.begin() + mid, leaf->entries.begin() + leaf->count, sibling->entries.begin());
+        sibling->count = static_cast<uint16_t>(leaf->count - mid);
+        sibling->next = leaf->next;
+        leaf->count = static_cast<uint16_t>(mid);
+        // The sibling is complete before the chain points at it
+        leaf->next = sibling;
+        return {sibling->entries[0], sibling};
+    }
+
+    auto inner = static_cast<InnerNode*>(node);
+    InnerNode* sibling = newInner();
+    EntryKey separator = inner->keys[mid];
+    std::copy(inner->keys.begin() + mid + 1, inner->keys.begin() + inner->count, sibling->keys.begin());
+    std::copy(inner->children.begin() + mid + 1, inner->children.begin() + inner->count + 1, sibling->children.begin());
+    sibling->count = static_cast<uint16_t>(inner->count - mid - 1);
+    inner->count = static_cast<uint16_t>(mid);
+    return {separator, sibling};
+}
+
+template <typename Key, typename Value, int Order>
+void ConcurrentBPlusTree<Key, Value, Order>::insertIntoInner(InnerNode* inner, const EntryKey& separator, Node* child) {
+    int index = static_cast<int>(std::upper_bound(inner->keys.begin(), inner->keys.begin() + inner->count, separator) -
+                                 inner->keys.begin());
+    std::copy_backward(inner->keys.begin() + index, inner->keys.begin() + inner->count,
+                       inner->keys.begin() + inner->count + 1);
+    std::copy_backward(inner->children.begin() + index + 1, inner->children.begin() + inner->count + 1,
+                       inner->children.begin() + inner->count + 2);
+    inner->keys[index] = separator;
+    inner->children[index + 1] = child;
+    inner->count++;
+}
+
+template <typename Key, typename Value, int Order>
+const typename ConcurrentBPlusTree<Key, Value, Order>::LeafNode*
+ConcurrentBPlusTree<Key, Value, Order>::findLeaf(const EntryKey& entry, uint64_t& version) const {
+    for (int attempt = 0;; ++attempt) {
+        backOff(attempt);
+        const Node* node = root.load(std::memory_order_acquire);
+        uint64_t nodeVersion;
+        if (!node->latch.readLock(nodeVersion) || node != root.load(std::memory_order_acquire)) continue;
+
+        bool restart = false;
+        while (!node->isLeaf) {
+            auto inner = static_cast<const InnerNode*>(node);
+            int count = std::min<int>(inner->count, Order - 1);
+            int index = static_cast<int>(std::upper_bound(inner->keys.begin(), inner->keys.begin() + count, entry) -
+                                         inner->keys.begin());
+            const Node* child = inner->children[index];
+            uint64_t childVersion;
+            if (!child || !child->latch.readLock(childVersion) || !inner->latch.validate(nodeVersion)) {
+                restart = true;
+                break;
+            }
+            node = child;
+            nodeVersion = childVersion;
+        }
+        if (!restart) {
+            version = nodeVersion;
+            return static_cast<const LeafNode*>(node);
+        }
+    }
+}
+
+template <typename Key, typename Value, int Order>
+std::vector<Value> ConcurrentBPlusTree<Key, Value, Order>::rangeSearch(Key rawLower, Key rawUpper) const {
+    std::vector<Value> result;
+    const StoredKey upper = Codec::encode(rawUpper);
+
+    // After a restart the scan resumes just past the last entry it kept, so nothing is returned twice
+    EntryKey resume{Codec::encode(rawLower), std::numeric_limits<Value>::lowest()};
+    bool resumeInclusive = true;
+
+    while (true) {
+        uint64_t version;
+        const LeafNode* leaf = findLeaf(resume, version);
+
+        while (true) {
+            // Copy what the leaf holds in range, and keep it only if the leaf did not change meanwhile
+            size_t kept = result.size();
+            EntryKey last = resume;
+            bool done = false;
+            int count = std::min<int>(leaf->count, Order - 1);
+            for (int i = 0; i < count; ++i) {
+                const EntryKey& entry = leaf->entries[i];
+                if (upper < entry.first) {
+                    done = true;
+                    break;
+                }
+                if (resumeInclusive ? !(entry < resume) : resume < entry) {
+                    result.push_back(entry.second);
+                    last = entry;
+                }
+            }
+            const LeafNode* next = leaf->next;
+            if (!leaf->latch.validate(version)) {
+                result.resize(kept);
+                break;
+            }
+            if (result.size() > kept) {
+                resume = last;
+                resumeInclusive = false;
+            }
+            if (done || !next) return result;
+
+            uint64_t nextVersion;
+            if (!next->latch.readLock(nextVersion)) break;
+            leaf = next;
+            version = nextVersion;
+        }
+    }
+}
+
+template <typename Key, typename Value, int Order>
+size_t ConcurrentBPlusTree<Key, Value, Order>::size() const {
+    uint64_t unused;
+    size_t total = 0;
+    for (const LeafNode* leaf = findLeaf({0, 0}, unused); leaf; leaf = leaf->next) {
+        total += leaf->count;
+    }
+    return total;
+}
+
+template <typename Key, typename Value, int Order>
+void ConcurrentBPlusTree<Key, Value, Order>::verifyTree() const {
+    std::cout << "Verifying concurrent B+ tree structure..." << std::endl;
+
+    // Every leaf sits at the tree height and every node's keys ascend
+    std::vector<std::pair<const Node*, int>> stack = {{root.load(), 1}};
+    while (!stack.empty()) {
+        auto [node, depth] = stack.back();
+        stack.pop_back();
+        if (node->isLeaf) {
+            if (depth != getTreeHeight()) {
+                std::cout << "Error: Leaf depth does not match tree height" << std::endl;
+            }
+            continue;
+        }
+        auto inner = static_cast<const InnerNode*>(node);
+        for (int i = 1; i < inner->count; ++i) {
+            if (!(inner->keys[i - 1] < inner->keys[i])) {
+                std::cout << "Error: Separators not in strictly ascending order" << std::endl;
+            }
+        }
+        for (int i = 0; i <= inner->count; ++i) {
+            stack.emplace_back(inner->children[i], depth + 1);
+        }
+    }
+
+    // The leaf chain reads every entry once, in order
+    uint64_t unused;
+    const EntryKey* previous = nullptr;
+    for (const LeafNode* leaf = findLeaf({0, 0}, unused); leaf; leaf = leaf->next) {
+        for (int i = 0; i < leaf->count; ++i) {
+            if (previous && !(*previous < leaf->entries[i])) {
+                std::cout << "Error: Leaf entries not in strictly ascending order" << std::endl;
+            }
+            previous = &leaf->entries[i];
+        }
+    }
+
+    std::cout << "Concurrent B+ tree verification complete" << std::endl;
+}
+
+// Compiled for the same key types as BPlusTree
+template class ConcurrentBPlusTree<float, uint32_t>;
+template class ConcurrentBPlusTree<int, uint32_t>;
+template class ConcurrentBPlusTree<uint8_t, uint32_t>;
+template class ConcurrentBPlusTree<CompositeKey<int, int>, uint32_t>;
@@ -81,7 +81,10 @@ std::vector<char> Datablock::getRecord(uint16_t recordId) const {
         throw std::runtime_error("Record not found");
     }
     
-    uint16_t offset = it->second;
+    return getRecordAt(it->second);
+}
+
+std::vector<char> Datablock::getRecordAt(uint16_t offset) const {
     uint8_t size;
     std::memcpy(&size, &data[offset], sizeof(uint8_t));
     
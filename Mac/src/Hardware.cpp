@@ -0,0 +1,71 @@
+#include "Hardware.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#endif
+
+PerfCounters::PerfCounters() {
+    fds.fill(-1);
+#ifdef __linux__
+    const std::array<uint64_t, EventCount> configs = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                                      PERF_COUNT_HW_CACHE_MISSES};
+    isAvailable = true;
+    for (int i = 0; i < EventCount; ++i) {
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        attributes.type = PERF_TYPE_HARDWARE;
+        attributes.config = configs[i];
+        attributes.disabled = 1;
+        // User space only, which unprivileged processes may count under the default paranoid level
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        fds[i] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (fds[i] < 0) isAvailable = false;
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters() {
+#ifdef __linux__
+    for (int fd : fds) {
+        if (fd >= 0) close(fd);
+    }
+#endif
+}
+
+void PerfCounters::start() {
+#ifdef __linux__
+    if (!isAvailable) return;
+    for (int fd : fds) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+void PerfCounters::stop() {
+#ifdef __linux__
+    if (!isAvailable) return;
+    for (int i = 0; i < EventCount; ++i) {
+        ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fds[i], &counts[i], sizeof(uint64_t)) != sizeof(uint64_t)) counts[i] = 0;
+    }
+#endif
+}
+
+std::string PerfCounters::summary() const {
+    if (!isAvailable) {
+#ifdef __linux__
+        return "hardware counters unavailable (perf_event_open refused)";
+#else
+        return "hardware counters unavailable on this platform";
+#endif
+    }
+    return std::to_string(counts[Cycles]) + " cycles, " + std::to_string(counts[Instructions]) + " instructions, " +
+           std::to_string(counts[CacheMisses]) + " cache misses";
+}
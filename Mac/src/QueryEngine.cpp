@@ -0,0 +1,295 @@
+#include "QueryEngine.h"
+#include "SimdFilter.h"
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+static size_t columnIndex(Column column) {
+    return static_cast<size_t>(column);
+}
+
+template <typename Value, typename Field>
+static void appendField(const std::vector<Record>& records, std::vector<Value>& values, Field field) {
+    values.reserve(values.size() + records.size());
+    for (const auto& record : records) {
+        values.push_back(static_cast<Value>(field(record)));
+    }
+}
+
+// One column of decoded records, switching on the column once rather than per record
+static void appendColumn(const std::vector<Record>& records, Column column, ColumnValues& values) {
+    switch (column) {
+        case Column::GameDate:     appendField(records, values.ints, [](const Record& r) { return r.gameDate; }); return;
+        case Column::TeamId:       appendField(records, values.ints, [](const Record& r) { return r.teamId; }); return;
+        case Column::PtsHome:      appendField(records, values.ints, [](const Record& r) { return r.ptsHome; }); return;
+        case Column::FgPctHome:    appendField(records, values.floats, [](const Record& r) { return r.fgPctHome; }); return;
+        case Column::FtPctHome:    appendField(records, values.floats, [](const Record& r) { return r.ftPctHome; }); return;
+        case Column::Fg3PctHome:   appendField(records, values.floats, [](const Record& r) { return r.fg3PctHome; }); return;
+        case Column::AstHome:      appendField(records, values.ints, [](const Record& r) { return r.astHome; }); return;
+        case Column::RebHome:      appendField(records, values.ints, [](const Record& r) { return r.rebHome; }); return;
+        case Column::HomeTeamWins: appendField(records, values.ints, [](const Record& r) { return r.homeTeamWins; }); return;
+    }
+}
+
+double Batch::value(Column column, size_t row) const {
+    const ColumnValues& columnValues = values(column);
+    // Widened apart: a float/int32 conditional would round the ints, team ids among them, to float
+    if (isFloatColumn(column)) return columnValues.floats[row];
+    return columnValues.ints[row];
+}
+
+void Batch::clear() {
+    rows = 0;
+    recordIds.clear();
+    datablockIds.clear();
+    slots.clear();
+    records.clear();
+    for (auto& column : columns) {
+        column.floats.clear();
+        column.ints.clear();
+    }
+    carried.fill(false);
+    selection.clear();
+}
+
+Scan::Scan(const Storage& storage, std::vector<Column> columns, size_t firstBlock, size_t endBlock)
+    : storage(storage), columns(std::move(columns)), nextBlock(firstBlock),
+      endBlock(std::min<size_t>(endBlock, storage.getDatablockCount())) {}
+
+Scan::Scan(const Storage& storage, std::vector<Column> columns, Predicate pushed, size_t firstBlock, size_t endBlock)
+    : Scan(storage, std::move(columns), firstBlock, endBlock) {
+    this->pushed = std::move(pushed);
+}
+
+bool Scan::next(Batch& batch) {
+    batch.clear();
+    for (Column column : columns) {
+        batch.carried[columnIndex(column)] = true;
+    }
+    while (nextBlock < endBlock && (batch.rows == 0 || batch.rows + MAX_RECORDS_PER_BLOCK <= Batch::capacity)) {
+        uint16_t datablockId = static_cast<uint16_t>(nextBlock++);
+        // The slot count the predicate saw, or else the one read with the ids, holds for every column, even if
+        // the block grows in between
+        size_t count = 0;
+        if (pushed) {
+            count = storage.selectSlots(datablockId, *pushed, selectedSlots, counters);
+            if (selectedSlots.empty()) continue;
+            for (uint32_t slot : selectedSlots) {
+                batch.selection.push_back(static_cast<uint32_t>(batch.rows + slot));
+            }
+        }
+        size_t idCount = storage.readRecordIds(datablockId, blockIds);
+        if (!pushed) count = idCount;
+        batch.recordIds.insert(batch.recordIds.end(), blockIds.begin(), blockIds.begin() + count);
+        batch.datablockIds.insert(batch.datablockIds.end(), count, datablockId);
+        for (size_t slot = 0; slot < count; ++slot) {
+            batch.slots.push_back(static_cast<uint32_t>(slot));
+        }
+        for (Column column : columns) {
+            storage.readColumn(datablockId, column, blockValues);
+            ColumnValues& values = batch.values(column);
+            if (isFloatColumn(column)) {
+                values.floats.insert(values.floats.end(), blockValues.floats.begin(), blockValues.floats.begin() + count);
+            } else {
+                values.ints.insert(values.ints.end(), blockValues.ints.begin(), blockValues.ints.begin() + count);
+            }
+        }
+        batch.rows += count;
+        blocksRead++;
+    }
+    if (batch.rows == 0) return false;
+    if (!pushed) {
+        batch.selection.resize(batch.rows);
+        std::iota(batch.selection.begin(), batch.selection.end(), 0);
+    }
+    return true;
+}
+
+template <typename Key>
+IndexRangeScan<Key>::IndexRangeScan(BPlusTree<Key, uint32_t>& tree, Key lower, Key upper, Storage& storage)
+    : cursor(tree.openCursor(lower, upper)), storage(storage) {}
+
+template <typename Key>
+bool IndexRangeScan<Key>::next(Batch& batch) {
+    ids.clear();
+    for (; cursor.valid() && ids.size() < Batch::capacity; cursor.next()) {
+        ids.push_back(static_cast<uint16_t>(cursor.value()));
+    }
+    if (ids.empty()) return false;
+
+    // The records are decoded by now, so they and every column come along
+    batch.clear();
+    batch.records = storage.bulkReadInBlockOrder(ids, blocksRead, heldBlock);
+    batch.rows = batch.records.size();
+    for (const auto& record : batch.records) {
+        batch.recordIds.push_back(record.recordId);
+    }
+    for (Column column : allColumns()) {
+        appendColumn(batch.records, column, batch.values(column));
+        batch.carried[columnIndex(column)] = true;
+    }
+    batch.selection.resize(batch.rows);
+    std::iota(batch.selection.begin(), batch.selection.end(), 0);
+    return true;
+}
+
+Filter::Filter(OperatorPtr child, ColumnRange range) : Operator(std::move(child)), range(range) {}
+
+bool Filter::next(Batch& batch) {
+    while (child->next(batch)) {
+        if (!batch.carries(range.column)) {
+            throw std::runtime_error("Filter on a column the plan does not read: " + columnName(range.column));
+        }
+        mask.resize(selectionWords(batch.rows));
+        selectColumnRange(batch.values(range.column), batch.rows, range, mask.data());
+        if (batch.selection.size() == batch.rows) {
+            // Nothing filtered out yet, so the mask alone is the selection
+            batch.selection.resize(compactSelected(mask.data(), batch.rows, batch.selection.data()));
+        } else {
+            size_t kept = 0;
+            for (size_t i = 0; i < batch.selection.size(); ++i) {
+                uint32_t row = batch.selection[i];
+                batch.selection[kept] = row;
+                kept += (mask[row / 64] >> (row % 64)) & 1;
+            }
+            batch.selection.resize(kept);
+        }
+        if (!batch.selection.empty()) return true;
+    }
+    return false;
+}
+
+Project::Project(OperatorPtr child, std::vector<Column> columns) : Operator(std::move(child)) {
+    for (Column column : columns) {
+        kept[columnIndex(column)] = true;
+    }
+}
+
+bool Project::next(Batch& batch) {
+    if (!child->next(batch)) return false;
+    for (Column column : allColumns()) {
+        size_t index = columnIndex(column);
+        if (kept[index] && !batch.carried[index]) {
+            throw std::runtime_error("Projection of a column the plan does not read: " + columnName(column));
+        }
+        batch.carried[index] = kept[index];
+    }
+    batch.records.clear();
+    return true;
+}
+
+Limit::Limit(OperatorPtr child, size_t limit) : Operator(std::move(child)), remaining(limit) {}
+
+bool Limit::next(Batch& batch) {
+    if (remaining == 0 || !child->next(batch)) return false;
+    if (batch.selection.size() > remaining) {
+        batch.selection.resize(remaining);
+    }
+    remaining -= batch.selection.size();
+    return true;
+}
+
+Collect::Collect(OperatorPtr plan, const Storage* storage) : plan(std::move(plan)), storage(storage) {}
+
+SearchResult Collect::run() {
+    SearchResult result = {0, 0, 0.0f, 0, {}};
+    Batch batch;
+    std::vector<uint32_t> blockSlots;
+    while (plan->next(batch)) {
+        if (!batch.records.empty()) {
+            for (uint32_t row : batch.selection) {
+                result.found_records.push_back(batch.records[row]);
+            }
+            continue;
+        }
+        bool whole = std::all_of(batch.carried.begin(), batch.carried.end(), [](bool carried) { return carried; });
+        if (whole || !storage || batch.datablockIds.empty()) {
+            for (uint32_t row : batch.selection) {
+                Record record{};
+                record.recordId = batch.recordIds[row];
+                for (Column column : allColumns()) {
+                    if (batch.carries(column)) setColumnValue(record, column, batch.value(column, row));
+                }
+                result.found_records.push_back(record);
+            }
+            continue;
+        }
+        // A block's rows sit next to each other, so each block's selected slots are read in one call
+        for (size_t i = 0; i < batch.selection.size();) {
+            uint16_t datablockId = batch.datablockIds[batch.selection[i]];
+            blockSlots.clear();
+            for (; i < batch.selection.size() && batch.datablockIds[batch.selection[i]] == datablockId; ++i) {
+                blockSlots.push_back(batch.slots[batch.selection[i]]);
+            }
+            storage->readSlots(datablockId, blockSlots.data(), blockSlots.size(), result.found_records);
+        }
+    }
+    result.indexNodesAccessed = plan->indexNodesAccessed();
+    result.dataBlocksAccessed = plan->dataBlocksAccessed();
+    result.numberOfResults = result.found_records.size();
+    return result;
+}
+
+Aggregate::Aggregate(OperatorPtr plan, Column measure) : plan(std::move(plan)), measure(measure) {}
+
+AggregateResult Aggregate::run() {
+    AggregateResult result = {0, 0, 0.0, 0.0f};
+    Batch batch;
+    while (plan->next(batch)) {
+        if (!batch.carries(measure)) {
+            throw std::runtime_error("Aggregate over a column the plan does not read: " + columnName(measure));
+        }
+        const ColumnValues& values = batch.values(measure);
+        if (isFloatColumn(measure)) {
+            for (uint32_t row : batch.selection) result.sum += values.floats[row];
+        } else {
+            for (uint32_t row : batch.selection) result.sum += values.ints[row];
+        }
+        result.count += batch.selection.size();
+    }
+    result.indexNodesAccessed = plan->indexNodesAccessed();
+    if (result.count > 0) {
+        result.average = static_cast<float>(result.sum / result.count);
+    }
+    return result;
+}
+
+SearchResult collectMorsels(const Storage& storage, const MorselPlan& plan, bool readRecords) {
+    std::vector<SearchResult> partials(storage.morselCount());
+    storage.scanMorselBlocks(partials.size(), [&](size_t morsel, size_t firstBlock, size_t endBlock) {
+        partials[morsel] = Collect(plan(firstBlock, endBlock), readRecords ? &storage : nullptr).run();
+    });
+
+    SearchResult result = {0, 0, 0.0f, 0, {}};
+    for (auto& partial : partials) {
+        result.indexNodesAccessed += partial.indexNodesAccessed;
+        result.dataBlocksAccessed += partial.dataBlocksAccessed;
+        result.found_records.insert(result.found_records.end(), partial.found_records.begin(), partial.found_records.end());
+    }
+    result.numberOfResults = result.found_records.size();
+    return result;
+}
+
+AggregateResult aggregateMorsels(const Storage& storage, const MorselPlan& plan, Column measure) {
+    std::vector<AggregateResult> partials(storage.morselCount());
+    storage.scanMorselBlocks(partials.size(), [&](size_t morsel, size_t firstBlock, size_t endBlock) {
+        partials[morsel] = Aggregate(plan(firstBlock, endBlock), measure).run();
+    });
+
+    // Added up in block order, so the sum does not depend on which thread ran which morsel
+    AggregateResult result = {0, 0, 0.0, 0.0f};
+    for (const auto& partial : partials) {
+        result.indexNodesAccessed += partial.indexNodesAccessed;
+        result.count += partial.count;
+        result.sum += partial.sum;
+    }
+    if (result.count > 0) {
+        result.average = static_cast<float>(result.sum / result.count);
+    }
+    return result;
+}
+
+// Compiled for the key types of the single-column indexes
+template class IndexRangeScan<float>;
+template class IndexRangeScan<int>;
+template class IndexRangeScan<uint8_t>;
@@ -1,8 +1,18 @@
 #include "Storage.h"
+#include "Hardware.h"
+#include "SimdFilter.h"
+#include "ThreadPool.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <cstdio>
+#include <optional>
 
 Storage::Storage(const std::string& filename) : filename(filename), totalRecords(0) {
     std::ifstream file(filename, std::ios::binary);
@@ -11,22 +21,368 @@ Storage::Storage(const std::string& filename) : filename(filename), totalRecords
     }
 }
 
-bool compareRecord(const Record& a, const Record& b){
-    return a.fgPctHome < b.fgPctHome;
+Storage::~Storage() {
+    clearPages();
 }
 
-std::unordered_map<uint16_t, std::vector<std::pair<uint16_t, uint16_t>>> Storage::getRecordLocationsMap() const {
-    std::unordered_map<uint16_t, std::vector<std::pair<uint16_t, uint16_t>>> result;
+void Storage::clearPages() {
+    for (uint32_t i = 0; i < pageCount; ++i) {
+        delete pages[i].exchange(nullptr);
+    }
+    pageCount = 0;
+}
+
+Storage::Page& Storage::appendPage(Datablock block) {
+    uint32_t id = pageCount.load(std::memory_order_relaxed);
+    Page* page = new Page(std::move(block));
+    pages.grow(id).store(page, std::memory_order_release);
+    // Counted only once the page is reachable, so a reader that sees the count can use every page below it
+    pageCount.store(id + 1, std::memory_order_release);
+    return *page;
+}
+
+void Storage::setRecordLocation(uint16_t recordId, uint16_t datablockId, uint16_t offset) {
+    recordLocations.grow(recordId).store((uint64_t(1) << 32) | (uint64_t(datablockId) << 16) | offset,
+                                         std::memory_order_release);
+}
+
+std::pair<uint16_t, uint16_t> Storage::getRecordLocation(uint16_t recordId) const {
+    uint64_t location = recordLocations.contains(recordId) ? recordLocations[recordId].load(std::memory_order_acquire) : 0;
+    if (location == 0) {
+        throw std::runtime_error("Record not found");
+    }
+    return {static_cast<uint16_t>(location >> 16), static_cast<uint16_t>(location)};
+}
+
+template <typename Read>
+auto Storage::readPage(uint16_t datablockId, Read read) const {
+    const Page& target = page(datablockId);
+    if (target.sealed.load(std::memory_order_acquire)) {
+        return read(target.block);
+    }
+    std::shared_lock<std::shared_mutex> latch(pageLatches[datablockId % pageLatches.size()]);
+    return read(target.block);
+}
+
+int encodeGameDate(int day, int month, int year) {
+    // Days from civil date, proleptic Gregorian calendar
+    year -= month <= 2;
+    const int era = (year >= 0 ? year : year - 399) / 400;
+    const int yearOfEra = year - era * 400;
+    const int dayOfYear = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    const int dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    return era * 146097 + dayOfEra - 719468;
+}
+
+int encodeGameDate(const std::string& ddmmyyyy) {
+    int day, month, year;
+    char sep1, sep2;
+    std::istringstream iss(ddmmyyyy);
+    if (!(iss >> day >> sep1 >> month >> sep2 >> year) || sep1 != '/' || sep2 != '/') {
+        throw std::runtime_error("Invalid date (expected dd/mm/yyyy): " + ddmmyyyy);
+    }
+    return encodeGameDate(day, month, year);
+}
 
-    for (const auto& datablock : datablocks) {
-        uint16_t datablockId = datablock.getId();
-        std::vector<std::pair<uint16_t, uint16_t>> records;
+std::string decodeGameDate(int days) {
+    // Civil date from days, inverse of encodeGameDate
+    days += 719468;
+    const int era = (days >= 0 ? days : days - 146096) / 146097;
+    const int dayOfEra = days - era * 146097;
+    const int yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+    const int dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+    const int mp = (5 * dayOfYear + 2) / 153;
+    const int day = dayOfYear - (153 * mp + 2) / 5 + 1;
+    const int month = mp < 10 ? mp + 3 : mp - 9;
+    const int year = yearOfEra + era * 400 + (month <= 2);
+
+    char buffer[32];
+    std::snprintf(buffer, sizeof(buffer), "%02d/%02d/%04d", day, month, year);
+    return buffer;
+}
+
+const std::vector<Column>& allColumns() {
+    static const std::vector<Column> columns = {
+        Column::GameDate, Column::TeamId, Column::PtsHome, Column::FgPctHome, Column::FtPctHome,
+        Column::Fg3PctHome, Column::AstHome, Column::RebHome, Column::HomeTeamWins
+    };
+    return columns;
+}
+
+std::string columnName(Column column) {
+    switch (column) {
+        case Column::GameDate:     return "game_date";
+        case Column::TeamId:       return "team_id";
+        case Column::PtsHome:      return "pts_home";
+        case Column::FgPctHome:    return "fg_pct_home";
+        case Column::FtPctHome:    return "ft_pct_home";
+        case Column::Fg3PctHome:   return "fg3_pct_home";
+        case Column::AstHome:      return "ast_home";
+        case Column::RebHome:      return "reb_home";
+        case Column::HomeTeamWins: return "home_team_wins";
+    }
+    throw std::runtime_error("Unknown column");
+}
 
-        for (const auto& [recordId, location] : datablock.getRecordLocations()) {
-            records.emplace_back(recordId, location);
+Column parseColumn(const std::string& name) {
+    for (Column column : allColumns()) {
+        if (columnName(column) == name) return column;
+    }
+    throw std::runtime_error("Unknown column: " + name);
+}
+
+double columnValue(const Record& record, Column column) {
+    switch (column) {
+        case Column::GameDate:     return record.gameDate;
+        case Column::TeamId:       return record.teamId;
+        case Column::PtsHome:      return record.ptsHome;
+        case Column::FgPctHome:    return record.fgPctHome;
+        case Column::FtPctHome:    return record.ftPctHome;
+        case Column::Fg3PctHome:   return record.fg3PctHome;
+        case Column::AstHome:      return record.astHome;
+        case Column::RebHome:      return record.rebHome;
+        case Column::HomeTeamWins: return record.homeTeamWins;
+    }
+    throw std::runtime_error("Unknown column");
+}
+
+void setColumnValue(Record& record, Column column, double value) {
+    switch (column) {
+        case Column::GameDate:     record.gameDate = static_cast<int>(value); return;
+        case Column::TeamId:       record.teamId = static_cast<int>(value); return;
+        case Column::PtsHome:      record.ptsHome = static_cast<uint8_t>(value); return;
+        case Column::FgPctHome:    record.fgPctHome = static_cast<float>(value); return;
+        case Column::FtPctHome:    record.ftPctHome = static_cast<float>(value); return;
+        case Column::Fg3PctHome:   record.fg3PctHome = static_cast<float>(value); return;
+        case Column::AstHome:      record.astHome = static_cast<uint8_t>(value); return;
+        case Column::RebHome:      record.rebHome = static_cast<uint8_t>(value); return;
+        case Column::HomeTeamWins: record.homeTeamWins = value != 0.0; return;
+    }
+    throw std::runtime_error("Unknown column");
+}
+
+bool isFloatColumn(Column column) {
+    return column == Column::FgPctHome || column == Column::FtPctHome || column == Column::Fg3PctHome;
+}
+
+// serializeRecord writes the fields in declaration order with nothing between them, so a column sits at the
+// same offset in the stored bytes as in the packed Record
+size_t columnOffset(Column column) {
+    switch (column) {
+        case Column::GameDate:     return offsetof(Record, gameDate);
+        case Column::TeamId:       return offsetof(Record, teamId);
+        case Column::PtsHome:      return offsetof(Record, ptsHome);
+        case Column::FgPctHome:    return offsetof(Record, fgPctHome);
+        case Column::FtPctHome:    return offsetof(Record, ftPctHome);
+        case Column::Fg3PctHome:   return offsetof(Record, fg3PctHome);
+        case Column::AstHome:      return offsetof(Record, astHome);
+        case Column::RebHome:      return offsetof(Record, rebHome);
+        case Column::HomeTeamWins: return offsetof(Record, homeTeamWins);
+    }
+    throw std::runtime_error("Unknown column");
+}
+
+// Bytes a column takes in a stored record
+size_t columnWidth(Column column) {
+    switch (column) {
+        case Column::GameDate:
+        case Column::TeamId:
+        case Column::FgPctHome:
+        case Column::FtPctHome:
+        case Column::Fg3PctHome:   return 4;
+        case Column::PtsHome:
+        case Column::AstHome:
+        case Column::RebHome:
+        case Column::HomeTeamWins: return 1;
+    }
+    throw std::runtime_error("Unknown column");
+}
+
+// [lower, upper] as the bounds a value of the column is compared against: rounded to float for the float
+// columns, and for the integer ones narrowed to [ceil(lower), floor(upper)], which holds the same integers.
+// False when no value of the column can lie in the range.
+static bool columnBounds(Column column, double lower, double upper, double& low, double& high) {
+    if (isFloatColumn(column)) {
+        low = static_cast<float>(lower);
+        high = static_cast<float>(upper);
+    } else {
+        low = std::max(std::ceil(lower), static_cast<double>(std::numeric_limits<int32_t>::min()));
+        high = std::min(std::floor(upper), static_cast<double>(std::numeric_limits<int32_t>::max()));
+    }
+    return low <= high;
+}
+
+// The constants of an In as values of the column; those the column cannot hold are dropped, as they never match
+static std::vector<double> inColumnDomain(Column column, const std::vector<double>& values) {
+    std::vector<double> domain;
+    for (double value : values) {
+        if (isFloatColumn(column)) {
+            domain.push_back(static_cast<float>(value));
+        } else if (value == std::floor(value) && value >= std::numeric_limits<int32_t>::min()
+                   && value <= std::numeric_limits<int32_t>::max()) {
+            domain.push_back(value);
         }
+    }
+    return domain;
+}
 
-        result[datablockId] = std::move(records);
+void selectColumnRange(const ColumnValues& values, size_t count, const ColumnRange& range, uint64_t* mask) {
+    double lower, upper;
+    if (!columnBounds(range.column, range.lower, range.upper, lower, upper)) {
+        std::fill(mask, mask + selectionWords(count), 0);
+        return;
+    }
+    if (isFloatColumn(range.column)) {
+        selectRange(values.floats.data(), count, static_cast<float>(lower), static_cast<float>(upper), mask);
+    } else {
+        selectRange(values.ints.data(), count, static_cast<int32_t>(lower), static_cast<int32_t>(upper), mask);
+    }
+}
+
+Predicate Predicate::between(Column column, double lower, double upper) {
+    Predicate predicate;
+    predicate.kind = Kind::Range;
+    predicate.column = column;
+    predicate.lower = lower;
+    predicate.upper = upper;
+    return predicate;
+}
+
+Predicate Predicate::equal(Column column, double value) {
+    return between(column, value, value);
+}
+
+Predicate Predicate::atLeast(Column column, double value) {
+    return between(column, value, std::numeric_limits<double>::infinity());
+}
+
+Predicate Predicate::atMost(Column column, double value) {
+    return between(column, -std::numeric_limits<double>::infinity(), value);
+}
+
+// Strict bounds become the nearest value of the column's type on the right side, so ranges stay inclusive
+Predicate Predicate::less(Column column, double value) {
+    if (!isFloatColumn(column)) return atMost(column, std::ceil(value) - 1);
+    float bound = static_cast<float>(value);
+    if (bound >= value) bound = std::nextafter(bound, -std::numeric_limits<float>::infinity());
+    return atMost(column, bound);
+}
+
+Predicate Predicate::greater(Column column, double value) {
+    if (!isFloatColumn(column)) return atLeast(column, std::floor(value) + 1);
+    float bound = static_cast<float>(value);
+    if (bound <= value) bound = std::nextafter(bound, std::numeric_limits<float>::infinity());
+    return atLeast(column, bound);
+}
+
+Predicate Predicate::in(Column column, std::vector<double> values) {
+    Predicate predicate;
+    predicate.kind = Kind::In;
+    predicate.column = column;
+    predicate.values = std::move(values);
+    return predicate;
+}
+
+Predicate Predicate::allOf(std::vector<Predicate> children) {
+    Predicate predicate;
+    predicate.kind = Kind::And;
+    predicate.children = std::move(children);
+    return predicate;
+}
+
+Predicate Predicate::anyOf(std::vector<Predicate> children) {
+    Predicate predicate;
+    predicate.kind = Kind::Or;
+    predicate.children = std::move(children);
+    return predicate;
+}
+
+bool Predicate::matches(const Record& record) const {
+    switch (kind) {
+        case Kind::Range: {
+            double low, high;
+            double value = columnValue(record, column);
+            return columnBounds(column, lower, upper, low, high) && value >= low && value <= high;
+        }
+        case Kind::In: {
+            std::vector<double> domain = inColumnDomain(column, values);
+            return std::find(domain.begin(), domain.end(), columnValue(record, column)) != domain.end();
+        }
+        case Kind::And:
+            return std::all_of(children.begin(), children.end(), [&](const Predicate& child) { return child.matches(record); });
+        case Kind::Or:
+            return std::any_of(children.begin(), children.end(), [&](const Predicate& child) { return child.matches(record); });
+    }
+    throw std::runtime_error("Unknown predicate");
+}
+
+// A predicate's constant as the column would hold it: integers in full, floats in the fewest digits that read
+// back as the same float. Bounds the column cannot hold exactly, as 119.5 on points, are written as given.
+static std::string constantText(Column column, double value) {
+    char text[32];
+    std::to_chars_result written;
+    if (isFloatColumn(column)) {
+        written = std::to_chars(text, text + sizeof(text), static_cast<float>(value));
+    } else if (value == std::floor(value) && std::abs(value) <= std::numeric_limits<int32_t>::max()) {
+        written = std::to_chars(text, text + sizeof(text), static_cast<int64_t>(value));
+    } else {
+        written = std::to_chars(text, text + sizeof(text), value);
+    }
+    return std::string(text, written.ptr);
+}
+
+std::string Predicate::toString() const {
+    std::ostringstream out;
+    switch (kind) {
+        case Kind::Range:
+            if (lower == upper) {
+                out << columnName(column) << " = " << constantText(column, lower);
+            } else if (upper == std::numeric_limits<double>::infinity()) {
+                out << columnName(column) << " >= " << constantText(column, lower);
+            } else if (lower == -std::numeric_limits<double>::infinity()) {
+                out << columnName(column) << " <= " << constantText(column, upper);
+            } else {
+                out << columnName(column) << " BETWEEN " << constantText(column, lower) << " AND "
+                    << constantText(column, upper);
+            }
+            break;
+        case Kind::In:
+            out << columnName(column) << " IN (";
+            for (size_t i = 0; i < values.size(); ++i) {
+                out << (i ? ", " : "") << constantText(column, values[i]);
+            }
+            out << ")";
+            break;
+        case Kind::And:
+        case Kind::Or:
+            if (children.empty()) return kind == Kind::And ? "TRUE" : "FALSE";
+            out << "(";
+            for (size_t i = 0; i < children.size(); ++i) {
+                out << (i ? (kind == Kind::And ? " AND " : " OR ") : "") << children[i].toString();
+            }
+            out << ")";
+            break;
+    }
+    return out.str();
+}
+
+bool compareRecord(const Record& a, const Record& b){
+    // Ties broken by id so the block layout does not depend on how the sort was split up
+    if (a.fgPctHome != b.fgPctHome) return a.fgPctHome < b.fgPctHome;
+    return a.recordId < b.recordId;
+}
+
+std::unordered_map<uint16_t, std::vector<std::pair<uint16_t, uint16_t>>> Storage::getRecordLocationsMap() const {
+    std::unordered_map<uint16_t, std::vector<std::pair<uint16_t, uint16_t>>> result;
+
+    for (uint16_t datablockId = 0; datablockId < getDatablockCount(); ++datablockId) {
+        result[datablockId] = readPage(datablockId, [](const Datablock& datablock) {
+            std::vector<std::pair<uint16_t, uint16_t>> records;
+            for (const auto& [recordId, location] : datablock.getRecordLocations()) {
+                records.emplace_back(recordId, location);
+            }
+            return records;
+        });
     }
 
     return result;
@@ -50,95 +406,154 @@ void Storage::ingestData(const std::string& inputFilename) {
     std::getline(inputFile, line); // Skip header
 
 
-    std::vector<Record> fileRecords;  // A vector of records in the original file
-    std::vector<Record> records;
-    uint16_t recordId = 0;
+    std::vector<std::string> lines;  // raw lines, parsed in parallel below
+    while (std::getline(inputFile, line)) {
+        lines.push_back(line);
+    }
 
-    
+    if (lines.size() > maxRecords) {
+        throw std::runtime_error("Too many records for 16-bit record ids in " + inputFilename);
+    }
 
+    std::vector<Record> fileRecords(lines.size());  // A vector of records in the original file
+    uint16_t recordId = static_cast<uint16_t>(lines.size());
 
     /*
     For each line in the file we will parse and ingest the data in each record
     */
-    while (std::getline(inputFile, line)) {
-        std::istringstream iss(line);
-        std::string token;
-        Record record;
+    ThreadPool::shared().parallelFor("ingest.parse", 0, lines.size(), 1024, [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            std::istringstream iss(lines[i]);
+            std::string token;
+            Record record;
 
-        record.recordId = recordId++;
+            record.recordId = static_cast<uint16_t>(i);
 
-        std::getline(iss, token, '\t');
-        token.erase(std::remove(token.begin(), token.end(), '/'), token.end());
-        record.gameDate = std::stoi(token);
+            std::getline(iss, token, '\t');
+            record.gameDate = encodeGameDate(token);
 
-        std::getline(iss, token, '\t');
-        record.teamId = std::stoi(token);
+            std::getline(iss, token, '\t');
+            record.teamId = std::stoi(token);
 
-        std::getline(iss, token, '\t');
-        record.ptsHome = token.empty() ? 0 : std::stoi(token);
+            std::getline(iss, token, '\t');
+            record.ptsHome = token.empty() ? 0 : std::stoi(token);
 
-        std::getline(iss, token, '\t');
-        record.fgPctHome = token.empty() ? 0.0f : std::stof(token);
+            std::getline(iss, token, '\t');
+            record.fgPctHome = token.empty() ? 0.0f : std::stof(token);
 
-        std::getline(iss, token, '\t');
-        record.ftPctHome = token.empty() ? 0.0f : std::stof(token);
+            std::getline(iss, token, '\t');
+            record.ftPctHome = token.empty() ? 0.0f : std::stof(token);
 
-        std::getline(iss, token, '\t');
-        record.fg3PctHome = token.empty() ? 0.0f : std::stof(token);
+            std::getline(iss, token, '\t');
+            record.fg3PctHome = token.empty() ? 0.0f : std::stof(token);
 
-        std::getline(iss, token, '\t');
-        record.astHome = token.empty() ? 0 : std::stoi(token);
+            std::getline(iss, token, '\t');
+            record.astHome = token.empty() ? 0 : std::stoi(token);
 
-        std::getline(iss, token, '\t');
-        record.rebHome = token.empty() ? 0 : std::stoi(token);
+            std::getline(iss, token, '\t');
+            record.rebHome = token.empty() ? 0 : std::stoi(token);
 
-        std::getline(iss, token, '\t');
-        record.homeTeamWins = token == "1";
+            std::getline(iss, token, '\t');
+            record.homeTeamWins = token == "1";
 
-        fileRecords.push_back(record); // TUAN's added code
-    }
+            fileRecords[i] = record; // TUAN's added code
+        }
+    });
 
     // Sort records based on fg_pct_home
-    std::sort(fileRecords.begin(), fileRecords.end(), compareRecord);
+    parallelSort(ThreadPool::shared(), "ingest.sort", fileRecords.begin(), fileRecords.end(), compareRecord);
 
-    for (Record sorted_record: fileRecords){
+    createDatablocks(fileRecords);
 
-        records.push_back(sorted_record);
+    totalRecords = recordId;
+    saveDatablocks();
+}
 
-        if (records.size() == MAX_RECORDS_PER_BLOCK) {
-            createDatablock(records);
-            records.clear();
-        }
+uint16_t Storage::insertRecord(Record record) {
+    std::lock_guard<std::mutex> writer(appendMutex);
+    if (totalRecords >= maxRecords) {
+        throw std::runtime_error("Storage is full: record ids are 16-bit");
     }
+    uint16_t recordId = appendRecord(record);
+    saveAppendedPages();
+    return recordId;
+}
 
-    // Store remaining records
-    if (!records.empty()) {
-        createDatablock(records);
+std::vector<uint16_t> Storage::insertRecords(const std::vector<Record>& records) {
+    std::lock_guard<std::mutex> writer(appendMutex);
+    if (totalRecords + records.size() > maxRecords) {
+        throw std::runtime_error("Storage is full: record ids are 16-bit");
     }
-
-    totalRecords = recordId;
-    datablockCount = datablocks.size();
-    saveDatablocks();
+    std::vector<uint16_t> recordIds;
+    recordIds.reserve(records.size());
+    for (const auto& record : records) {
+        recordIds.push_back(appendRecord(record));
+    }
+    saveAppendedPages();
+    return recordIds;
 }
 
-void Storage::createDatablock(const std::vector<Record>& records) {
-    Datablock datablock(datablocks.size());
-    
-    for (const auto& record : records) {
-        std::vector<char> serializedRecord = serializeRecord(record);
+uint16_t Storage::appendRecord(Record record) {
+    record.recordId = totalRecords;
+    std::vector<char> serializedRecord = serializeRecord(record);
 
+    // Append to the last datablock while it still has a free slot, otherwise seal it and start a new one
+    Page* last = pageCount > 0 ? &page(static_cast<uint16_t>(pageCount - 1)) : nullptr;
+    bool added = false;
+    if (last && last->block.getRecordCount() < MAX_RECORDS_PER_BLOCK) {
+        std::unique_lock<std::shared_mutex> latch(pageLatches[last->block.getId() % pageLatches.size()]);
+        added = last->block.addRecord(record.recordId, serializedRecord);
+    }
+    if (!added) {
+        if (last) seal(*last);
+        Datablock datablock(getDatablockCount());
         if (!datablock.addRecord(record.recordId, serializedRecord)) {
-            
-            datablocks.push_back(datablock);
-            datablock = Datablock(datablocks.size());
-            if (!datablock.addRecord(record.recordId, serializedRecord)) {
-                throw std::runtime_error("Record too large for datablock");
+            throw std::runtime_error("Record too large for datablock");
+        }
+        last = &appendPage(std::move(datablock));
+    }
+
+    const Datablock& datablock = last->block;
+    setRecordLocation(record.recordId, datablock.getId(), datablock.getRecordLocations().at(record.recordId));
+    if (datablock.getRecordCount() >= MAX_RECORDS_PER_BLOCK) {
+        seal(*last);
+    }
+
+    totalRecords++;
+    return record.recordId;
+}
+
+void Storage::createDatablocks(const std::vector<Record>& records) {
+    std::lock_guard<std::mutex> writer(appendMutex);
+    // Earlier blocks are complete once new ones start
+    if (pageCount > 0) seal(page(static_cast<uint16_t>(pageCount - 1)));
+    uint16_t firstId = getDatablockCount();
+
+    // Block b holds records b * MAX_RECORDS_PER_BLOCK onwards, so every block can be packed on its own
+    size_t blockCount = (records.size() + MAX_RECORDS_PER_BLOCK - 1) / MAX_RECORDS_PER_BLOCK;
+    std::vector<std::optional<Datablock>> blocks(blockCount);
+    ThreadPool::shared().parallelFor("ingest.blocks", 0, blockCount, 8, [&](size_t from, size_t to) {
+        for (size_t b = from; b < to; ++b) {
+            Datablock datablock(static_cast<uint16_t>(firstId + b));
+            size_t end = std::min<size_t>(records.size(), (b + 1) * MAX_RECORDS_PER_BLOCK);
+            for (size_t i = b * MAX_RECORDS_PER_BLOCK; i < end; ++i) {
+                if (!datablock.addRecord(records[i].recordId, serializeRecord(records[i]))) {
+                    throw std::runtime_error("Record too large for datablock");
+                }
             }
+            blocks[b] = std::move(datablock);
+        }
+    });
+
+    for (auto& block : blocks) {
+        Page& appended = appendPage(std::move(*block));
+        for (const auto& [recordId, offset] : appended.block.getRecordLocations()) {
+            setRecordLocation(recordId, appended.block.getId(), offset);
+        }
+        if (appended.block.getRecordCount() >= MAX_RECORDS_PER_BLOCK) {
+            seal(appended);
         }
-        recordLocations[record.recordId] = {datablock.getId(), datablock.getRecordLocations().at(record.recordId)};
     }
-    
-    datablocks.push_back(datablock);
 }
 
 void Storage::saveDatablocks() {
@@ -147,38 +562,295 @@ void Storage::saveDatablocks() {
         throw std::runtime_error("Unable to open file for writing: " + filename);
     }
 
-    uint16_t datablockCount = datablocks.size();
+    uint16_t datablockCount = getDatablockCount();
     file.write(reinterpret_cast<const char*>(&datablockCount), sizeof(uint16_t));
 
-    for (const auto& datablock : datablocks) {
-        std::vector<char> serializedDatablock = datablock.serialize();
+    lastPageOffset = sizeof(uint16_t);
+    lastPageSize = 0;
+    for (uint16_t datablockId = 0; datablockId < datablockCount; ++datablockId) {
+        std::vector<char> serializedDatablock = readPage(datablockId, [](const Datablock& datablock) {
+            return datablock.serialize();
+        });
         uint16_t size = serializedDatablock.size();
+        lastPageOffset += datablockId > 0 ? sizeof(uint16_t) + lastPageSize : 0;
+        lastPageSize = size;
         file.write(reinterpret_cast<const char*>(&size), sizeof(uint16_t));
         file.write(serializedDatablock.data(), serializedDatablock.size());
     }
+    savedPages = datablockCount;
+}
+
+void Storage::saveAppendedPages() {
+    uint16_t datablockCount = getDatablockCount();
+    std::fstream file(filename, std::ios::binary | std::ios::in | std::ios::out);
+    // Appends change the last saved page and start pages after it; anything else takes a full write
+    if (!file.is_open() || savedPages == 0 || datablockCount < savedPages) {
+        file.close();
+        saveDatablocks();
+        return;
+    }
+
+    file.write(reinterpret_cast<const char*>(&datablockCount), sizeof(uint16_t));
+    file.seekp(lastPageOffset);
+    // Pages only grow, so the new copy of the last saved page covers all of the old one
+    for (uint16_t datablockId = savedPages - 1; datablockId < datablockCount; ++datablockId) {
+        std::vector<char> serializedDatablock = readPage(datablockId, [](const Datablock& datablock) {
+            return datablock.serialize();
+        });
+        uint16_t size = serializedDatablock.size();
+        lastPageOffset += datablockId > savedPages - 1 ? sizeof(uint16_t) + lastPageSize : 0;
+        lastPageSize = size;
+        file.write(reinterpret_cast<const char*>(&size), sizeof(uint16_t));
+        file.write(serializedDatablock.data(), serializedDatablock.size());
+    }
+    if (!file) {
+        throw std::runtime_error("Unable to write to file: " + filename);
+    }
+    savedPages = datablockCount;
 }
 
 
 Datablock * Storage::getDatablock(uint16_t dataBlockId){
-    return &datablocks[dataBlockId];
+    return &page(dataBlockId).block;
 }
 
 std::vector<Record> Storage::getRecordsWithBlockId(uint16_t datablockId){
-    Datablock * datablock = getDatablock(datablockId);
-    std::vector<Record> result_record;
+    return readPage(datablockId, [this](const Datablock& datablock) {
+        std::vector<Record> result_record;
+
+        //                 recordId   offset
+        std::unordered_map<uint16_t, uint16_t> datablockRecordLocations = datablock.getRecordLocations();
+
+        //             recordId   offset
+        for (std::pair<uint16_t, uint16_t> datablockRecordLocation: datablockRecordLocations){
+            result_record.push_back(deserializeRecord(datablock.getRecordAt(datablockRecordLocation.second)));
+        }
+
+        return result_record;
+    });
+}
 
-    //                 recordId   offset
-    std::unordered_map<uint16_t, uint16_t> datablockRecordLocations = datablock->getRecordLocations();
+// One column of every record in a block, read from the record bytes; the caller holds the page
+static size_t extractColumn(const Datablock& datablock, Column column, ColumnValues& values) {
+    const size_t offset = sizeof(uint8_t) + columnOffset(column);   // past the record's size byte
+    const size_t stride = sizeof(uint8_t) + RECORD_SIZE;
+    size_t slots = datablock.getRecordCount();
+    const char* bytes = datablock.recordAddress(0) + offset;
+    if (isFloatColumn(column)) {
+        values.floats.resize(slots);
+        for (size_t slot = 0; slot < slots; ++slot) {
+            std::memcpy(&values.floats[slot], bytes + slot * stride, sizeof(float));
+        }
+    } else if (columnWidth(column) == sizeof(int32_t)) {
+        values.ints.resize(slots);
+        for (size_t slot = 0; slot < slots; ++slot) {
+            std::memcpy(&values.ints[slot], bytes + slot * stride, sizeof(int32_t));
+        }
+    } else {
+        // One-byte columns: points, assists, rebounds and the win flag
+        values.ints.resize(slots);
+        for (size_t slot = 0; slot < slots; ++slot) {
+            values.ints[slot] = static_cast<uint8_t>(bytes[slot * stride]);
+        }
+    }
+    return slots;
+}
+
+size_t Storage::readColumn(uint16_t datablockId, Column column, ColumnValues& values) const {
+    return readPage(datablockId, [&](const Datablock& datablock) { return extractColumn(datablock, column, values); });
+}
+
+namespace {
+using ZoneMap = std::array<std::pair<double, double>, COLUMN_COUNT>;
+
+// What a block's zone map says about a predicate: no record can satisfy it, every record does, or it takes a look
+enum class ZoneVerdict { None, Some, All };
+
+ZoneVerdict zoneVerdict(const Predicate& predicate, const ZoneMap& zoneMap) {
+    switch (predicate.kind) {
+        case Predicate::Kind::Range: {
+            auto [minimum, maximum] = zoneMap[static_cast<size_t>(predicate.column)];
+            double lower, upper;
+            if (!columnBounds(predicate.column, predicate.lower, predicate.upper, lower, upper)
+                || maximum < lower || minimum > upper) {
+                return ZoneVerdict::None;
+            }
+            return lower <= minimum && maximum <= upper ? ZoneVerdict::All : ZoneVerdict::Some;
+        }
+        case Predicate::Kind::In: {
+            auto [minimum, maximum] = zoneMap[static_cast<size_t>(predicate.column)];
+            std::vector<double> domain = inColumnDomain(predicate.column, predicate.values);
+            bool inZone = std::any_of(domain.begin(), domain.end(),
+                                      [&](double value) { return value >= minimum && value <= maximum; });
+            if (!inZone) return ZoneVerdict::None;
+            // A block holding a single value matches throughout once that value is in the list
+            return minimum == maximum ? ZoneVerdict::All : ZoneVerdict::Some;
+        }
+        case Predicate::Kind::And: {
+            ZoneVerdict verdict = ZoneVerdict::All;
+            for (const auto& child : predicate.children) {
+                ZoneVerdict childVerdict = zoneVerdict(child, zoneMap);
+                if (childVerdict == ZoneVerdict::None) return ZoneVerdict::None;
+                if (childVerdict == ZoneVerdict::Some) verdict = ZoneVerdict::Some;
+            }
+            return verdict;
+        }
+        case Predicate::Kind::Or: {
+            ZoneVerdict verdict = ZoneVerdict::None;
+            for (const auto& child : predicate.children) {
+                ZoneVerdict childVerdict = zoneVerdict(child, zoneMap);
+                if (childVerdict == ZoneVerdict::All) return ZoneVerdict::All;
+                if (childVerdict == ZoneVerdict::Some) verdict = ZoneVerdict::Some;
+            }
+            return verdict;
+        }
+    }
+    return ZoneVerdict::Some;
+}
+
+// Evaluates a predicate over the records of one block into a selection bitmask. Each column is read from the
+// record bytes the first time a comparison needs it; a comparison or subtree the zone map settles reads nothing.
+class BlockFilter {
+public:
+    BlockFilter(const Datablock& datablock, size_t count, const ZoneMap* zoneMap)
+        : datablock(datablock), count(count), zoneMap(zoneMap) {}
+
+    void evaluate(const Predicate& predicate, uint64_t* mask);
+    size_t bytesRead = 0;
+
+private:
+    const Datablock& datablock;
+    size_t count;
+    const ZoneMap* zoneMap;   // null for a block still being filled
+    std::array<ColumnValues, COLUMN_COUNT> columns;
+    std::array<bool, COLUMN_COUNT> loaded{};
+
+    const ColumnValues& column(Column column);
+};
+
+const ColumnValues& BlockFilter::column(Column column) {
+    size_t index = static_cast<size_t>(column);
+    if (!loaded[index]) {
+        extractColumn(datablock, column, columns[index]);
+        bytesRead += count * columnWidth(column);
+        loaded[index] = true;
+    }
+    return columns[index];
+}
+
+void BlockFilter::evaluate(const Predicate& predicate, uint64_t* mask) {
+    ZoneVerdict verdict = zoneMap ? zoneVerdict(predicate, *zoneMap) : ZoneVerdict::Some;
+    if (verdict == ZoneVerdict::None) {
+        std::fill(mask, mask + selectionWords(count), 0);
+        return;
+    }
+    if (verdict == ZoneVerdict::All) {
+        selectAll(mask, count);
+        return;
+    }
+
+    switch (predicate.kind) {
+        case Predicate::Kind::Range:
+            selectColumnRange(column(predicate.column), count, {predicate.column, predicate.lower, predicate.upper}, mask);
+            return;
+        case Predicate::Kind::In: {
+            std::vector<double> domain = inColumnDomain(predicate.column, predicate.values);
+            const ColumnValues& values = column(predicate.column);
+            if (isFloatColumn(predicate.column)) {
+                std::vector<float> set(domain.begin(), domain.end());
+                selectIn(values.floats.data(), count, set.data(), set.size(), mask);
+            } else {
+                std::vector<int32_t> set(domain.begin(), domain.end());
+                selectIn(values.ints.data(), count, set.data(), set.size(), mask);
+            }
+            return;
+        }
+        case Predicate::Kind::And:
+        case Predicate::Kind::Or: {
+            bool conjunction = predicate.kind == Predicate::Kind::And;
+            if (conjunction) {
+                selectAll(mask, count);
+            } else {
+                std::fill(mask, mask + selectionWords(count), 0);
+            }
+            std::vector<uint64_t> childMask(selectionWords(count));
+            for (const auto& child : predicate.children) {
+                // Children after the outcome is settled, with nothing left to keep or everything kept, go untested
+                size_t selected = countSelected(mask, count);
+                if (conjunction ? selected == 0 : selected == count) return;
+                evaluate(child, childMask.data());
+                if (conjunction) {
+                    intersectSelection(mask, childMask.data(), count);
+                } else {
+                    uniteSelection(mask, childMask.data(), count);
+                }
+            }
+            return;
+        }
+    }
+}
+}
 
+void Storage::seal(Page& target) {
+    if (target.sealed.load(std::memory_order_relaxed)) return;
+    ColumnValues values;
+    for (Column column : allColumns()) {
+        size_t count = extractColumn(target.block, column, values);
+        auto& zone = target.zoneMap[static_cast<size_t>(column)];
+        zone = {std::numeric_limits<double>::infinity(), -std::numeric_limits<double>::infinity()};
+        for (size_t slot = 0; slot < count; ++slot) {
+            double value = isFloatColumn(column) ? static_cast<double>(values.floats[slot]) : values.ints[slot];
+            zone = {std::min(zone.first, value), std::max(zone.second, value)};
+        }
+    }
+    // Readers look at the zone map only once they see the page sealed, so it is complete by then
+    target.sealed.store(true, std::memory_order_release);
+}
 
-    std::vector<char> serializedRecord;
-    //             recordId   offset
-    for (std::pair<uint16_t, uint16_t> datablockRecordLocation: datablockRecordLocations){
-        serializedRecord = datablock->getRecord(datablockRecordLocation.first);
-        result_record.push_back(deserializeRecord(serializedRecord));
+size_t Storage::selectSlots(uint16_t datablockId, const Predicate& predicate, std::vector<uint32_t>& slots,
+                            ScanCounters& counters) const {
+    const Page& target = page(datablockId);
+    const ZoneMap* zoneMap = zoneMapsEnabled && target.sealed.load(std::memory_order_acquire) ? &target.zoneMap : nullptr;
+    if (zoneMap && zoneVerdict(predicate, *zoneMap) == ZoneVerdict::None) {
+        counters.blocksSkipped++;
+        slots.clear();
+        return target.block.getRecordCount();
     }
+    return readPage(datablockId, [&](const Datablock& datablock) {
+        size_t count = datablock.getRecordCount();
+        BlockFilter filter(datablock, count, zoneMap);
+        std::vector<uint64_t> mask(selectionWords(count));
+        filter.evaluate(predicate, mask.data());
+        slots.resize(count);
+        slots.resize(compactSelected(mask.data(), count, slots.data()));
+        counters.blocksRead++;
+        counters.bytesRead += filter.bytesRead;
+        return count;
+    });
+}
 
-    return result_record;
+size_t Storage::readRecordIds(uint16_t datablockId, std::vector<uint16_t>& recordIds) const {
+    const size_t offset = sizeof(uint8_t) + offsetof(Record, recordId);
+    const size_t stride = sizeof(uint8_t) + RECORD_SIZE;
+    return readPage(datablockId, [&](const Datablock& datablock) {
+        size_t slots = datablock.getRecordCount();
+        const char* bytes = datablock.recordAddress(0) + offset;
+        recordIds.resize(slots);
+        for (size_t slot = 0; slot < slots; ++slot) {
+            std::memcpy(&recordIds[slot], bytes + slot * stride, sizeof(uint16_t));
+        }
+        return slots;
+    });
+}
+
+void Storage::readSlots(uint16_t datablockId, const uint32_t* slots, size_t count, std::vector<Record>& out) const {
+    const size_t stride = sizeof(uint8_t) + RECORD_SIZE;
+    readPage(datablockId, [&](const Datablock& datablock) {
+        for (size_t i = 0; i < count; ++i) {
+            out.push_back(deserializeRecord(datablock.getRecordAt(static_cast<uint16_t>(slots[i] * stride))));
+        }
+        return 0;
+    });
 }
 
 
@@ -192,41 +864,50 @@ void Storage::loadDatablocks() {
     uint16_t datablockCount;
     file.read(reinterpret_cast<char*>(&datablockCount), sizeof(uint16_t));
 
-    datablocks.clear();
-    recordLocations.clear();
+    clearPages();
     totalRecords = 0;
 
-    for (uint16_t i = 0; i < datablockCount; ++i) {
+    // The file is read front to back, blocks are decoded in parallel and published in order
+    std::vector<std::vector<char>> serializedDatablocks(datablockCount);
+    lastPageSize = 0;
+    for (auto& serializedDatablock : serializedDatablocks) {
+        lastPageOffset = file.tellg();
         uint16_t size;
         file.read(reinterpret_cast<char*>(&size), sizeof(uint16_t));
+        lastPageSize = size;
 
-        std::vector<char> serializedDatablock(size);
+        serializedDatablock.resize(size);
         file.read(serializedDatablock.data(), size);
+    }
+    std::vector<std::optional<Datablock>> decoded(datablockCount);
+    ThreadPool::shared().parallelFor("load.decode", 0, datablockCount, 8, [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            decoded[i] = Datablock::deserialize(serializedDatablocks[i]);
+        }
+    });
 
-        Datablock datablock = Datablock::deserialize(serializedDatablock);
-        datablocks.push_back(datablock);
+    for (uint16_t i = 0; i < datablockCount; ++i) {
+        Page& loaded = appendPage(std::move(*decoded[i]));
+        const Datablock& datablock = loaded.block;
 
         for (const auto& pair : datablock.getRecordLocations()) {
-            recordLocations[pair.first] = {datablock.getId(), pair.second};
-            totalRecords = std::max(totalRecords, static_cast<uint16_t>(pair.first + 1));
+            setRecordLocation(pair.first, datablock.getId(), pair.second);
+            totalRecords = std::max(totalRecords.load(), static_cast<uint16_t>(pair.first + 1));
+        }
+        // Every block but the last is full; the last stays open for inserts until it fills up
+        if (i + 1 < datablockCount || datablock.getRecordCount() >= MAX_RECORDS_PER_BLOCK) {
+            seal(loaded);
         }
     }
-
-    datablockCount = datablocks.size();
+    savedPages = datablockCount;
 }
 
 Record Storage::getRecord(uint16_t recordId) {
-    // Find the recordID
-    auto it = recordLocations.find(recordId);
+    auto [datablockId, offset] = getRecordLocation(recordId);
 
-    if (it == recordLocations.end()) {
-        throw std::runtime_error("Record not found");
-    }
-
-    uint16_t datablockId = it->second.first;
-    uint16_t offset = it->second.second;
-
-    std::vector<char> serializedRecord = datablocks[datablockId].getRecord(recordId);
+    std::vector<char> serializedRecord = readPage(datablockId, [offset = offset](const Datablock& datablock) {
+        return datablock.getRecordAt(offset);
+    });
     return deserializeRecord(serializedRecord);
 }
 
@@ -241,13 +922,60 @@ std::vector<Record> Storage::bulkRead(const std::vector<uint16_t>& recordIds) {
     return result;
 }
 
+std::vector<Record> Storage::bulkReadInBlockOrder(const std::vector<uint16_t>& recordIds, int& dataBlocksAccessed) {
+    int heldBlock = -1;
+    return bulkReadInBlockOrder(recordIds, dataBlocksAccessed, heldBlock);
+}
+
+std::vector<Record> Storage::bulkReadInBlockOrder(const std::vector<uint16_t>& recordIds, int& dataBlocksAccessed,
+                                                  int& heldBlock, std::vector<uint16_t>* recordBlocks) {
+    // datablockId | offset | recordId packed into one integer, so a plain sort visits every block once, front to back
+    std::vector<uint64_t> locations;
+    locations.reserve(recordIds.size());
+    for (uint16_t recordId : recordIds) {
+        auto location = getRecordLocation(recordId);
+        locations.push_back((uint64_t(location.first) << 32) | (uint64_t(location.second) << 16) | recordId);
+    }
+    std::sort(locations.begin(), locations.end());
+
+    std::vector<Record> result;
+    result.reserve(locations.size());
+    if (recordBlocks) {
+        recordBlocks->clear();
+        recordBlocks->reserve(locations.size());
+        for (uint64_t location : locations) recordBlocks->push_back(static_cast<uint16_t>(location >> 32));
+    }
+    // Each block's run of records is read under one latch acquisition at most, and none for sealed blocks
+    for (size_t runStart = 0; runStart < locations.size();) {
+        uint16_t datablockId = static_cast<uint16_t>(locations[runStart] >> 32);
+        size_t runEnd = runStart;
+        while (runEnd < locations.size() && static_cast<uint16_t>(locations[runEnd] >> 32) == datablockId) ++runEnd;
+        if (datablockId != heldBlock) dataBlocksAccessed++;
+        heldBlock = datablockId;
+
+        readPage(datablockId, [&](const Datablock& datablock) {
+            for (size_t i = runStart; i < runEnd; ++i) {
+                if (prefetchDistance > 0 && i + prefetchDistance < runEnd) {
+                    PREFETCH(datablock.recordAddress(static_cast<uint16_t>(locations[i + prefetchDistance] >> 16)));
+                }
+                // The offset came with the location, so the block's own directory lookup is not needed
+                result.push_back(deserializeRecord(datablock.getRecordAt(static_cast<uint16_t>(locations[i] >> 16))));
+            }
+            return 0;
+        });
+        runStart = runEnd;
+    }
+
+    return result;
+}
+
 void Storage::printStatistics() {
     auto temp_datablock = getDatablock(1);
     temp_datablock->printSchema();
 
     std::cout << "----------------- Storage Statistics -----------------" << std::endl;
     std::cout << "Total number of records: " << totalRecords << std::endl;
-    std::cout << "Number of datablocks: " << datablocks.size() << std::endl;
+    std::cout << "Number of datablocks: " << getDatablockCount() << std::endl;
     std::cout << "Size of record: " << unsigned(RECORD_SIZE) << " bytes" << std::endl;
     std::cout << "Size of record (in memory): " << sizeof(Record) << " bytes" << std::endl;
     std::cout << "Size of record (with header): " << unsigned(RECORD_SIZE + 1) << " bytes" << std::endl;
@@ -264,15 +992,82 @@ size_t Storage::getTotalRecords() const {
     return totalRecords;
 }
 
+size_t Storage::scanMorselBlocks(size_t morsels, const std::function<void(size_t, size_t, size_t)>& visit) const {
+    size_t datablockCount = std::min<size_t>(getDatablockCount(), morsels * morselSize);
+    morsels = (datablockCount + morselSize - 1) / morselSize;
+    std::atomic<size_t> nextMorsel{0};
+
+    // One task per thread, each a loop claiming morsels, rather than one task per morsel
+    ThreadPool& pool = ThreadPool::shared();
+    pool.parallelFor("scan.morsels", 0, std::min(pool.threadCount(), morsels), 1, [&](size_t, size_t) {
+        for (size_t morsel = nextMorsel++; morsel < morsels; morsel = nextMorsel++) {
+            visit(morsel, morsel * morselSize, std::min(datablockCount, (morsel + 1) * morselSize));
+        }
+    });
+
+    return datablockCount;
+}
+
+size_t Storage::scanMorsels(size_t morsels, const std::function<void(size_t, const std::vector<Record>&)>& visit) const {
+    return scanMorselBlocks(morsels, [&](size_t morsel, size_t firstBlock, size_t endBlock) {
+        std::vector<Record> records;
+        for (size_t datablockId = firstBlock; datablockId < endBlock; ++datablockId) {
+            readPage(static_cast<uint16_t>(datablockId), [&](const Datablock& datablock) {
+                for (const auto& pair : datablock.getRecordLocations()) {
+                    records.push_back(deserializeRecord(datablock.getRecordAt(pair.second)));
+                }
+                return 0;
+            });
+        }
+        visit(morsel, records);
+    });
+}
+
+ScanCounters Storage::scanMorsels(size_t morsels, const Predicate& predicate,
+                                 const std::function<void(size_t, const std::vector<Record>&)>& visit) const {
+    ScanCounters counters;
+    std::mutex countersMutex;
+    scanMorselBlocks(morsels, [&](size_t morsel, size_t firstBlock, size_t endBlock) {
+        ScanCounters morselCounters;
+        std::vector<Record> records;
+        std::vector<uint32_t> slots;
+        for (size_t datablockId = firstBlock; datablockId < endBlock; ++datablockId) {
+            uint16_t id = static_cast<uint16_t>(datablockId);
+            selectSlots(id, predicate, slots, morselCounters);
+            if (slots.empty()) continue;
+            readSlots(id, slots.data(), slots.size(), records);
+            morselCounters.bytesRead += slots.size() * RECORD_SIZE;
+        }
+        visit(morsel, records);
+
+        std::lock_guard<std::mutex> lock(countersMutex);
+        counters.blocksRead += morselCounters.blocksRead;
+        counters.blocksSkipped += morselCounters.blocksSkipped;
+        counters.bytesRead += morselCounters.bytesRead;
+    });
+    return counters;
+}
+
 std::vector<Record> Storage::getAllRecords() const {
+    // Each block is decoded into its own slot, then the slots are joined in block order
+    uint16_t datablockCount = getDatablockCount();
+    std::vector<std::vector<Record>> perBlock(datablockCount);
+    ThreadPool::shared().parallelFor("load.records", 0, datablockCount, 8, [&](size_t from, size_t to) {
+        for (size_t datablockId = from; datablockId < to; ++datablockId) {
+            perBlock[datablockId] = readPage(static_cast<uint16_t>(datablockId), [this](const Datablock& datablock) {
+                std::vector<Record> records;
+                for (const auto& pair : datablock.getRecordLocations()) {
+                    records.push_back(deserializeRecord(datablock.getRecordAt(pair.second)));
+                }
+                return records;
+            });
+        }
+    });
+
     std::vector<Record> allRecords;
     allRecords.reserve(totalRecords);
-
-    for (const auto& datablock : datablocks) {
-        for (const auto& pair : datablock.getRecordLocations()) {
-            std::vector<char> serializedRecord = datablock.getRecord(pair.first);
-            allRecords.push_back(deserializeRecord(serializedRecord));
-        }
+    for (const auto& records : perBlock) {
+        allRecords.insert(allRecords.end(), records.begin(), records.end());
     }
 
     return allRecords;
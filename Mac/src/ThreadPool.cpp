@@ -0,0 +1,198 @@
+#include "ThreadPool.h"
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+
+namespace {
+// Which pool the current thread works for, and its queue there
+thread_local const ThreadPool* currentPool = nullptr;
+thread_local size_t currentQueue = 0;
+}
+
+ThreadPool::ThreadPool(size_t threads) {
+    start(threads);
+}
+
+ThreadPool::~ThreadPool() {
+    stop();
+}
+
+ThreadPool& ThreadPool::shared() {
+    static ThreadPool pool;
+    return pool;
+}
+
+void ThreadPool::resize(size_t threads) {
+    stop();
+    start(threads);
+}
+
+void ThreadPool::start(size_t threads) {
+    threads = std::max<size_t>(threads, 1);
+    queues.clear();
+    for (size_t i = 0; i < threads; ++i) {
+        queues.push_back(std::make_unique<TaskQueue>());
+    }
+    for (size_t i = 0; i + 1 < threads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+void ThreadPool::stop() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+    stopping = false;
+}
+
+size_t ThreadPool::homeQueue() const {
+    return currentPool == this ? currentQueue : queues.size() - 1;
+}
+
+void ThreadPool::push(Task task) {
+    TaskQueue& queue = *queues[homeQueue()];
+    // Counted before it is visible, so a thief's decrement can never run ahead of this increment
+    queued++;
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(std::move(task));
+    }
+    // Taking the lock orders this push before any worker's check of queued on its way to sleep
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wakeUp.notify_one();
+}
+
+bool ThreadPool::runOne() {
+    size_t home = homeQueue();
+    bool isWorker = home + 1 < queues.size();
+    Task task;
+    size_t takenFrom = queues.size();
+
+    // A worker takes its newest task, the outside queue is served oldest first like every victim
+    {
+        TaskQueue& own = *queues[home];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            if (isWorker) {
+                task = std::move(own.tasks.back());
+                own.tasks.pop_back();
+            } else {
+                task = std::move(own.tasks.front());
+                own.tasks.pop_front();
+            }
+            takenFrom = home;
+        }
+    }
+    for (size_t i = 1; takenFrom == queues.size() && i < queues.size(); ++i) {
+        size_t victim = (home + i) % queues.size();
+        TaskQueue& queue = *queues[victim];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.tasks.empty()) {
+            task = std::move(queue.tasks.front());
+            queue.tasks.pop_front();
+            takenFrom = victim;
+        }
+    }
+    if (takenFrom == queues.size()) return false;
+    queued--;
+
+    TaskGroup* group = task.group;
+    auto start = std::chrono::steady_clock::now();
+    try {
+        task.run();
+    } catch (...) {
+        std::lock_guard<std::mutex> lock(group->errorMutex);
+        if (!group->error) group->error = std::current_exception();
+    }
+    double elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        TaskStats& stats = taskStats[group->label];
+        stats.tasks++;
+        stats.stolen += takenFrom != home;
+        stats.totalMicroseconds += elapsed;
+        stats.longestMicroseconds = std::max(stats.longestMicroseconds, elapsed);
+    }
+    // Last touch of the group: its owner may return from wait() and destroy it right after
+    group->pending.fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t index) {
+    currentPool = this;
+    currentQueue = index;
+    while (true) {
+        if (runOne()) continue;
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this]() { return stopping || queued > 0; });
+        if (stopping && queued == 0) return;
+    }
+}
+
+void ThreadPool::parallelFor(const std::string& label, size_t begin, size_t end, size_t grain,
+                             const std::function<void(size_t, size_t)>& body) {
+    grain = std::max<size_t>(grain, 1);
+    TaskGroup group(label, *this);
+    for (size_t chunk = begin; chunk < end; chunk += grain) {
+        size_t chunkEnd = std::min(end, chunk + grain);
+        group.run([&body, chunk, chunkEnd]() { body(chunk, chunkEnd); });
+    }
+    group.wait();
+}
+
+std::map<std::string, ThreadPool::TaskStats> ThreadPool::stats() const {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return taskStats;
+}
+
+void ThreadPool::resetStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    taskStats.clear();
+}
+
+void ThreadPool::printStats() const {
+    std::cout << std::left << std::setw(18) << "Task" << std::right << std::setw(8) << "Tasks" << std::setw(8)
+              << "Stolen" << std::setw(14) << "Total (us)" << std::setw(12) << "Mean (us)" << std::setw(14)
+              << "Longest (us)" << std::endl;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const auto& [label, stats] : this->stats()) {
+        std::cout << std::left << std::setw(18) << label << std::right << std::setw(8) << stats.tasks << std::setw(8)
+                  << stats.stolen << std::setw(14) << stats.totalMicroseconds << std::setw(12)
+                  << stats.totalMicroseconds / stats.tasks << std::setw(14) << stats.longestMicroseconds << std::endl;
+    }
+    std::cout.unsetf(std::ios::fixed);
+    std::cout << std::setprecision(6);
+}
+
+TaskGroup::TaskGroup(std::string label, ThreadPool& pool) : pool(pool), label(std::move(label)) {}
+
+TaskGroup::~TaskGroup() {
+    // Tasks refer to the group, so none may outlive it; an error nobody waited for is dropped
+    try {
+        wait();
+    } catch (...) {
+    }
+}
+
+void TaskGroup::run(std::function<void()> task) {
+    pending++;
+    pool.push({std::move(task), this});
+}
+
+void TaskGroup::wait() {
+    while (pending.load(std::memory_order_acquire) > 0) {
+        if (!pool.runOne()) std::this_thread::yield();
+    }
+    std::lock_guard<std::mutex> lock(errorMutex);
+    if (error) {
+        std::exception_ptr thrown = error;
+        error = nullptr;
+        std::rethrow_exception(thrown);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef CONCURRENTBPLUSTREE_H
+#define CONCURRENTBPLUSTREE_H
+
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "BPlusTree.h"
+
+// Version latch for optimistic lock coupling. Readers note the version, read without writing anything, and
+// check afterwards that it has not moved; writers set the lock bit with a compare-and-swap from a version they
+// read, so a writer never waits and a failed attempt simply restarts the operation.
+class OptimisticLatch {
+public:
+    // Version to validate against later, or false when a writer holds the latch
+    bool readLock(uint64_t& version) const {
+        version = word.load(std::memory_order_acquire);
+        return (version & lockedBit) == 0;
+    }
+    bool validate(uint64_t version) const {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return word.load(std::memory_order_relaxed) == version;
+    }
+    // Takes the latch only if nobody wrote since version was read
+    bool upgradeToWriteLock(uint64_t& version) {
+        if (!word.compare_exchange_strong(version, version + lockedBit, std::memory_order_acquire)) return false;
+        version += lockedBit;
+        return true;
+    }
+    // Clears the lock bit and moves the version on, which fails every reader that started before
+    void writeUnlock() { word.fetch_add(lockedBit, std::memory_order_release); }
+
+private:
+    static constexpr uint64_t lockedBit = 2;
+    std::atomic<uint64_t> word{0};
+};
+
+// Thread-safe in-memory B+ tree over (key, value) entries, for serving range searches while ingesting.
+// Every (key, value) pair is its own entry, so equal keys need no posting lists and entries never move between
+// nodes except by splits. Inner nodes are split on the way down as soon as they are full, so a writer only
+// ever latches the node it changes and its parent. Nodes are never merged or freed before the tree is, so an
+// optimistic reader may always follow a pointer it read and let validation decide whether to trust what it saw.
+template <typename Key, typename Value = uint32_t, int Order = pageOrder<Key, Value>()>
+class ConcurrentBPlusTree {
+public:
+    static_assert(Order >= 4, "B+ tree order must be at least 4");
+
+    using Codec = KeyCodec<Key>;
+    using StoredKey = typename Codec::Encoded;
+    using EntryKey = std::pair<StoredKey, Value>;   // what nodes hold and compare
+
+    ConcurrentBPlusTree();
+    ConcurrentBPlusTree(const ConcurrentBPlusTree&) = delete;
+    ConcurrentBPlusTree& operator=(const ConcurrentBPlusTree&) = delete;
+
+    // Safe to call from any number of threads at once, alongside each other
+    void insert(Key key, Value value);
+    std::vector<Value> rangeSearch(Key lower, Key upper) const;
+
+    // Only meaningful while no writer runs
+    size_t size() const;
+    int getTreeHeight() const { return treeHeight.load(std::memory_order_relaxed); }
+    void verifyTree() const;
+
+private:
+    struct Node {
+        OptimisticLatch latch;
+        bool isLeaf;
+        uint16_t count = 0;   // entries in a leaf, separators in an inner node; at most Order - 1
+
+        explicit Node(bool leaf) : isLeaf(leaf) {}
+    };
+
+    struct LeafNode : Node {
+        std::array<EntryKey, Order - 1> entries;
+        LeafNode* next = nullptr;
+
+        LeafNode() : Node(true) {}
+    };
+
+    struct InnerNode : Node {
+        // Separator i is the smallest entry of children[i + 1]'s subtree at the time it split off
+        std::array<EntryKey, Order - 1> keys;
+        std::array<Node*, Order> children{};
+
+        InnerNode() : Node(false) {}
+    };
+
+    std::atomic<Node*> root;
+    std::atomic<int> treeHeight{1};
+    std::mutex nodesMutex;
+    // Own every node; nodes live as long as the tree
+    std::vector<std::unique_ptr<LeafNode>> leaves;
+    std::vector<std::unique_ptr<InnerNode>> inners;
+
+    LeafNode* newLeaf();
+    InnerNode* newInner();
+    // Moves the upper half of a full node into a new right sibling and returns (separator, sibling)
+    std::pair<EntryKey, Node*> split(Node* node);
+    void insertIntoInner(InnerNode* inner, const EntryKey& separator, Node* child);
+    // Descends optimistically to the leaf that would hold entry, with the leaf's version
+    const LeafNode* findLeaf(const EntryKey& entry, uint64_t& version) const;
+};
+
+#endif // CONCURRENTBPLUSTREE_H
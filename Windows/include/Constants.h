@@ -4,6 +4,9 @@
 #include <inttypes.h>
 #include <iostream>
 
+// Index nodes are sized at compile time to fit in one page of this size
+constexpr uint16_t INDEX_PAGE_SIZE = 4096;
+
 extern uint8_t RECORD_SIZE;
 extern uint16_t BLOCK_SIZE;
 extern uint16_t BLOCK_HEADER_SIZE;
@@ -14,7 +17,7 @@ extern uint16_t MIN_FREE_SPACE_PER_BLOCK;
 extern std::string DATA_FILENAME;
 extern std::string DATABASE_FILENAME;
 extern std::string INDEX_FILENAME;
-extern uint16_t BPLUSTREE_ORDER;
-extern bool isEqual(float a, float b, float epsilon = 1e-6f);
+extern std::string INDEX_CATALOG_FILENAME;
+extern std::string GAMEDATE_INDEX_FILENAME;
 
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+#ifndef INDEXMANAGER_H
+#define INDEXMANAGER_H
+
+#include <map>
+#include <optional>
+#include <string>
+#include <variant>
+#include "BPlusTree.h"
+
+// One B+ tree per index; the key type follows the indexed column's storage type
+using ColumnIndex = std::variant<BPlusTree<float, uint32_t>, BPlusTree<int, uint32_t>, BPlusTree<uint8_t, uint32_t>,
+                                 BPlusTree<CompositeKey<int, int>, uint32_t>>;
+
+struct IndexInfo {
+    std::string name;
+    std::vector<Column> columns;   // more than one for a composite index, in key order
+    std::optional<Column> measure; // column summed per subtree, for index-only COUNT/SUM/AVG
+    std::vector<Column> payload;   // columns copied into the leaves, for index-only scans
+    ColumnIndex tree;
+    bool unsaved = false;          // changed by insertRecord since its file was last written
+};
+
+// Catalog of named secondary indexes over Storage. The catalog file lists
+// "name column[,column] indexFile [measure|- [payload[,payload]]]" per line; each index is persisted in its own file.
+class IndexManager {
+public:
+    IndexManager(Storage& storage, const std::string& catalogFilename);
+    // Writes the indexes single inserts have changed; an error writing them here is dropped
+    ~IndexManager();
+
+    void createIndex(const std::string& name, const std::vector<Column>& columns, const std::string& indexFilename = "",
+                     std::optional<Column> measure = std::nullopt, const std::vector<Column>& payload = {});
+    void ensureIndex(const std::string& name, const std::vector<Column>& columns, const std::string& indexFilename = "",
+                     std::optional<Column> measure = std::nullopt, const std::vector<Column>& payload = {});
+    bool hasIndex(const std::string& name) const { return indexes.count(name) > 0; }
+    IndexInfo* findIndexOn(const std::vector<Column>& columns);
+
+    template <typename Index>
+    Index& getIndex(const std::string& name) {
+        auto it = indexes.find(name);
+        if (it == indexes.end()) {
+            throw std::runtime_error("No such index: " + name);
+        }
+        return std::get<Index>(it->second.tree);
+    }
+
+    // Inserts into Storage, which writes the changed page, and into every index in memory; the indexes are
+    // written by flush(), by the next insertRecords, or at destruction
+    uint16_t insertRecord(const Record& record);
+    // Same for many records, with one sorted batch insertion per index, and every index written at the end
+    std::vector<uint16_t> insertRecords(const std::vector<Record>& records);
+    // Writes every index changed since it was last written
+    void flush();
+
+    // lower <= column <= upper, through an index on the column if one exists, else a prefix scan of
+    // a composite index led by the column, otherwise a full scan
+    SearchResult rangeSearch(Column column, double lower, double upper);
+    SearchResult scan(Column column, double lower, double upper);
+
+    // Like rangeSearch, but when an index on the column covers every needed column the records come straight
+    // from its leaves; they then hold only recordId and the covered columns
+    SearchResult coveredRangeSearch(Column column, double lower, double upper, const std::vector<Column>& needed);
+
+    // first == value and lower <= second <= upper, through a composite (first, second) index if one exists
+    SearchResult rangeSearch(Column first, double value, Column second, double lower, double upper);
+    SearchResult scan(Column first, double value, Column second, double lower, double upper);
+
+    // COUNT / SUM / AVG of measure over lower <= column <= upper, from an index on the column that keeps
+    // sums of measure if one exists, otherwise by a full scan
+    AggregateResult aggregate(Column column, double lower, double upper, Column measure);
+    AggregateResult scanAggregate(Column column, double lower, double upper, Column measure);
+
+    void printStatistics() const;
+
+private:
+    Storage& storage;
+    std::string catalogFilename;
+    std::map<std::string, IndexInfo> indexes;
+
+    void loadCatalog();
+    void saveCatalog() const;
+};
+
+#endif // INDEXMANAGER_H
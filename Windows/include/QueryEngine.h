@@ -0,0 +1,168 @@
+#ifndef QUERYENGINE_H
+#define QUERYENGINE_H
+
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "BPlusTree.h"
+
+// Vectorized, batch-at-a-time execution. A plan is a chain of operators, each pulling batches from the one
+// below it: a Scan or an IndexRangeScan at the bottom, any of Filter, Project and Limit above, and a sink, Collect
+// or Aggregate, that drains the chain. A batch holds whole columns and a selection vector naming the rows still
+// alive, so every operator runs a tight loop over arrays and costs one virtual call per batch, not per row.
+
+// Up to capacity rows in columns, widened to 32 bits as in ColumnValues
+struct Batch {
+    static constexpr size_t capacity = 1024;
+    static constexpr size_t columnCount = COLUMN_COUNT;
+
+    size_t rows = 0;
+    std::vector<uint16_t> recordIds;
+    // Where each row is stored, for rows that came from a Scan; lets Collect read the columns a batch lacks
+    std::vector<uint16_t> datablockIds;
+    std::vector<uint32_t> slots;
+    std::array<ColumnValues, columnCount> columns;
+    std::array<bool, columnCount> carried{};
+    // The rows whole, when the source decoded them anyway, as an IndexRangeScan does; empty otherwise
+    std::vector<Record> records;
+    // The rows still selected, ascending
+    std::vector<uint32_t> selection;
+
+    bool carries(Column column) const { return carried[static_cast<size_t>(column)]; }
+    ColumnValues& values(Column column) { return columns[static_cast<size_t>(column)]; }
+    const ColumnValues& values(Column column) const { return columns[static_cast<size_t>(column)]; }
+    double value(Column column, size_t row) const;
+    // Empties the batch but keeps the vectors' memory for the next one
+    void clear();
+};
+
+class Operator {
+public:
+    virtual ~Operator() = default;
+    // Replaces batch with the next rows; false once there are none left
+    virtual bool next(Batch& batch) = 0;
+    // What the plan below and including this operator has read so far
+    virtual int indexNodesAccessed() const { return child ? child->indexNodesAccessed() : 0; }
+    virtual int dataBlocksAccessed() const { return child ? child->dataBlocksAccessed() : 0; }
+
+protected:
+    explicit Operator(std::unique_ptr<Operator> child = nullptr) : child(std::move(child)) {}
+
+    std::unique_ptr<Operator> child;
+};
+
+using OperatorPtr = std::unique_ptr<Operator>;
+
+// Blocks [firstBlock, endBlock) in order, whole blocks per batch. Only the given columns are read, straight
+// from the record bytes; no Record is decoded. With a pushed-down predicate, each block's rows are first tested
+// in Storage::selectSlots: only the rows that pass are selected, and a block with none is neither read nor
+// passed on.
+class Scan : public Operator {
+public:
+    Scan(const Storage& storage, std::vector<Column> columns, size_t firstBlock = 0,
+         size_t endBlock = std::numeric_limits<size_t>::max());
+    Scan(const Storage& storage, std::vector<Column> columns, Predicate pushed, size_t firstBlock = 0,
+         size_t endBlock = std::numeric_limits<size_t>::max());
+    bool next(Batch& batch) override;
+    int dataBlocksAccessed() const override { return blocksRead; }
+    const ScanCounters& pushdownCounters() const { return counters; }
+
+private:
+    const Storage& storage;
+    std::vector<Column> columns;
+    size_t nextBlock;
+    size_t endBlock;
+    std::optional<Predicate> pushed;
+    int blocksRead = 0;
+    ScanCounters counters;
+    ColumnValues blockValues;
+    std::vector<uint16_t> blockIds;
+    std::vector<uint32_t> selectedSlots;
+};
+
+// The records with lower <= key <= upper, in key order a batch at a time; each batch's records are fetched in
+// block order and carry every column. The block the previous batch ended on is still at hand, so a block
+// straddling two batches counts as one read, as in rangeSearch.
+template <typename Key>
+class IndexRangeScan : public Operator {
+public:
+    IndexRangeScan(BPlusTree<Key, uint32_t>& tree, Key lower, Key upper, Storage& storage);
+    bool next(Batch& batch) override;
+    int indexNodesAccessed() const override { return cursor.indexNodesAccessed(); }
+    int dataBlocksAccessed() const override { return blocksRead; }
+
+private:
+    typename BPlusTree<Key, uint32_t>::Cursor cursor;
+    Storage& storage;
+    int blocksRead = 0;
+    int heldBlock = -1;
+    std::vector<uint16_t> ids;
+};
+
+// Keeps the selected rows with lower <= column <= upper, testing the whole column with the SIMD filter kernels.
+// Batches left with no row selected are not passed on.
+class Filter : public Operator {
+public:
+    Filter(OperatorPtr child, ColumnRange range);
+    bool next(Batch& batch) override;
+
+private:
+    ColumnRange range;
+    std::vector<uint64_t> mask;
+};
+
+// Passes on only the given columns, which the batches must carry
+class Project : public Operator {
+public:
+    Project(OperatorPtr child, std::vector<Column> columns);
+    bool next(Batch& batch) override;
+
+private:
+    std::array<bool, Batch::columnCount> kept{};
+};
+
+// The first limit selected rows; stops pulling from the child once they are through
+class Limit : public Operator {
+public:
+    Limit(OperatorPtr child, size_t limit);
+    bool next(Batch& batch) override;
+
+private:
+    size_t remaining;
+};
+
+// Drains a plan into records. Rows a source decoded whole are passed on as they are, and rows of a batch that
+// carries every column are assembled from the columns; other rows are read whole from their slots when storage
+// is given, else they hold recordId and the carried columns only, as after a Project.
+class Collect {
+public:
+    explicit Collect(OperatorPtr plan, const Storage* storage = nullptr);
+    SearchResult run();
+
+private:
+    OperatorPtr plan;
+    const Storage* storage;
+};
+
+// COUNT / SUM / AVG of measure over the selected rows
+class Aggregate {
+public:
+    Aggregate(OperatorPtr plan, Column measure);
+    AggregateResult run();
+
+private:
+    OperatorPtr plan;
+    Column measure;
+};
+
+// One plan per morsel of blocks, built by plan(firstBlock, endBlock) and run on the shared pool as in
+// Storage::scanMorselBlocks; the morsels' results are joined in block order
+using MorselPlan = std::function<OperatorPtr(size_t firstBlock, size_t endBlock)>;
+SearchResult collectMorsels(const Storage& storage, const MorselPlan& plan, bool readRecords = true);
+AggregateResult aggregateMorsels(const Storage& storage, const MorselPlan& plan, Column measure);
+
+#endif // QUERYENGINE_H
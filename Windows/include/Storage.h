@@ -1,15 +1,24 @@
 #ifndef STORAGE_H
 #define STORAGE_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <functional>
+#include <ios>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <filesystem>
 #include <unordered_map>
 #include "Datablock.h"
 
-#pragma pack(push, 1);
+#pragma pack(push, 1)
 struct Record {
-    int gameDate;             // 4 bytes
+    int gameDate;             // days since epoch: 4 bytes
     int teamId;               // 4 bytes
     uint8_t ptsHome;          // (36 ~ 168): 1 byte
     float fgPctHome;          // 4 bytes
@@ -20,40 +29,244 @@ struct Record {
     bool homeTeamWins;        // 1 byte
     uint16_t recordId;        // 2 bytes
 };
+#pragma pack(pop)
 
+// gameDate is stored as days since 1970-01-01 so that it sorts chronologically
+int encodeGameDate(int day, int month, int year);
+int encodeGameDate(const std::string& ddmmyyyy);
+std::string decodeGameDate(int days);
+
+// Record columns that can be indexed or filtered on
+enum class Column {
+    GameDate,
+    TeamId,
+    PtsHome,
+    FgPctHome,
+    FtPctHome,
+    Fg3PctHome,
+    AstHome,
+    RebHome,
+    HomeTeamWins
+};
+constexpr size_t COLUMN_COUNT = static_cast<size_t>(Column::HomeTeamWins) + 1;
+
+const std::vector<Column>& allColumns();
+std::string columnName(Column column);
+Column parseColumn(const std::string& name);
+double columnValue(const Record& record, Column column);
+void setColumnValue(Record& record, Column column, double value);
+// The fg/ft/3pt percentages; every other column is an integer of some width
+bool isFloatColumn(Column column);
+// Where a column sits in the packed Record, which is also its offset in a stored record, and the bytes it takes
+size_t columnOffset(Column column);
+size_t columnWidth(Column column);
+
+// lower <= column <= upper
+struct ColumnRange {
+    Column column;
+    double lower;
+    double upper;
+};
+
+// One column's values across the slots of a block, widened to 32 bits: float columns fill floats, the others ints
+struct ColumnValues {
+    std::vector<float> floats;
+    std::vector<int32_t> ints;
+};
+
+// Sets bit i of mask, a selection bitmask as in SimdFilter.h, for each of the first count values that lies in the
+// range, compared in the column's own type the way an index on it compares
+void selectColumnRange(const ColumnValues& values, size_t count, const ColumnRange& range, uint64_t* mask);
+
+// Filter on records: a comparison of one column with constants, or an AND / OR of other predicates. Constants are
+// compared in the column's own type, as in selectColumnRange. Storage scans test it on the raw column bytes of a
+// block, after asking the block's zone map whether it can settle the question without them.
+struct Predicate {
+    enum class Kind { Range, In, And, Or };
+
+    Kind kind = Kind::And;
+    Column column = Column::GameDate;   // Range and In
+    double lower = 0.0;                 // Range: lower <= column <= upper
+    double upper = 0.0;
+    std::vector<double> values;         // In: column is one of these
+    std::vector<Predicate> children;    // And, Or; an empty And holds for every record, an empty Or for none
+
+    static Predicate between(Column column, double lower, double upper);
+    static Predicate equal(Column column, double value);
+    static Predicate atLeast(Column column, double value);
+    static Predicate atMost(Column column, double value);
+    static Predicate less(Column column, double value);
+    static Predicate greater(Column column, double value);
+    static Predicate in(Column column, std::vector<double> values);
+    static Predicate allOf(std::vector<Predicate> children);
+    static Predicate anyOf(std::vector<Predicate> children);
+
+    // Tests one decoded record, the slow way
+    bool matches(const Record& record) const;
+    std::string toString() const;
+};
+
+// What a filtered scan read. A block whose zone map rules every record out is skipped without being read;
+// bytesRead counts the column bytes the predicate was tested on and the bytes of the records decoded.
+struct ScanCounters {
+    size_t blocksRead = 0;
+    size_t blocksSkipped = 0;
+    size_t bytesRead = 0;
+};
+
+// Append-only array whose elements never move: fixed-size chunks are allocated as the array grows and freed only
+// with it, so a reader holding an element is never invalidated by a concurrent append. Appends must be serialized.
+template <typename T, size_t ChunkSize, size_t MaxChunks>
+class StableArray {
+public:
+    StableArray() = default;
+    StableArray(const StableArray&) = delete;
+    StableArray& operator=(const StableArray&) = delete;
+    ~StableArray() {
+        for (auto& chunk : chunks) delete[] chunk.load();
+    }
+
+    static constexpr size_t capacity() { return ChunkSize * MaxChunks; }
+
+    // The element must lie in a chunk that already exists
+    T& operator[](size_t index) const { return chunks[index / ChunkSize].load(std::memory_order_acquire)[index % ChunkSize]; }
+    bool contains(size_t index) const {
+        return index < capacity() && chunks[index / ChunkSize].load(std::memory_order_acquire) != nullptr;
+    }
+    // Allocates the element's chunk if needed; elements start value-initialized
+    T& grow(size_t index) {
+        if (index >= capacity()) {
+            throw std::runtime_error("Stable array is full");
+        }
+        auto& chunk = chunks[index / ChunkSize];
+        if (!chunk.load(std::memory_order_relaxed)) chunk.store(new T[ChunkSize](), std::memory_order_release);
+        return (*this)[index];
+    }
+
+private:
+    std::array<std::atomic<T*>, MaxChunks> chunks{};
+};
+
+// Records and data blocks are safe to read from any number of threads while one thread appends. The page
+// directory never moves a page, full pages are sealed and then read without latching, and the one page still
+// being filled is read under a shared latch that the appending writer takes exclusively.
 class Storage {
 public:
+    // Record ids are 16-bit and the count of records must fit as well, so ids run from 0 to maxRecords - 1
+    static constexpr size_t maxRecords = std::numeric_limits<uint16_t>::max();
+
     Storage(const std::string& filename);
+    ~Storage();
     void ingestData(const std::string& inputFilename);
+    // Appends a record and writes the page it went into; throws once maxRecords records exist
+    uint16_t insertRecord(Record record);
+    // Appends records in order and writes the pages they went into once, for the whole batch; throws, appending
+    // none of them, if they would pass maxRecords
+    std::vector<uint16_t> insertRecords(const std::vector<Record>& records);
     Record getRecord(uint16_t recordId);
     std::vector<Record> bulkRead(const std::vector<uint16_t>& recordIds);
+    // Reads in ascending block order and, within a block, ascending slot order; counts distinct blocks read
+    std::vector<Record> bulkReadInBlockOrder(const std::vector<uint16_t>& recordIds, int& dataBlocksAccessed);
+    // Same, for a caller that fetches in several calls: heldBlock, the block the previous call ended on (-1 for
+    // none), is still at hand and not counted again, and is set to the block this call ends on. recordBlocks, if
+    // given, receives the block each returned record was read from.
+    std::vector<Record> bulkReadInBlockOrder(const std::vector<uint16_t>& recordIds, int& dataBlocksAccessed, int& heldBlock,
+                                             std::vector<uint16_t>* recordBlocks = nullptr);
+    // How many records bulkReadInBlockOrder requests ahead of the one it decodes; 0 turns it off
+    void setPrefetchDistance(size_t distance) { prefetchDistance = distance; }
+    size_t getPrefetchDistance() const { return prefetchDistance; }
     void printStatistics();
     size_t getTotalRecords() const;
     std::vector<Record> getAllRecords() const;
-    uint16_t getDatablockCount() {return datablockCount;}
-    
-    const std::unordered_map<uint16_t, std::pair<uint16_t, uint16_t>>& getRecordLocations() const {
-        return recordLocations;
-    }
+
+    // Full scan in morsels of consecutive blocks. Threads of the shared pool claim the next morsel off one counter
+    // until none is left, so a thread that finishes early simply claims more. visit(morsel, records) gets every
+    // record of one morsel in a single call on a single thread; morsels are numbered in block order, so callers
+    // can keep per-morsel partial results and combine them in order. Scans the first morsels morsels and returns
+    // how many blocks that was; blocks appended meanwhile are not visited.
+    size_t scanMorsels(size_t morsels, const std::function<void(size_t morsel, const std::vector<Record>& records)>& visit) const;
+    // Same, but visit gets only the records that satisfy predicate, which is pushed down to selectSlots, so only
+    // the records that pass are decoded
+    ScanCounters scanMorsels(size_t morsels, const Predicate& predicate,
+                             const std::function<void(size_t morsel, const std::vector<Record>& records)>& visit) const;
+    // The scheduling under both: visit(morsel, firstBlock, endBlock) reads blocks [firstBlock, endBlock) itself
+    size_t scanMorselBlocks(size_t morsels, const std::function<void(size_t morsel, size_t firstBlock, size_t endBlock)>& visit) const;
+    size_t morselCount() const { return (getDatablockCount() + morselSize - 1) / morselSize; }
+    void setMorselSize(size_t blocks) { morselSize = std::max<size_t>(blocks, 1); }
+    uint16_t getDatablockCount() const { return static_cast<uint16_t>(pageCount.load(std::memory_order_acquire)); }
+
+    // {datablockId, offset} of a stored record
+    std::pair<uint16_t, uint16_t> getRecordLocation(uint16_t recordId) const;
 
     std::unordered_map<uint16_t, std::vector<std::pair<uint16_t, uint16_t>>> getRecordLocationsMap() const;
 
+    // The pointer stays valid for the life of the Storage; a block that is not yet full may still change
     Datablock * getDatablock(uint16_t dataBlockId);
     std::vector<Record> getRecordsWithBlockId(uint16_t datablockId);
+    // One column of every record in a block, in slot order, read straight from the record bytes with no Record
+    // decoded; returns the block's slot count. A block still being filled may have grown by the next call.
+    size_t readColumn(uint16_t datablockId, Column column, ColumnValues& values) const;
+    // The record ids of a block in slot order, the same way; returns the slot count
+    size_t readRecordIds(uint16_t datablockId, std::vector<uint16_t>& recordIds) const;
+    // The slots of a block whose records satisfy predicate, tested on the raw column bytes with the SIMD filter
+    // kernels and only for the columns the predicate still needs once the zone map has had its say. Returns the
+    // block's slot count and adds what it read to counters.
+    size_t selectSlots(uint16_t datablockId, const Predicate& predicate, std::vector<uint32_t>& slots,
+                       ScanCounters& counters) const;
+    // Zone maps (per-block minimum and maximum of every column) are kept for every full block; turning their use
+    // off makes every filtered scan test every block, for comparison
+    void setZoneMapsEnabled(bool enabled) { zoneMapsEnabled = enabled; }
+    // Decodes the records in the given slots of a block and appends them to out
+    void readSlots(uint16_t datablockId, const uint32_t* slots, size_t count, std::vector<Record>& out) const;
     void loadDatablocks();
 
 private:
+    struct Page {
+        Datablock block;
+        std::atomic<bool> sealed{false};   // set once the block is full; it never changes afterwards
+        // {minimum, maximum} of every column, filled in when the page is sealed
+        std::array<std::pair<double, double>, COLUMN_COUNT> zoneMap{};
+
+        explicit Page(Datablock block) : block(std::move(block)) {}
+    };
+
     std::string filename;
-    std::vector<Datablock> datablocks;
+    // The file as last written: how many pages it holds, and where the last one starts and how long it is
+    uint16_t savedPages = 0;
+    std::streamoff lastPageOffset = 0;
+    uint16_t lastPageSize = 0;
 
-    //                 recordId          dataBlockId recordId
-    std::unordered_map<uint16_t, std::pair<uint16_t, uint16_t>> recordLocations; // recordId -> {datablockId, offset}
-    uint16_t totalRecords;
+    // Page directory, indexed by datablock id, and record directory: recordId -> 1 << 32 | datablockId << 16 | offset,
+    // 0 while the record does not exist
+    StableArray<std::atomic<Page*>, 256, 256> pages;
+    StableArray<std::atomic<uint64_t>, 1024, 64> recordLocations;
+    std::atomic<uint32_t> pageCount{0};
+    std::atomic<uint16_t> totalRecords;
+    mutable std::array<std::shared_mutex, 64> pageLatches;   // striped by datablock id
+    std::mutex appendMutex;                                  // one writer at a time
 
-    uint16_t datablockCount;
-    
-    void createDatablock(const std::vector<Record>& records);
+    size_t prefetchDistance = 0;   // off by default, as for BPlusTree
+    size_t morselSize = 8;   // blocks per morsel
+    bool zoneMapsEnabled = true;
+
+    Page& page(uint16_t datablockId) const { return *pages[datablockId].load(std::memory_order_acquire); }
+    Page& appendPage(Datablock block);
+    void setRecordLocation(uint16_t recordId, uint16_t datablockId, uint16_t offset);
+    // Fills in the page's zone map and marks it sealed; only the appending writer calls this
+    void seal(Page& target);
+    // Runs read(block) on a sealed page directly and on the page being filled under its shared latch
+    template <typename Read>
+    auto readPage(uint16_t datablockId, Read read) const;
+    void clearPages();
+
+    // Packs records, in order, into new full blocks
+    void createDatablocks(const std::vector<Record>& records);
     void saveDatablocks();
+    // Writes only the pages appends touched: the last saved page, over its old copy at the end of the file, and
+    // any started after it
+    void saveAppendedPages();
+    // Places one record in the last page or a new one after it; the caller holds appendMutex and saves the pages
+    uint16_t appendRecord(Record record);
     
     std::vector<char> serializeRecord(const Record& record) const;
     Record deserializeRecord(const std::vector<char>& data) const;
@@ -1,363 +1,1360 @@
 #include "BPlusTree.h"
+#include "Hardware.h"
+#include "ThreadPool.h"
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <queue>
 #include <stack>
+#include <tuple>
 #include <set>
 #include <unordered_map>
 
 
-bool compareRecordPairs(const std::pair<float, uint32_t>& a, const std::pair<float, uint32_t>& b) {
-    
-    // First we compare the key
-    if (a.first != b.first) {
-        return a.first < b.first;
-    }
-    // If keys are equal, compare datablockId first, then fileOffset
-    // if (a.second.datablockId != b.second.datablockId) {
-    //     return a.second.datablockId < b.second.datablockId;
-    // }
-    return a.second < b.second;
+float fgPctHomeKey(const Record& record) {
+    return record.fgPctHome;
+}
+
+int gameDateKey(const Record& record) {
+    return record.gameDate;
+}
+
+int teamIdKey(const Record& record) {
+    return record.teamId;
+}
+
+uint8_t ptsHomeKey(const Record& record) {
+    return record.ptsHome;
+}
+
+float ftPctHomeKey(const Record& record) {
+    return record.ftPctHome;
+}
+
+float fg3PctHomeKey(const Record& record) {
+    return record.fg3PctHome;
+}
+
+uint8_t astHomeKey(const Record& record) {
+    return record.astHome;
+}
+
+uint8_t rebHomeKey(const Record& record) {
+    return record.rebHome;
+}
+
+uint8_t homeTeamWinsKey(const Record& record) {
+    return record.homeTeamWins;
+}
+
+CompositeKey<int, int> teamDateKey(const Record& record) {
+    return {record.teamId, record.gameDate};
+}
+
+// Prints a key as a number, also for single-byte keys that would otherwise print as characters
+template <typename Key>
+static void printKey(std::ostream& os, const Key& key) {
+    os << +key;
+}
+
+template <typename First, typename Second>
+static void printKey(std::ostream& os, const CompositeKey<First, Second>& key) {
+    os << "(" << +key.first << "," << +key.second << ")";
 }
 
+// Spread n items over the fewest nodes of at most maxPerNode, evenly, so every node stays at least half full
+static std::vector<size_t> evenNodeSizes(size_t n, size_t maxPerNode) {
+    size_t nodeCount = (n + maxPerNode - 1) / maxPerNode;
+    std::vector<size_t> sizes(nodeCount, n / nodeCount);
+    for (size_t i = 0; i < n % nodeCount; ++i) sizes[i]++;
+    return sizes;
+}
+
+
+template <typename Key, typename Value, int Order>
+BPlusTree<Key, Value, Order>::BPlusTree(const std::string& indexFilename, KeyExtractor keyOf, std::optional<Column> measure,
+                                        std::vector<Column> payload)
+    : root(nullptr), indexFilename(indexFilename), keyOf(keyOf), measure(measure), payload(std::move(payload)) {
+    for (Column column : this->payload) {
+        payloadFields.emplace_back(columnOffset(column), columnWidth(column));
+        payloadRowBytes += columnWidth(column);
+    }
+}
 
+template <typename Key, typename Value, int Order>
+std::vector<uint8_t> BPlusTree<Key, Value, Order>::payloadOf(const Record& record) const {
+    std::vector<uint8_t> row(payloadRowBytes);
+    const auto* fields = reinterpret_cast<const uint8_t*>(&record);
+    size_t at = 0;
+    for (const auto& [offset, width] : payloadFields) {
+        std::memcpy(row.data() + at, fields + offset, width);
+        at += width;
+    }
+    return row;
+}
 
-BPlusTree::BPlusTree(int order, const std::string& indexFilename) 
-    : order(order), indexFilename(indexFilename), root(nullptr) {}
+template <typename Key, typename Value, int Order>
+bool BPlusTree<Key, Value, Order>::covers(const std::vector<Column>& columns) const {
+    return std::all_of(columns.begin(), columns.end(), [this](Column column) {
+        return std::find(payload.begin(), payload.end(), column) != payload.end();
+    });
+}
 
-void BPlusTree::buildFromStorage(const Storage& storage) {
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::buildFromStorage(const Storage& storage) {
     std::cout << "Starting to build B+ tree from storage..." << std::endl;
 
     auto records = storage.getAllRecords();
     std::cout << "Retrieved " << records.size() << " records from storage." << std::endl;
 
-    int count = 0;
+    std::vector<Entry> entries;
+    entries.reserve(records.size());
     for (const auto& record : records) {
-        try {
+        entries.push_back({keyOf(record), record.recordId, measureOf(record), payloadOf(record)});
+    }
+    size_t count = entries.size();
+
+    bulkLoad(std::move(entries));
+
+    std::cout << "Finished building B+ tree. Total records inserted: " << count << std::endl;
+    std::cout << "Saving B+ tree to file..." << std::endl;
 
-            // START TUAN's CODE
+    saveToFile();
+    std::cout << "B+ tree saved to file." << std::endl;
+}
+
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::bulkLoad(std::vector<Entry> entries) {
+    // Sorted by encoded key, then value, so each key's ids can be appended to its posting list in order
+    std::vector<std::tuple<StoredKey, Value, size_t>> encoded(entries.size());
+    ThreadPool& pool = ThreadPool::shared();
+    pool.parallelFor("build.encode", 0, entries.size(), 4096, [&](size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            if (entries[i].payload.size() != payloadRowBytes) {
+                throw std::runtime_error("Entry payload does not match the covered columns of " + indexFilename);
+            }
+            encoded[i] = {Codec::encode(entries[i].key), entries[i].value, i};
+        }
+    });
+    parallelSort(pool, "build.sort", encoded.begin(), encoded.end(),
+                 std::less<std::tuple<StoredKey, Value, size_t>>());
+
+    // Collapse runs of equal keys into one entry with a posting list, the sum of their measures and their payloads.
+    // The sorted stream is cut into slices, each moved forward to the next key change so no run is split, and
+    // every slice is collapsed on its own thread
+    struct Group {
+        StoredKey key;
+        PostingList<Value> postings;
+        double sum;
+        std::vector<uint8_t> payloadRows;
+    };
+    size_t slices = std::max<size_t>(1, std::min(pool.threadCount() * 4, encoded.size() / 4096));
+    std::vector<size_t> sliceStarts;
+    for (size_t slice = 0; slice < slices; ++slice) {
+        size_t start = std::max(encoded.size() * slice / slices, sliceStarts.empty() ? 0 : sliceStarts.back());
+        while (start > 0 && start < encoded.size() && std::get<0>(encoded[start]) == std::get<0>(encoded[start - 1])) {
+            start++;
+        }
+        sliceStarts.push_back(start);
+    }
+    sliceStarts.push_back(encoded.size());
+
+    std::vector<std::vector<Group>> sliceGroups(slices);
+    pool.parallelFor("build.groups", 0, slices, 1, [&](size_t from, size_t to) {
+        for (size_t slice = from; slice < to; ++slice) {
+            std::vector<Group>& groups = sliceGroups[slice];
+            for (size_t i = sliceStarts[slice]; i < sliceStarts[slice + 1]; ++i) {
+                const auto& [key, value, entryIndex] = encoded[i];
+                if (groups.empty() || groups.back().key != key) {
+                    groups.push_back({key, PostingList<Value>(), 0.0, {}});
+                }
+                const Entry& entry = entries[entryIndex];
+                groups.back().postings.insert(value);
+                groups.back().sum += entry.measure;
+                groups.back().payloadRows.insert(groups.back().payloadRows.end(), entry.payload.begin(), entry.payload.end());
+            }
+        }
+    });
+    entries = {};
+    encoded = {};
 
-            // int temp;
-            // std::shared_ptr<BPlusTreeNode> temp_leaf = findLeaf(record.fgPctHome, temp);
-            // if (root != nullptr){
-            //     if (std::find(temp_leaf->keys.begin(), temp_leaf->keys.end(), record.fgPctHome) != temp_leaf->keys.end()){
-            //         continue;
-            //     }
-            // }
+    std::vector<Group> groups;
+    for (auto& slice : sliceGroups) {
+        std::move(slice.begin(), slice.end(), std::back_inserter(groups));
+    }
+    sliceGroups = {};
 
-            // END TUAN's CODE
+    root = nullptr;
+    if (groups.empty()) {
+        tree_height = 0;
+        _getTotalNodes();
+        return;
+    }
 
-            insert(record.fgPctHome, record.recordId);
-            count++;
-            if (count % 1000 == 0) {
-                std::cout << "Inserted " << count << " records into the B+ tree." << std::endl;
+    // Leaf level: leaf l takes the groups from firstGroup[l], so every leaf is filled on its own, and the
+    // leaves are then stitched into one chain. Each level entry is (node, smallest key in its subtree)
+    std::vector<size_t> groupBytes;
+    groupBytes.reserve(groups.size());
+    for (const Group& group : groups) groupBytes.push_back(leafEntryBytes(group.postings));
+    std::vector<size_t> sizes = leafSizes(groupBytes);
+    std::vector<size_t> firstGroup = {0};
+    for (size_t size : sizes) firstGroup.push_back(firstGroup.back() + size);
+    std::vector<std::shared_ptr<LeafNode>> leaves(sizes.size());
+    pool.parallelFor("build.leaves", 0, leaves.size(), 16, [&](size_t from, size_t to) {
+        for (size_t l = from; l < to; ++l) {
+            auto leaf = std::make_shared<LeafNode>();
+            for (size_t i = 0; i < sizes[l]; ++i) {
+                Group& group = groups[firstGroup[l] + i];
+                leaf->keys[i] = group.key;
+                leaf->postings[i] = std::move(group.postings);
+                leaf->sums[i] = group.sum;
+                leaf->payloadRows.insert(leaf->payloadRows.end(), group.payloadRows.begin(), group.payloadRows.end());
+                group.payloadRows = {};
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Error inserting record: " << e.what() << std::endl;
-            std::cerr << "Record details: fgPctHome=" << record.fgPctHome 
-                      << ", recordId=" << record.recordId << std::endl;
+            leaf->keyCount = static_cast<uint16_t>(sizes[l]);
+            leaves[l] = std::move(leaf);
         }
+    });
+    std::vector<std::pair<std::shared_ptr<Node>, StoredKey>> level;
+    for (size_t l = 0; l < leaves.size(); ++l) {
+        if (l > 0) {
+            leaves[l - 1]->nextLeaf = leaves[l];
+            leaves[l]->prevLeaf = leaves[l - 1];
+        }
+        level.emplace_back(leaves[l], leaves[l]->keys[0]);
     }
 
-    std::cout << "Finished building B+ tree. Total records inserted: " << count << std::endl;
-    std::cout << "Saving B+ tree to file..." << std::endl;
+    // Internal levels, bottom-up until a single root remains; the nodes of a level are built in parallel, each
+    // taking its children's subtree totals as it links them, since every child is complete by then
+    while (level.size() > 1) {
+        std::vector<size_t> sizes = evenNodeSizes(level.size(), Order);
+        std::vector<size_t> firstChild = {0};
+        for (size_t size : sizes) firstChild.push_back(firstChild.back() + size);
+        std::vector<std::pair<std::shared_ptr<Node>, StoredKey>> parents(sizes.size());
+        pool.parallelFor("build.internal", 0, sizes.size(), 8, [&](size_t from, size_t to) {
+            for (size_t p = from; p < to; ++p) {
+                auto internal = std::make_shared<InternalNode>();
+                for (size_t i = 0; i < sizes[p]; ++i) {
+                    const auto& [child, childKey] = level[firstChild[p] + i];
+                    internal->children[i] = child;
+                    child->parent = internal;
+                    if (i > 0) internal->keys[i - 1] = childKey;
+                    std::tie(internal->childCounts[i], internal->childSums[i]) = nodeTotals(*child);
+                }
+                internal->keyCount = static_cast<uint16_t>(sizes[p] - 1);
+                parents[p] = {internal, level[firstChild[p]].second};
+            }
+        });
+        level = std::move(parents);
+    }
 
-    saveToFile();
-    std::cout << "B+ tree saved to file." << std::endl;
+    root = level.front().first;
     tree_height = getHeight(root);
     _getTotalNodes();
 }
 
-void BPlusTree::insert(float key, uint32_t recordId) {
-    if (!root) {
-        root = std::make_shared<BPlusTreeNode>(true);
-
-
-        root->keys.push_back(key);
-
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::insert(Key rawKey, Value value, double measureValue, const std::vector<uint8_t>& payloadRow) {
+    if (payloadRow.size() != payloadRowBytes) {
+        throw std::runtime_error("Inserted payload does not match the covered columns of " + indexFilename);
+    }
 
-        root->recordIds.push_back(recordId);
+    StoredKey key = Codec::encode(rawKey);
+    if (!root) {
+        auto leaf = std::make_shared<LeafNode>();
+        leaf->keys[0] = key;
+        leaf->postings[0].insert(value);
+        leaf->sums[0] = measureValue;
+        leaf->payloadRows = payloadRow;
+        leaf->keyCount = 1;
+        root = leaf;
+        tree_height = 1;
+        statsStale = true;
         return;
     }
 
-    int temp;
+    int temp = 0;
     auto leaf = findLeaf(key, temp);
 
     if (!leaf) {
         throw std::runtime_error("findLeaf returned nullptr");
     }
 
-    if (leaf->keys.size() < order - 1) {
-        insertIntoLeaf(leaf, key, recordId);
-    } else {
-        splitLeafNode(leaf, key, recordId);
+    insertIntoLeaf(*leaf, key, value, measureValue, payloadRow);
+
+    // Every ancestor's subtree totals on the path down grow by the new entry; splits below only redistribute them
+    for (auto node = leaf->parent.lock(); node; node = node->parent.lock()) {
+        auto internal = std::static_pointer_cast<InternalNode>(node);
+        int index = nodeUpperBound(internal->keys.data(), internal->keyCount, key);
+        internal->childCounts[index]++;
+        internal->childSums[index] += measureValue;
     }
-}
 
-void BPlusTree::insertIntoLeaf(std::shared_ptr<BPlusTreeNode> leaf, float key, uint32_t recordId) {
-    auto it = std::lower_bound(leaf->keys.begin(), leaf->keys.end(), key);
-    int index = std::distance(leaf->keys.begin(), it);
-    
-    leaf->keys.insert(leaf->keys.begin() + index, key);
-    leaf->recordIds.insert(leaf->recordIds.begin() + index, recordId);
+    if (leaf->keyCount == Order || (leaf->keyCount > 1 && leafBytes(*leaf) > INDEX_PAGE_SIZE)) {
+        splitLeafNode(leaf);
+    }
+    statsStale = true;
 }
 
-void BPlusTree::splitLeafNode(std::shared_ptr<BPlusTreeNode> leaf, float newKey, uint32_t recordId) {
-    auto newLeaf = std::make_shared<BPlusTreeNode>(true);
-    
-    std::vector<float> tempKeys = leaf->keys;
-    std::vector<uint32_t> tempRecordIds = leaf->recordIds;
-
-    tempKeys.push_back(newKey);
-    tempRecordIds.push_back(recordId);
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::insertBatch(std::vector<Entry> entries) {
+    if (!root) {
+        bulkLoad(std::move(entries));
+        return;
+    }
 
-    //                     key   recordId
-    std::vector<std::pair<float, uint32_t>> pairs;
+    std::vector<std::tuple<StoredKey, Value, size_t>> encoded;
+    encoded.reserve(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].payload.size() != payloadRowBytes) {
+            throw std::runtime_error("Inserted payload does not match the covered columns of " + indexFilename);
+        }
+        encoded.emplace_back(Codec::encode(entries[i].key), entries[i].value, i);
+    }
+    std::sort(encoded.begin(), encoded.end());
+
+    // A node touched by the batch and the (separator, new right sibling) pairs it split off, left to right
+    struct Touched {
+        std::shared_ptr<Node> node;
+        std::vector<std::pair<StoredKey, std::shared_ptr<Node>>> siblings;
+    };
+    std::vector<Touched> touched;
+
+    // Leaf level: one descent per leaf that receives keys, which takes every key below its upper fence at once
+    size_t next = 0;
+    while (next < encoded.size()) {
+        StoredKey first = std::get<0>(encoded[next]);
+        StoredKey fence{};
+        bool fenced = false;
+        auto current = root;
+        while (!current->isLeaf) {
+            auto internal = std::static_pointer_cast<InternalNode>(current);
+            int index = nodeUpperBound(internal->keys.data(), internal->keyCount, first);
+            // The separator right of the child taken bounds the keys below it; deeper ones are tighter
+            if (index < internal->keyCount) {
+                fence = internal->keys[index];
+                fenced = true;
+            }
+            current = internal->children[index];
+        }
+        auto leaf = std::static_pointer_cast<LeafNode>(current);
+        size_t runEnd = next;
+        while (runEnd < encoded.size() && (!fenced || std::get<0>(encoded[runEnd]) < fence)) ++runEnd;
+
+        // Merge the run into the leaf's keys; a key already present only grows its posting list
+        std::vector<StoredKey> keys;
+        std::vector<PostingList<Value>> postings;
+        std::vector<double> sums;
+        std::vector<std::vector<uint8_t>> payloads;
+        int existing = 0;
+        auto existingRows = leaf->payloadRows.begin();
+        auto keepExisting = [&]() {
+            auto rowsEnd = existingRows + leaf->postings[existing].size() * payloadRowBytes;
+            keys.push_back(leaf->keys[existing]);
+            postings.push_back(std::move(leaf->postings[existing]));
+            sums.push_back(leaf->sums[existing]);
+            payloads.emplace_back(existingRows, rowsEnd);
+            existingRows = rowsEnd;
+            ++existing;
+        };
+        for (size_t i = next; i < runEnd; ++i) {
+            const auto& [key, value, entryIndex] = encoded[i];
+            while (existing < leaf->keyCount && leaf->keys[existing] < key) keepExisting();
+            if (existing < leaf->keyCount && leaf->keys[existing] == key) {
+                keepExisting();
+            } else if (keys.empty() || keys.back() != key) {
+                keys.push_back(key);
+                postings.emplace_back();
+                sums.push_back(0.0);
+                payloads.emplace_back();
+            }
+            const Entry& entry = entries[entryIndex];
+            uint32_t position = postings.back().insert(value);
+            sums.back() += entry.measure;
+            payloads.back().insert(payloads.back().begin() + position * payloadRowBytes, entry.payload.begin(), entry.payload.end());
+        }
+        while (existing < leaf->keyCount) keepExisting();
+
+        // An overfull leaf splits once, into as many evenly filled leaves as the merged keys and their bytes need
+        std::vector<size_t> entryBytes;
+        entryBytes.reserve(keys.size());
+        for (const auto& posting : postings) entryBytes.push_back(leafEntryBytes(posting));
+        auto sizes = leafSizes(entryBytes);
+        Touched entry{leaf, {}};
+        auto piece = leaf;
+        size_t k = 0;
+        for (size_t p = 0; p < sizes.size(); ++p) {
+            if (p > 0) {
+                auto newLeaf = std::make_shared<LeafNode>();
+                newLeaf->nextLeaf = piece->nextLeaf;
+                newLeaf->prevLeaf = piece;
+                if (newLeaf->nextLeaf) newLeaf->nextLeaf->prevLeaf = newLeaf;
+                piece->nextLeaf = newLeaf;
+                piece = newLeaf;
+                entry.siblings.emplace_back(keys[k], newLeaf);
+            }
+            piece->payloadRows.clear();
+            for (size_t i = 0; i < sizes[p]; ++i, ++k) {
+                piece->keys[i] = keys[k];
+                piece->postings[i] = std::move(postings[k]);
+                piece->sums[i] = sums[k];
+                piece->payloadRows.insert(piece->payloadRows.end(), payloads[k].begin(), payloads[k].end());
+            }
+            piece->keyCount = static_cast<uint16_t>(sizes[p]);
+        }
+        touched.push_back(std::move(entry));
+        next = runEnd;
+    }
 
+    // Internal levels, bottom-up: each parent takes all of its children's new siblings in one pass, splits at most
+    // once and refreshes its subtree totals; a root that splits gets a new root above it
+    while (!touched.empty()) {
+        std::vector<Touched> above;
+        for (size_t i = 0; i < touched.size();) {
+            auto parent = std::static_pointer_cast<InternalNode>(touched[i].node->parent.lock());
+            if (!parent) {
+                if (touched[i].siblings.empty()) {
+                    ++i;
+                    continue;
+                }
+                parent = std::make_shared<InternalNode>();
+                parent->children[0] = root;
+                root->parent = parent;
+                root = parent;
+            }
+            size_t groupEnd = i;
+            while (groupEnd < touched.size() && touched[groupEnd].node->parent.lock() == parent) ++groupEnd;
+
+            std::vector<StoredKey> keys;
+            std::vector<std::shared_ptr<Node>> children;
+            size_t t = i;
+            for (int c = 0; c <= parent->keyCount; ++c) {
+                if (c > 0) keys.push_back(parent->keys[c - 1]);
+                children.push_back(parent->children[c]);
+                if (t < groupEnd && touched[t].node == parent->children[c]) {
+                    for (auto& [separator, sibling] : touched[t].siblings) {
+                        keys.push_back(separator);
+                        children.push_back(sibling);
+                    }
+                    ++t;
+                }
+            }
 
-    for (size_t i = 0; i < tempKeys.size(); ++i) {
-        pairs.emplace_back(tempKeys[i], tempRecordIds[i]);
+            auto sizes = children.size() <= Order ? std::vector<size_t>{children.size()} : evenNodeSizes(children.size(), Order);
+            Touched entry{parent, {}};
+            auto piece = parent;
+            size_t c = 0;
+            for (size_t p = 0; p < sizes.size(); ++p) {
+                if (p > 0) {
+                    piece = std::make_shared<InternalNode>();
+                    entry.siblings.emplace_back(keys[c - 1], piece);
+                }
+                for (size_t j = 0; j < sizes[p]; ++j, ++c) {
+                    if (j > 0) piece->keys[j - 1] = keys[c - 1];
+                    piece->children[j] = children[c];
+                    children[c]->parent = piece;
+                    std::tie(piece->childCounts[j], piece->childSums[j]) = nodeTotals(*children[c]);
+                }
+                for (size_t j = sizes[p]; j <= Order; ++j) piece->children[j].reset();
+                piece->keyCount = static_cast<uint16_t>(sizes[p] - 1);
+            }
+            above.push_back(std::move(entry));
+            i = groupEnd;
+        }
+        touched = std::move(above);
     }
 
-    std::sort(pairs.begin(), pairs.end(), compareRecordPairs);
-
-    int mid = (order + 1) / 2;
-    leaf->keys.clear();
-    leaf->recordIds.clear();
-    newLeaf->keys.clear();
-    newLeaf->recordIds.clear();
+    tree_height = getHeight(root);
+    statsStale = true;
+}
 
-    for (int i = 0; i < mid; ++i) {
-        leaf->keys.push_back(pairs[i].first);
-        leaf->recordIds.push_back(pairs[i].second);
-    }
-    for (size_t i = mid; i < pairs.size(); ++i) {
-        newLeaf->keys.push_back(pairs[i].first);
-        newLeaf->recordIds.push_back(pairs[i].second);
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::insertRecords(const std::vector<Record>& records) {
+    std::vector<Entry> entries;
+    entries.reserve(records.size());
+    for (const auto& record : records) {
+        entries.push_back({keyOf(record), record.recordId, measureOf(record), payloadOf(record)});
     }
+    insertBatch(std::move(entries));
+}
 
-    newLeaf->nextLeaf = leaf->nextLeaf;
-    leaf->nextLeaf = newLeaf;
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::insertIntoLeaf(LeafNode& leaf, StoredKey key, Value value, double measureValue,
+                                                  const std::vector<uint8_t>& payloadRow) {
+    int index = nodeLowerBound(leaf.keys.data(), leaf.keyCount, key);
+    auto rows = leaf.payloadRows.begin() + payloadOffset(leaf, index);
+
+    // A key already in the leaf only grows its posting list, with the payload row at the same position
+    if (index < leaf.keyCount && leaf.keys[index] == key) {
+        uint32_t position = leaf.postings[index].insert(value);
+        leaf.sums[index] += measureValue;
+        leaf.payloadRows.insert(rows + position * payloadRowBytes, payloadRow.begin(), payloadRow.end());
+        return;
+    }
 
-    float promotedKey = newLeaf->keys.front();
-    insertIntoParent(leaf, promotedKey, newLeaf);
+    leaf.payloadRows.insert(rows, payloadRow.begin(), payloadRow.end());
+
+    std::copy_backward(leaf.keys.begin() + index, leaf.keys.begin() + leaf.keyCount,
+                       leaf.keys.begin() + leaf.keyCount + 1);
+    std::move_backward(leaf.postings.begin() + index, leaf.postings.begin() + leaf.keyCount,
+                       leaf.postings.begin() + leaf.keyCount + 1);
+    std::copy_backward(leaf.sums.begin() + index, leaf.sums.begin() + leaf.keyCount,
+                       leaf.sums.begin() + leaf.keyCount + 1);
+    leaf.keys[index] = key;
+    leaf.postings[index] = PostingList<Value>();
+    leaf.postings[index].insert(value);
+    leaf.sums[index] = measureValue;
+    leaf.keyCount++;
 }
 
-void BPlusTree::insertIntoParent(std::shared_ptr<BPlusTreeNode> leftChild, float key, std::shared_ptr<BPlusTreeNode> rightChild) {
-    try{
-        if (leftChild == root) {
-        auto newRoot = std::make_shared<BPlusTreeNode>(false);
-
-        newRoot->keys.push_back(key);
-        newRoot->children.push_back(leftChild);
-        newRoot->children.push_back(rightChild);
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::splitLeafNode(std::shared_ptr<LeafNode> leaf) {
+    // Usually two halves; a leaf over its page by more than one key's worth of bytes may need more pieces
+    std::vector<size_t> entryBytes;
+    for (int i = 0; i < leaf->keyCount; ++i) entryBytes.push_back(leafEntryBytes(leaf->postings[i]));
+    std::vector<size_t> sizes = leafSizes(entryBytes);
+
+    int start = static_cast<int>(sizes[0]);
+    size_t keptRows = payloadOffset(*leaf, start);
+    size_t rowsStart = keptRows;
+    auto piece = leaf;
+    for (size_t p = 1; p < sizes.size(); ++p) {
+        auto newLeaf = std::make_shared<LeafNode>();
+        int end = start + static_cast<int>(sizes[p]);
+
+        size_t rowsEnd = rowsStart;
+        for (int i = start; i < end; ++i) rowsEnd += leaf->postings[i].size() * payloadRowBytes;
+        newLeaf->payloadRows.assign(leaf->payloadRows.begin() + rowsStart, leaf->payloadRows.begin() + rowsEnd);
+        rowsStart = rowsEnd;
+        std::copy(leaf->keys.begin() + start, leaf->keys.begin() + end, newLeaf->keys.begin());
+        std::move(leaf->postings.begin() + start, leaf->postings.begin() + end, newLeaf->postings.begin());
+        std::copy(leaf->sums.begin() + start, leaf->sums.begin() + end, newLeaf->sums.begin());
+        newLeaf->keyCount = static_cast<uint16_t>(sizes[p]);
+
+        newLeaf->nextLeaf = piece->nextLeaf;
+        newLeaf->prevLeaf = piece;
+        if (newLeaf->nextLeaf) newLeaf->nextLeaf->prevLeaf = newLeaf;
+        piece->nextLeaf = newLeaf;
+        piece = newLeaf;
+        start = end;
+    }
+    leaf->payloadRows.resize(keptRows);
+    leaf->keyCount = static_cast<uint16_t>(sizes[0]);
 
+    // Each new leaf goes in right after the one it was cut from, so the separators arrive in key order
+    for (auto left = leaf; left->nextLeaf != piece->nextLeaf; left = left->nextLeaf) {
+        insertIntoParent(left, left->nextLeaf->keys[0], left->nextLeaf);
+    }
+}
 
-        root = newRoot;
+template <typename Key, typename Value, int Order>
+size_t BPlusTree<Key, Value, Order>::leafEntryBytes(const PostingList<Value>& posting) const {
+    return sizeof(StoredKey) + 2 * sizeof(uint32_t) + posting.bytes().size() + sizeof(double)
+           + posting.size() * payloadRowBytes;
+}
 
-        leftChild->parent = newRoot;
-        // TODO: Debug
+template <typename Key, typename Value, int Order>
+size_t BPlusTree<Key, Value, Order>::payloadOffset(const LeafNode& leaf, int index) const {
+    size_t rows = 0;
+    for (int i = 0; i < index; ++i) rows += leaf.postings[i].size();
+    return rows * payloadRowBytes;
+}
 
-        // std::cout << "DEBUG: in 'insertIntoParrent', leftChild's parrent address: " << rightChild->parent.lock() << std::endl;
-        
-        //TODO: Debugging
-        // std::cout << "DEBUG: Left child's parrent address " << leftChild->parent.lock() << std::endl;
-        
+template <typename Key, typename Value, int Order>
+size_t BPlusTree<Key, Value, Order>::leafBytes(const LeafNode& leaf) const {
+    size_t bytes = nodeHeaderSize;
+    for (int i = 0; i < leaf.keyCount; ++i) bytes += leafEntryBytes(leaf.postings[i]);
+    return bytes;
+}
 
-        rightChild->parent = newRoot;
+// Leaf sizes for a run of entries of the given encoded sizes: evenly filled up to Order - 1 keys, and any leaf
+// that would then overflow its page cut again into as many pieces of about equal bytes as it takes to fit.
+// An entry larger than a page alone keeps a leaf of its own and spills the rest into overflow pages
+template <typename Key, typename Value, int Order>
+std::vector<size_t> BPlusTree<Key, Value, Order>::leafSizes(const std::vector<size_t>& entryBytes) const {
+    constexpr size_t pageBody = INDEX_PAGE_SIZE - nodeHeaderSize;
+    std::vector<size_t> sizes;
+    size_t first = 0;
+    for (size_t chunk : evenNodeSizes(entryBytes.size(), Order - 1)) {
+        size_t chunkBytes = 0;
+        for (size_t i = first; i < first + chunk; ++i) chunkBytes += entryBytes[i];
+        size_t pieces = (chunkBytes + pageBody - 1) / pageBody;
+
+        // Piece p ends at the entry boundary nearest p + 1 pieces' share of the chunk, and never past a page
+        size_t keys = 0, bytes = 0, before = 0, piece = 0;
+        for (size_t i = first; i < first + chunk; ++i) {
+            size_t boundary = chunkBytes * (piece + 1) / pieces;
+            if (keys > 0 && (bytes + entryBytes[i] > pageBody || before + bytes + entryBytes[i] / 2 > boundary)) {
+                sizes.push_back(keys);
+                before += bytes;
+                piece++;
+                keys = 0;
+                bytes = 0;
+            }
+            keys++;
+            bytes += entryBytes[i];
+        }
+        sizes.push_back(keys);
+        first += chunk;
+    }
+    return sizes;
+}
 
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::insertIntoParent(std::shared_ptr<Node> leftChild, StoredKey key, std::shared_ptr<Node> rightChild) {
+    try {
+        if (leftChild == root) {
+            auto newRoot = std::make_shared<InternalNode>();
 
-        // TODO:Debug
-        //std::cout << "DEBUG: Right child's parrent address " << leftChild->parent.lock() << std::endl;
-        return;
-        }
+            newRoot->keys[0] = key;
+            newRoot->children[0] = leftChild;
+            newRoot->children[1] = rightChild;
+            newRoot->keyCount = 1;
+            std::tie(newRoot->childCounts[0], newRoot->childSums[0]) = nodeTotals(*leftChild);
+            std::tie(newRoot->childCounts[1], newRoot->childSums[1]) = nodeTotals(*rightChild);
 
-        auto parent = leftChild->parent.lock();
+            root = newRoot;
+            tree_height++;
 
+            leftChild->parent = newRoot;
+            rightChild->parent = newRoot;
+            return;
+        }
 
+        auto parent = std::static_pointer_cast<InternalNode>(leftChild->parent.lock());
 
         if (!parent) {
             throw std::runtime_error("Parent node is null");
         }
 
-        auto it = std::find(parent->children.begin(), parent->children.end(), leftChild);
-        if (it == parent->children.end()) {
+        auto childrenEnd = parent->children.begin() + parent->keyCount + 1;
+        auto it = std::find(parent->children.begin(), childrenEnd, leftChild);
+        if (it == childrenEnd) {
             throw std::runtime_error("Left child not found in parent's children");
         }
         int index = std::distance(parent->children.begin(), it);
 
-        if (parent->keys.size() < order - 1) {
-            parent->keys.insert(parent->keys.begin() + index, key);
-            parent->children.insert(parent->children.begin() + index + 1, rightChild);
-            rightChild->parent = parent;
-
-            // TODO: Debug
-
-            // std::cout << "DEBUG: in 'insertIntoParrent', rightChild's parrent address: " << rightChild->parent.lock() << std::endl;
-
-        } else {
-            splitNonLeafNode(parent, index, key, rightChild);
+        // Shift keys after index and children after index + 1 one slot to the right
+        std::copy_backward(parent->keys.begin() + index, parent->keys.begin() + parent->keyCount,
+                           parent->keys.begin() + parent->keyCount + 1);
+        std::move_backward(parent->children.begin() + index + 1, parent->children.begin() + parent->keyCount + 1,
+                           parent->children.begin() + parent->keyCount + 2);
+        std::copy_backward(parent->childCounts.begin() + index + 1, parent->childCounts.begin() + parent->keyCount + 1,
+                           parent->childCounts.begin() + parent->keyCount + 2);
+        std::copy_backward(parent->childSums.begin() + index + 1, parent->childSums.begin() + parent->keyCount + 1,
+                           parent->childSums.begin() + parent->keyCount + 2);
+        parent->keys[index] = key;
+        parent->children[index + 1] = rightChild;
+        parent->keyCount++;
+
+        // The split divided one child's totals between the two halves
+        std::tie(parent->childCounts[index], parent->childSums[index]) = nodeTotals(*leftChild);
+        std::tie(parent->childCounts[index + 1], parent->childSums[index + 1]) = nodeTotals(*rightChild);
+        rightChild->parent = parent;
+
+        if (parent->keyCount == Order) {
+            splitNonLeafNode(parent);
         }
-    } catch (const std::exception& e){
+    } catch (const std::exception& e) {
         std::cerr << "Error in insertIntoParent: " << e.what() << std::endl;
         throw;
     }
 }
 
-void BPlusTree::splitNonLeafNode(std::shared_ptr<BPlusTreeNode> node, int index, float key, std::shared_ptr<BPlusTreeNode> rightChild) {
-    auto newNode = std::make_shared<BPlusTreeNode>(false);
-    std::vector<float> tempKeys = node->keys;
-    std::vector<std::shared_ptr<BPlusTreeNode>> tempChildren = node->children;
-
-    tempKeys.insert(tempKeys.begin() + index, key);
-    tempChildren.insert(tempChildren.begin() + index + 1, rightChild);
-
-    int mid = order / 2;
-    float promotedKey = tempKeys[mid];
-
-    node->keys.assign(tempKeys.begin(), tempKeys.begin() + mid);
-    node->children.assign(tempChildren.begin(), tempChildren.begin() + mid + 1);
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::splitNonLeafNode(std::shared_ptr<InternalNode> node) {
+    auto newNode = std::make_shared<InternalNode>();
 
-    newNode->keys.assign(tempKeys.begin() + mid + 1, tempKeys.end());
-    newNode->children.assign(tempChildren.begin() + mid + 1, tempChildren.end());
+    int mid = Order / 2;
+    StoredKey promotedKey = node->keys[mid];
 
-    for (auto& child : newNode->children) {
-        child->parent = newNode;
+    std::copy(node->keys.begin() + mid + 1, node->keys.begin() + node->keyCount, newNode->keys.begin());
+    std::move(node->children.begin() + mid + 1, node->children.begin() + node->keyCount + 1, newNode->children.begin());
+    std::copy(node->childCounts.begin() + mid + 1, node->childCounts.begin() + node->keyCount + 1, newNode->childCounts.begin());
+    std::copy(node->childSums.begin() + mid + 1, node->childSums.begin() + node->keyCount + 1, newNode->childSums.begin());
+    newNode->keyCount = node->keyCount - mid - 1;
+    node->keyCount = mid;
 
-        // TODO: Debug
-
-        // std::cout << "DEBUG: in 'splitNonLeafNode', child's parent address " << child->parent.lock() << std::endl;
+    for (int i = 0; i <= newNode->keyCount; ++i) {
+        newNode->children[i]->parent = newNode;
     }
 
     insertIntoParent(node, promotedKey, newNode);
 }
 
-std::shared_ptr<BPlusTreeNode> BPlusTree::findLeaf(float key, int& indexNodeCounter) {
+template <typename Key, typename Value, int Order>
+std::shared_ptr<typename BPlusTree<Key, Value, Order>::LeafNode>
+BPlusTree<Key, Value, Order>::findLeaf(StoredKey key, int& indexNodeCounter) {
     auto current = root;
     while (current && !current->isLeaf) {
-        auto it = std::lower_bound(current->keys.begin(), current->keys.end(), key);
-        int index = std::distance(current->keys.begin(), it);
-        current = current->children[index];
+        auto internal = std::static_pointer_cast<InternalNode>(current);
+        // Separators are the first key of the right subtree, so equal keys descend right
+        int index = nodeUpperBound(internal->keys.data(), internal->keyCount, key);
+        current = internal->children[index];
         indexNodeCounter++;
     }
-    return current;
+    return std::static_pointer_cast<LeafNode>(current);
 }
 
-SearchResult BPlusTree::rangeSearch(float lower, float upper, Storage& storage) {
-    SearchResult result = {0, 0, 0.0f, 0};
+template <typename Key, typename Value, int Order>
+SearchResult BPlusTree<Key, Value, Order>::rangeSearch(Key rawLower, Key rawUpper, Storage& storage) {
+    SearchResult result = {0, 0, 0.0f, 0, {}};
     if (!root) return result;
 
-    auto leaf = findLeaf(lower, result.indexNodesAccessed);
-    std::unordered_map<uint32_t, std::vector<uint16_t>> datablockRecordIds;
+    StoredKey lower = Codec::encode(rawLower);
+    StoredKey upper = Codec::encode(rawUpper);
 
-    // START OLD VERSION
+    auto leaf = findLeaf(lower, result.indexNodesAccessed);
+    std::vector<uint16_t> recordIds;
+
+    // A second pointer runs prefetchDistance leaves ahead along the chain, requesting each leaf it reaches so
+    // the scan finds it cached; within a leaf, posting bytes are requested prefetchDistance keys ahead
+    auto prefetchLeaf = [](const LeafNode* node) {
+        PREFETCH(node);
+        PREFETCH(&node->postings[0]);
+        PREFETCH(&node->nextLeaf);
+    };
+    const LeafNode* ahead = leaf.get();
+    for (int i = 0; i < prefetchDistance && ahead; ++i) {
+        ahead = ahead->nextLeaf.get();
+        if (ahead) prefetchLeaf(ahead);
+    }
 
+    while (leaf && !(upper < leaf->keys[0])) {
+        for (int i = 0; i < leaf->keyCount; ++i) {
 
-    while (leaf && leaf->keys.front() <= upper) {        
-        for (size_t i = 0; i < leaf->keys.size(); ++i) {
-            
-            if (leaf->keys[i] > upper) break;
-            if (leaf->keys[i] >= lower) {
-                uint16_t recordId = leaf->recordIds[i];
-                uint16_t datablockId = storage.getRecordLocations().at(recordId).first;
-                datablockRecordIds[datablockId].push_back(recordId);
-                result.numberOfResults++;
+            if (upper < leaf->keys[i]) break;
+            if (prefetchDistance > 0 && i + prefetchDistance < leaf->keyCount) {
+                PREFETCH(leaf->postings[i + prefetchDistance].bytes().data());
+            }
+            if (!(leaf->keys[i] < lower)) {
+                leaf->postings[i].forEach([&](Value value) {
+                    recordIds.push_back(static_cast<uint16_t>(value));
+                });
+                result.numberOfResults += leaf->postings[i].size();
             }
         }
         leaf = leaf->nextLeaf;
+        if (ahead) {
+            ahead = ahead->nextLeaf.get();
+            if (ahead) prefetchLeaf(ahead);
+        }
     }
 
-    std::vector<Record> resulting_records;
-    for (const auto& pair : datablockRecordIds) {
-        result.dataBlocksAccessed++;
-        auto records = storage.bulkRead(pair.second);
-        resulting_records.insert(resulting_records.end(), records.begin(), records.end());
+    // Key order is random with respect to the heap, so fetch in block and slot order instead:
+    // each block is read once, front to back, and blocks are visited in ascending page order
+    result.found_records = storage.bulkReadInBlockOrder(recordIds, result.dataBlocksAccessed);
+
+    return result;
+}
+
+template <typename Key, typename Value, int Order>
+SearchResult BPlusTree<Key, Value, Order>::rangeSearchParallel(Key rawLower, Key rawUpper, Storage& storage, bool keyOrder) {
+    SearchResult result = {0, 0, 0.0f, 0, {}};
+    if (!root) return result;
+
+    StoredKey lower = Codec::encode(rawLower);
+    StoredKey upper = Codec::encode(rawUpper);
+    if (upper < lower) return result;
+
+    // One thread gains nothing from sub-ranges: the serial search, or one sub-range when key order is wanted
+    ThreadPool& pool = ThreadPool::shared();
+    if (pool.threadCount() == 1 && !keyOrder) return rangeSearch(rawLower, rawUpper, storage);
+
+    // Split the range level by level: each inner node on the frontier gives way to its children that meet the
+    // range, weighted by their entry counts, until there are enough pieces; leaves give way to their keys
+    struct Piece {
+        std::shared_ptr<Node> node;   // null once the piece is a single leaf key
+        StoredKey start;
+        uint32_t weight;
+    };
+    const size_t wanted = pool.threadCount() == 1 ? 1 : pool.threadCount() * 4;
+    std::vector<Piece> frontier = {{root, lower, 0}};
+    while (frontier.size() < wanted && frontier.front().node) {
+        std::vector<Piece> next;
+        for (const Piece& piece : frontier) {
+            auto clamp = [&](const StoredKey& key) { return key < lower ? lower : key; };
+            if (!piece.node->isLeaf) {
+                auto internal = std::static_pointer_cast<InternalNode>(piece.node);
+                result.indexNodesAccessed++;
+                int first = nodeUpperBound(internal->keys.data(), internal->keyCount, lower);
+                int last = nodeUpperBound(internal->keys.data(), internal->keyCount, upper);
+                for (int i = first; i <= last; ++i) {
+                    next.push_back({internal->children[i], clamp(i == 0 ? piece.start : internal->keys[i - 1]),
+                                    internal->childCounts[i]});
+                }
+            } else {
+                auto leaf = std::static_pointer_cast<LeafNode>(piece.node);
+                int first = nodeLowerBound(leaf->keys.data(), leaf->keyCount, lower);
+                int last = nodeUpperBound(leaf->keys.data(), leaf->keyCount, upper);
+                for (int i = first; i < last; ++i) {
+                    next.push_back({nullptr, clamp(leaf->keys[i]), static_cast<uint32_t>(leaf->postings[i].size())});
+                }
+            }
+        }
+        if (next.empty()) return result;
+        frontier = std::move(next);
     }
 
-    result.found_records = resulting_records;
+    // Consecutive pieces grouped into sub-ranges of about equal weight; sub-range p is [starts[p], starts[p + 1])
+    // and the last one runs to upper inclusive
+    uint64_t totalWeight = 0;
+    for (const Piece& piece : frontier) totalWeight += piece.weight;
+    std::vector<StoredKey> starts = {lower};
+    uint64_t running = 0;
+    for (size_t i = 0; i + 1 < frontier.size(); ++i) {
+        running += frontier[i].weight;
+        if (running * wanted >= totalWeight * starts.size()) starts.push_back(frontier[i + 1].start);
+    }
 
-    // END OLD VERSION
+    struct SubRange {
+        int indexNodesAccessed = 0;
+        int dataBlocksAccessed = 0;
+        int firstBlock = -1;   // the blocks its fetch started and ended on
+        int lastBlock = -1;
+        std::vector<Record> records;
+    };
+    std::vector<SubRange> subRanges(starts.size());
+    pool.parallelFor("range.subrange", 0, starts.size(), 1, [&](size_t from, size_t to) {
+        for (size_t p = from; p < to; ++p) {
+            SubRange& subRange = subRanges[p];
+            bool lastRange = p + 1 == starts.size();
+            auto beyond = [&](const StoredKey& key) { return lastRange ? upper < key : !(key < starts[p + 1]); };
+
+            std::vector<uint16_t> recordIds;
+            for (auto leaf = findLeaf(starts[p], subRange.indexNodesAccessed); leaf; leaf = leaf->nextLeaf) {
+                int i = nodeLowerBound(leaf->keys.data(), leaf->keyCount, starts[p]);
+                for (; i < leaf->keyCount && !beyond(leaf->keys[i]); ++i) {
+                    leaf->postings[i].forEach([&](Value value) { recordIds.push_back(static_cast<uint16_t>(value)); });
+                }
+                if (i < leaf->keyCount) break;
+            }
+            subRange.records = storage.bulkReadInBlockOrder(recordIds, subRange.dataBlocksAccessed, subRange.lastBlock);
+            if (!subRange.records.empty()) {
+                subRange.firstBlock = storage.getRecordLocation(subRange.records.front().recordId).first;
+            }
 
+            if (keyOrder) {
+                // Ids were collected in key order; records arrive in block order, so put each back at its rank
+                std::vector<std::pair<uint16_t, uint32_t>> ranks;
+                ranks.reserve(recordIds.size());
+                for (size_t rank = 0; rank < recordIds.size(); ++rank) {
+                    ranks.emplace_back(recordIds[rank], static_cast<uint32_t>(rank));
+                }
+                std::sort(ranks.begin(), ranks.end());
+                std::sort(subRange.records.begin(), subRange.records.end(),
+                          [](const Record& a, const Record& b) { return a.recordId < b.recordId; });
+                std::vector<Record> ordered(subRange.records.size());
+                for (size_t i = 0; i < ranks.size(); ++i) {
+                    ordered[ranks[i].second] = subRange.records[i];
+                }
+                subRange.records = std::move(ordered);
+            }
+        }
+    });
+
+    // A block a sub-range starts on where the one before it ended counts once, as in the serial search
+    int heldBlock = -1;
+    for (auto& subRange : subRanges) {
+        result.indexNodesAccessed += subRange.indexNodesAccessed;
+        result.dataBlocksAccessed += subRange.dataBlocksAccessed - (subRange.firstBlock != -1 && subRange.firstBlock == heldBlock);
+        if (subRange.lastBlock != -1) heldBlock = subRange.lastBlock;
+        result.found_records.insert(result.found_records.end(), subRange.records.begin(), subRange.records.end());
+    }
+    result.numberOfResults = static_cast<int>(result.found_records.size());
+    return result;
+}
+
+template <typename Key, typename Value, int Order>
+BatchSearchResult BPlusTree<Key, Value, Order>::rangeSearchBatch(const std::vector<std::pair<Key, Key>>& ranges, Storage& storage) {
+    BatchSearchResult batch = {{}, {}, std::vector<BatchProbeResult>(ranges.size(), BatchProbeResult{0, 0, 0, 0}), 0, 0, 0};
+    if (!root) return batch;
+
+    struct Probe {
+        StoredKey lower;
+        StoredKey upper;
+        size_t index;
+    };
+    std::vector<Probe> probes;
+    probes.reserve(ranges.size());
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        Probe probe{Codec::encode(ranges[i].first), Codec::encode(ranges[i].second), i};
+        if (!(probe.upper < probe.lower)) probes.push_back(probe);
+    }
+    std::sort(probes.begin(), probes.end(), [](const Probe& a, const Probe& b) { return a.lower < b.lower; });
+
+    // The internal nodes of the last descent, root first, each with the separator its subtree's keys stay below
+    // (none on the rightmost spine). Probes start in ascending order, so a later descent climbs only to the
+    // lowest of them whose subtree still holds its start and goes down from there.
+    struct PathStep {
+        std::shared_ptr<InternalNode> node;
+        StoredKey fence;
+        bool fenced;
+    };
+    std::vector<PathStep> path;
+    auto descend = [&](StoredKey start, int& nodesAccessed) -> std::shared_ptr<LeafNode> {
+        if (root->isLeaf) return std::static_pointer_cast<LeafNode>(root);
+        while (path.size() > 1 && path.back().fenced && !(start < path.back().fence)) path.pop_back();
+        if (path.empty()) path.push_back({std::static_pointer_cast<InternalNode>(root), StoredKey{}, false});
+        while (true) {
+            const PathStep& step = path.back();
+            int index = nodeUpperBound(step.node->keys.data(), step.node->keyCount, start);
+            std::shared_ptr<Node> child = step.node->children[index];
+            nodesAccessed++;
+            if (child->isLeaf) return std::static_pointer_cast<LeafNode>(child);
+            bool fenced = index < step.node->keyCount;
+            PathStep next{std::static_pointer_cast<InternalNode>(child), fenced ? step.node->keys[index] : step.fence,
+                          fenced || step.fenced};
+            path.push_back(next);
+        }
+    };
+
+    // Sweep the leaves once in key order. Each key is handed to every active probe whose range holds it,
+    // so overlapping and adjacent ranges share one leaf walk and one posting list decode.
+    std::vector<std::vector<uint16_t>> probeRecordIds(ranges.size());
+    std::vector<const Probe*> active;
+    size_t nextProbe = 0;
+    std::shared_ptr<LeafNode> leaf;
+    int slot = 0;
+
+    while (true) {
+        if (active.empty()) {
+            if (nextProbe == probes.size()) break;
+
+            // Jump to the next range; only descend again when it starts beyond the current leaf
+            StoredKey start = probes[nextProbe].lower;
+            if (!leaf || leaf->keys[leaf->keyCount - 1] < start) {
+                int nodesAccessed = 0;
+                leaf = descend(start, nodesAccessed);
+                batch.results[probes[nextProbe].index].indexNodesAccessed = nodesAccessed;
+                batch.indexNodesAccessed += nodesAccessed;
+                batch.descents++;
+            }
+            slot = nodeLowerBound(leaf->keys.data(), leaf->keyCount, start);
+        }
+
+        if (slot == leaf->keyCount) {
+            leaf = leaf->nextLeaf;
+            slot = 0;
+            if (!leaf) break;   // past the last key: nothing is left for any probe
+            continue;
+        }
+
+        StoredKey key = leaf->keys[slot];
+        while (nextProbe < probes.size() && !(key < probes[nextProbe].lower)) {
+            active.push_back(&probes[nextProbe++]);
+        }
+        active.erase(std::remove_if(active.begin(), active.end(), [key](const Probe* probe) { return probe->upper < key; }),
+                     active.end());
+
+        if (!active.empty()) {
+            leaf->postings[slot].forEach([&](Value value) {
+                for (const Probe* probe : active) {
+                    probeRecordIds[probe->index].push_back(static_cast<uint16_t>(value));
+                }
+            });
+        }
+        slot++;
+    }
 
+    // Every record any probe needs is read once, in block order, for the whole batch. Record ids are dense, so
+    // flat tables indexed by id stand in for sorting the union and for a map back to fetched positions.
+    size_t totalMatches = 0;
+    uint16_t maxRecordId = 0;
+    for (const auto& recordIds : probeRecordIds) {
+        totalMatches += recordIds.size();
+        for (uint16_t recordId : recordIds) maxRecordId = std::max(maxRecordId, recordId);
+    }
+    if (totalMatches == 0) return batch;
 
+    std::vector<uint8_t> wanted(size_t(maxRecordId) + 1, 0);
+    for (const auto& recordIds : probeRecordIds) {
+        for (uint16_t recordId : recordIds) wanted[recordId] = 1;
+    }
+    std::vector<uint16_t> batchRecordIds;
+    for (size_t recordId = 0; recordId < wanted.size(); ++recordId) {
+        if (wanted[recordId]) batchRecordIds.push_back(static_cast<uint16_t>(recordId));
+    }
 
+    int heldBlock = -1;
+    std::vector<uint16_t> recordBlocks;
+    batch.records = storage.bulkReadInBlockOrder(batchRecordIds, batch.dataBlocksAccessed, heldBlock, &recordBlocks);
+    if (batch.records.empty()) return batch;
 
-    // START TUAN's CODE
+    std::vector<uint32_t> positionOf(wanted.size(), 0);
+    for (uint32_t position = 0; position < batch.records.size(); ++position) {
+        positionOf[batch.records[position].recordId] = position;
+    }
 
-    // std::vector<Record> recordsInBlock;
+    // A probe counts a block the first time it meets it: lastProbe[block] is the probe that last did
+    std::vector<size_t> lastProbe(size_t(recordBlocks.back()) + 1, ranges.size());
+    batch.matches.reserve(totalMatches);
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        BatchProbeResult& result = batch.results[i];
+        result.firstMatch = batch.matches.size();
+        result.numberOfResults = static_cast<int>(probeRecordIds[i].size());
+        for (uint16_t recordId : probeRecordIds[i]) {
+            uint32_t position = positionOf[recordId];
+            batch.matches.push_back(position);
+            uint16_t block = recordBlocks[position];
+            if (lastProbe[block] != i) {
+                lastProbe[block] = i;
+                result.dataBlocksAccessed++;
+            }
+        }
+    }
 
-    // while (leaf && leaf->keys.front() <= upper) {
+    return batch;
+}
 
-    //     for (size_t i = 0; i < leaf->keys.size(); ++i) {
-    //         if (leaf->keys[i] > upper) break;
-    //         if (leaf->keys[i] >= lower) {
+template <typename Key, typename Value, int Order>
+BatchSearchResult BPlusTree<Key, Value, Order>::lookupBatch(const std::vector<Key>& keys, Storage& storage) {
+    std::vector<std::pair<Key, Key>> ranges;
+    ranges.reserve(keys.size());
+    for (const Key& key : keys) {
+        ranges.emplace_back(key, key);
+    }
+    return rangeSearchBatch(ranges, storage);
+}
 
-    //             uint16_t recordId = leaf->recordIds[i];
-    //             uint16_t datablockId = storage.getRecordLocations().at(recordId).first;
+template <typename Key, typename Value, int Order>
+uint32_t BPlusTree<Key, Value, Order>::count(Key rawKey) {
+    StoredKey key = Codec::encode(rawKey);
+    int indexNodesAccessed = 0;
+    auto leaf = findLeaf(key, indexNodesAccessed);
+    if (!leaf) return 0;
 
+    int index = nodeLowerBound(leaf->keys.data(), leaf->keyCount, key);
+    if (index == leaf->keyCount || leaf->keys[index] != key) return 0;
+    return leaf->postings[index].size();
+}
 
-    //             bool keep_loop = true;
-                
-    //             while(keep_loop){
-    //                 recordsInBlock = storage.getRecordsWithBlockId(datablockId);
-    //                 result.dataBlocksAccessed++;
+template <typename Key, typename Value, int Order>
+std::vector<uint32_t> BPlusTree<Key, Value, Order>::countBatch(const std::vector<Key>& keys, size_t groupSize) {
+    std::vector<uint32_t> counts(keys.size(), 0);
+    if (!root || keys.empty()) return counts;
+    groupSize = std::max<size_t>(groupSize, 1);
+
+    // A binary search over a node first reads its header and the middle of its keys, then a quarter either side
+    auto prefetchKeys = [](const Node* node) {
+        PREFETCH(node);
+        PREFETCH(&node->keys[Order / 4]);
+        PREFETCH(&node->keys[Order / 2]);
+        PREFETCH(&node->keys[3 * Order / 4]);
+    };
+
+    std::vector<StoredKey> encoded(groupSize);
+    std::vector<const Node*> nodes(groupSize);
+    std::vector<int> slots(groupSize);
+    for (size_t begin = 0; begin < keys.size(); begin += groupSize) {
+        size_t size = std::min(groupSize, keys.size() - begin);
+        for (size_t i = 0; i < size; ++i) {
+            encoded[i] = Codec::encode(keys[begin + i]);
+            nodes[i] = root.get();
+        }
 
-    //                 for (Record &record:recordsInBlock){
+        // Leaves all sit at the same depth, so the whole group moves down one level per pass
+        while (!nodes[0]->isLeaf) {
+            for (size_t i = 0; i < size; ++i) {
+                auto internal = static_cast<const InternalNode*>(nodes[i]);
+                nodes[i] = internal->children[nodeUpperBound(internal->keys.data(), internal->keyCount, encoded[i])].get();
+                prefetchKeys(nodes[i]);
+            }
+        }
 
-    //                     std::cout << "cur fgt: " << record.fgPctHome << std::endl;
+        for (size_t i = 0; i < size; ++i) {
+            auto leaf = static_cast<const LeafNode*>(nodes[i]);
+            slots[i] = nodeLowerBound(leaf->keys.data(), leaf->keyCount, encoded[i]);
+            if (slots[i] < leaf->keyCount) PREFETCH(&leaf->postings[slots[i]]);
+        }
+        for (size_t i = 0; i < size; ++i) {
+            auto leaf = static_cast<const LeafNode*>(nodes[i]);
+            if (slots[i] < leaf->keyCount && leaf->keys[slots[i]] == encoded[i]) {
+                counts[begin + i] = leaf->postings[slots[i]].size();
+            }
+        }
+    }
+    return counts;
+}
+
+template <typename Key, typename Value, int Order>
+typename BPlusTree<Key, Value, Order>::Cursor BPlusTree<Key, Value, Order>::openCursor(Key lower, Key upper) {
+    return cursorFrom(Codec::encode(lower), Codec::encode(upper));
+}
+
+template <typename Key, typename Value, int Order>
+typename BPlusTree<Key, Value, Order>::Cursor BPlusTree<Key, Value, Order>::cursorFrom(StoredKey lower, StoredKey upper) {
+    Cursor cursor;
+    if (!root) return cursor;
+
+    cursor.upper = upper;
+    cursor.leaf = findLeaf(lower, cursor.nodesAccessed);
+    cursor.slot = nodeLowerBound(cursor.leaf->keys.data(), cursor.leaf->keyCount, lower);
+    cursor.settle();
+    return cursor;
+}
+
+template <typename Key, typename Value, int Order>
+typename BPlusTree<Key, Value, Order>::ReverseCursor BPlusTree<Key, Value, Order>::openReverseCursor(Key lower, Key upper) {
+    return reverseCursorFrom(Codec::encode(lower), Codec::encode(upper));
+}
+
+template <typename Key, typename Value, int Order>
+typename BPlusTree<Key, Value, Order>::ReverseCursor
+BPlusTree<Key, Value, Order>::reverseCursorFrom(StoredKey lower, StoredKey upper) {
+    ReverseCursor cursor;
+    if (!root) return cursor;
+
+    cursor.lower = lower;
+    cursor.leaf = findLeaf(upper, cursor.nodesAccessed);
+    cursor.slot = nodeUpperBound(cursor.leaf->keys.data(), cursor.leaf->keyCount, upper) - 1;
+    cursor.settle();
+    return cursor;
+}
+
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::ReverseCursor::next() {
+    if (--remaining > 0) return;
+    slot--;
+    settle();
+}
+
+// Moves backward from (leaf, slot) to the last entry still in range, or invalidates the cursor
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::ReverseCursor::settle() {
+    while (leaf) {
+        if (slot < 0) {
+            leaf = leaf->prevLeaf.lock();
+            if (leaf) slot = leaf->keyCount - 1;
+            continue;
+        }
+        if (leaf->keys[slot] < lower) {
+            leaf = nullptr;
+            return;
+        }
+        // Gaps only decode forwards, so one key's list is decoded whole and read from the back
+        values = leaf->postings[slot].decode();
+        remaining = values.size();
+        if (remaining > 0) return;
+        slot--;
+    }
+}
+
+template <typename Key, typename Value, int Order>
+SearchResult BPlusTree<Key, Value, Order>::topK(size_t k, Storage& storage, bool descending) {
+    SearchResult result = {0, 0, 0.0f, 0, {}};
+    constexpr StoredKey lowest = std::numeric_limits<StoredKey>::min();
+    constexpr StoredKey highest = std::numeric_limits<StoredKey>::max();
+
+    std::vector<uint16_t> recordIds;
+    if (descending) {
+        auto cursor = reverseCursorFrom(lowest, highest);
+        for (; cursor.valid() && recordIds.size() < k; cursor.next()) {
+            recordIds.push_back(static_cast<uint16_t>(cursor.value()));
+        }
+        result.indexNodesAccessed = cursor.indexNodesAccessed();
+    } else {
+        auto cursor = cursorFrom(lowest, highest);
+        for (; cursor.valid() && recordIds.size() < k; cursor.next()) {
+            recordIds.push_back(static_cast<uint16_t>(cursor.value()));
+        }
+        result.indexNodesAccessed = cursor.indexNodesAccessed();
+    }
+
+    // Only k records, read in key order so the result stays ordered
+    std::set<uint16_t> blocks;
+    for (uint16_t recordId : recordIds) {
+        blocks.insert(storage.getRecordLocation(recordId).first);
+    }
+    result.found_records = storage.bulkRead(recordIds);
+    result.dataBlocksAccessed = static_cast<int>(blocks.size());
+    result.numberOfResults = static_cast<int>(recordIds.size());
+    return result;
+}
+
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::Cursor::next() {
+    if (reader.next(current)) return;
+    slot++;
+    settle();
+}
+
+// Moves forward from (leaf, slot) to the first entry still in range, or invalidates the cursor
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::Cursor::settle() {
+    while (leaf) {
+        if (slot == leaf->keyCount) {
+            leaf = leaf->nextLeaf;
+            slot = 0;
+            continue;
+        }
+        if (upper < leaf->keys[slot]) {
+            leaf = nullptr;
+            return;
+        }
+        reader = leaf->postings[slot].reader();
+        if (reader.next(current)) return;
+        slot++;
+    }
+}
 
-    //                     if (record.fgPctHome > upper){
-    //                         keep_loop = false;
-    //                         std::cout << "we actually break the loop" << std::endl;
-    //                         break;
-    //                     }
+template <typename Key, typename Value, int Order>
+typename BPlusTree<Key, Value, Order>::RecordCursor
+BPlusTree<Key, Value, Order>::openRecordCursor(Key lower, Key upper, Storage& storage) {
+    return RecordCursor(openCursor(lower, upper), storage);
+}
 
-    //                     if (record.fgPctHome >= lower){
-    //                         result.found_records.push_back(record);
-    //                     }
-    //                 }
+template <typename Key, typename Value, int Order>
+BPlusTree<Key, Value, Order>::RecordCursor::RecordCursor(Cursor cursor, Storage& storage)
+    : cursor(std::move(cursor)), storage(&storage) {
+    refill();
+}
 
-    //                 recordsInBlock.clear();
-    //                 std::cout << "cur_datablockid: " << datablockId << " block count: " << storage.getDatablockCount() << std::endl;
-    //                 datablockId++;
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::RecordCursor::next() {
+    if (++position == buffer.size()) refill();
+}
 
-    //                 if (datablockId > storage.getDatablockCount()){
-    //                     keep_loop = false;
-    //                 }
-    //             }
-                
-                
-    //             result.numberOfResults++;
-    //         }
-    //     }
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::RecordCursor::refill() {
+    buffer.clear();
+    position = 0;
 
-    //     leaf = leaf->nextLeaf;
-    // }
+    std::vector<uint16_t> recordIds;
+    for (size_t taken = 0; taken < cursorBatchSize && cursor.valid(); ++taken, cursor.next()) {
+        recordIds.push_back(static_cast<uint16_t>(cursor.value()));
+    }
+    buffer = storage->bulkReadInBlockOrder(recordIds, blocksRead, heldBlock);
+}
 
+template <typename Key, typename Value, int Order>
+SearchResult BPlusTree<Key, Value, Order>::rangeSearchCovered(Key rawLower, Key rawUpper) {
+    SearchResult result = {0, 0, 0.0f, 0, {}};
+    if (!root) return result;
 
+    StoredKey lower = Codec::encode(rawLower);
+    StoredKey upper = Codec::encode(rawUpper);
+    auto leaf = findLeaf(lower, result.indexNodesAccessed);
 
+    while (leaf && !(upper < leaf->keys[0])) {
+        const uint8_t* row = leaf->payloadRows.data();
+        for (int i = 0; i < leaf->keyCount; ++i) {
+            if (upper < leaf->keys[i]) break;
+            if (leaf->keys[i] < lower) {
+                row += leaf->postings[i].size() * payloadRowBytes;
+                continue;
+            }
 
-    // if (!result.found_records.empty()) {
-    //     float totalFG3PctHome = 0.0f;
-    //     for (const auto& record : result.found_records) {
-    //         totalFG3PctHome += record.fg3PctHome;
-    //     }
-    //     result.avgFG3PctHome = totalFG3PctHome / result.found_records.size();
-    // }
+            // Rows hold the columns in their stored widths, so each is copied straight into place
+            leaf->postings[i].forEach([&](Value value) {
+                Record record{};
+                record.recordId = static_cast<uint16_t>(value);
+                auto* fields = reinterpret_cast<uint8_t*>(&record);
+                for (const auto& [offset, width] : payloadFields) {
+                    std::memcpy(fields + offset, row, width);
+                    row += width;
+                }
+                result.found_records.push_back(record);
+            });
+            result.numberOfResults += leaf->postings[i].size();
+        }
+        leaf = leaf->nextLeaf;
+    }
 
-    // END TUAN's CODE
+    return result;
+}
 
+template <typename Key, typename Value, int Order>
+AggregateResult BPlusTree<Key, Value, Order>::rangeAggregate(Key rawLower, Key rawUpper) {
+    AggregateResult result = {0, 0, 0.0, 0.0f};
+    StoredKey lower = Codec::encode(rawLower);
+    StoredKey upper = Codec::encode(rawUpper);
+    if (!root || upper < lower) return result;
+
+    // Everything <= upper minus everything < lower: two root-to-leaf paths, no leaf walk and no data blocks
+    auto [upperCount, upperSum] = prefixAggregate(upper, true, result.indexNodesAccessed);
+    auto [lowerCount, lowerSum] = prefixAggregate(lower, false, result.indexNodesAccessed);
+
+    result.count = upperCount - lowerCount;
+    result.sum = upperSum - lowerSum;
+    if (result.count > 0) {
+        result.average = static_cast<float>(result.sum / result.count);
+    }
     return result;
 }
 
-void BPlusTree::printStatistics() {
+// Count and measure sum of all entries below bound (or up to and including it)
+template <typename Key, typename Value, int Order>
+std::pair<uint32_t, double> BPlusTree<Key, Value, Order>::prefixAggregate(StoredKey bound, bool inclusive, int& indexNodeCounter) {
+    uint32_t count = 0;
+    double sum = 0.0;
+
+    auto current = root;
+    while (!current->isLeaf) {
+        auto internal = std::static_pointer_cast<InternalNode>(current);
+        // Children left of the one bound descends into hold only smaller keys
+        int index = nodeUpperBound(internal->keys.data(), internal->keyCount, bound);
+        for (int i = 0; i < index; ++i) {
+            count += internal->childCounts[i];
+            sum += internal->childSums[i];
+        }
+        current = internal->children[index];
+        indexNodeCounter++;
+    }
+
+    auto leaf = std::static_pointer_cast<LeafNode>(current);
+    int end = inclusive ? nodeUpperBound(leaf->keys.data(), leaf->keyCount, bound)
+                        : nodeLowerBound(leaf->keys.data(), leaf->keyCount, bound);
+    for (int i = 0; i < end; ++i) {
+        count += leaf->postings[i].size();
+        sum += leaf->sums[i];
+    }
+    return {count, sum};
+}
+
+template <typename Key, typename Value, int Order>
+std::pair<uint32_t, double> BPlusTree<Key, Value, Order>::nodeTotals(const Node& node) const {
+    uint32_t count = 0;
+    double sum = 0.0;
+    if (node.isLeaf) {
+        const auto& leaf = static_cast<const LeafNode&>(node);
+        for (int i = 0; i < leaf.keyCount; ++i) {
+            count += leaf.postings[i].size();
+            sum += leaf.sums[i];
+        }
+    } else {
+        const auto& internal = static_cast<const InternalNode&>(node);
+        for (int i = 0; i <= internal.keyCount; ++i) {
+            count += internal.childCounts[i];
+            sum += internal.childSums[i];
+        }
+    }
+    return {count, sum};
+}
+
+// Recomputes every internal node's per-child totals bottom-up; returns the totals of node's subtree
+template <typename Key, typename Value, int Order>
+std::pair<uint32_t, double> BPlusTree<Key, Value, Order>::rebuildAggregates(const std::shared_ptr<Node>& node) {
+    if (!node->isLeaf) {
+        auto internal = std::static_pointer_cast<InternalNode>(node);
+        for (int i = 0; i <= internal->keyCount; ++i) {
+            std::tie(internal->childCounts[i], internal->childSums[i]) = rebuildAggregates(internal->children[i]);
+        }
+    }
+    return nodeTotals(*node);
+}
+
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::printStatistics() {
+    if (statsStale) _getTotalNodes();
     std::cout << "----------------- B+ Tree Statistics -----------------" << std::endl;
-    std::cout << "Order (maximum number of keys per node): " << order << std::endl;
+    std::cout << "Order (maximum number of keys per node): " << Order - 1 << std::endl;
     std::cout << "Height of the tree: " << tree_height << std::endl;
     std::cout << "Content of root node (keys): ";
     if (root) {
-        for (const auto& key : root->keys) {
-            std::cout << key << " ";
+        for (int i = 0; i < root->keyCount; ++i) {
+            printKey(std::cout, Codec::decode(root->keys[i]));
+            std::cout << " ";
         }
     }
     std::cout << std::endl;
@@ -365,30 +1362,43 @@ void BPlusTree::printStatistics() {
     std::cout << "Total nodes: " << totalNodes << std::endl;
     std::cout << "Internal nodes: " << internalNodes << std::endl;
     std::cout << "Leaf nodes: " << leafNodes << std::endl;
+    if (overflowPages > 0) std::cout << "Overflow pages (keys too large for one leaf page): " << overflowPages << std::endl;
+    std::cout << "Distinct keys: " << distinctKeys << ", entries: " << totalEntries
+              << ", posting list bytes: " << postingBytes << " (vs " << totalEntries * sizeof(Value) << " uncompressed)" << std::endl;
+    if (!payload.empty()) {
+        std::cout << "Covered columns:";
+        for (Column column : payload) std::cout << " " << columnName(column);
+        std::cout << ", payload bytes: " << payloadBytes << std::endl;
+    }
     std::cout << "------------------------------------------------------" << std::endl;
 }
 
-int BPlusTree::getHeight(std::shared_ptr<BPlusTreeNode> node) {
+template <typename Key, typename Value, int Order>
+int BPlusTree<Key, Value, Order>::getHeight(std::shared_ptr<Node> node) {
     int height = 0;
     while (node) {
         height++;
         if (node->isLeaf) break;
-        node = node->children[0];
+        node = std::static_pointer_cast<InternalNode>(node)->children[0];
     }
     return height;
 }
 
-void BPlusTree::saveToFile() {
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::saveToFile() {
     std::ofstream file(indexFilename, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Unable to open index file for writing: " + indexFilename);
     }
 
-    // Write the order of the B+ tree
+    // Write the order of the B+ tree and the payload row width, in bytes, of each leaf entry
+    int order = Order;
     file.write(reinterpret_cast<const char*>(&order), sizeof(order));
+    uint32_t payloadWidth = static_cast<uint32_t>(payloadRowBytes);
+    file.write(reinterpret_cast<const char*>(&payloadWidth), sizeof(payloadWidth));
 
     // Perform a level-order traversal to write nodes
-    std::queue<std::shared_ptr<BPlusTreeNode>> queue;
+    std::queue<std::shared_ptr<Node>> queue;
     if (root) queue.push(root);
 
     while (!queue.empty()) {
@@ -398,8 +1408,9 @@ void BPlusTree::saveToFile() {
         writeNode(file, node);
 
         if (!node->isLeaf) {
-            for (const auto& child : node->children) {
-                queue.push(child);
+            auto internal = std::static_pointer_cast<InternalNode>(node);
+            for (int i = 0; i <= internal->keyCount; ++i) {
+                queue.push(internal->children[i]);
             }
         }
     }
@@ -408,42 +1419,53 @@ void BPlusTree::saveToFile() {
     std::cout << "B+ tree saved to file: " << indexFilename << std::endl;
 }
 
-void BPlusTree::loadFromFile() {
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::loadFromFile() {
     std::ifstream file(indexFilename, std::ios::binary);
     if (!file.is_open()) {
         throw std::runtime_error("Unable to open index file for reading: " + indexFilename);
     }
 
-    // Read the order of the B+ tree
+    // Read the order of the B+ tree; node layout is fixed at compile time so it has to match
+    int order = 0;
     file.read(reinterpret_cast<char*>(&order), sizeof(order));
+    if (order != Order) {
+        throw std::runtime_error("Index file " + indexFilename + " was built with order " + std::to_string(order)
+                                 + ", expected " + std::to_string(Order));
+    }
+    uint32_t payloadWidth = 0;
+    file.read(reinterpret_cast<char*>(&payloadWidth), sizeof(payloadWidth));
+    if (payloadWidth != payloadRowBytes) {
+        throw std::runtime_error("Index file " + indexFilename + " stores " + std::to_string(payloadWidth)
+                                 + "-byte payload rows, expected " + std::to_string(payloadRowBytes));
+    }
 
-    std::queue<std::pair<std::shared_ptr<BPlusTreeNode>, size_t>> queue;
-    std::shared_ptr<BPlusTreeNode> prevLeaf = nullptr;
+    std::queue<std::pair<std::shared_ptr<InternalNode>, int>> queue;
+    std::shared_ptr<LeafNode> prevLeaf = nullptr;
 
     root = readNode(file);
-    if (root) queue.push({root, root->keys.size() + 1});
+    if (root && !root->isLeaf) queue.push({std::static_pointer_cast<InternalNode>(root), root->keyCount + 1});
 
     while (!queue.empty()) {
         auto [parent, childCount] = queue.front();
         queue.pop();
 
-        for (size_t i = 0; i < childCount; ++i) {
+        for (int i = 0; i < childCount; ++i) {
             auto child = readNode(file);
             if (!child) break;
 
-            parent->children.push_back(child);
+            parent->children[i] = child;
             child->parent = parent;
 
-            // TODO: Debug
-            // std::cout << "DEBUG: child's Parrent address: " << child->parent.lock() << std::endl;
-
             if (!child->isLeaf) {
-                queue.push({child, child->keys.size() + 1});
+                queue.push({std::static_pointer_cast<InternalNode>(child), child->keyCount + 1});
             } else {
+                auto leaf = std::static_pointer_cast<LeafNode>(child);
                 if (prevLeaf) {
-                    prevLeaf->nextLeaf = child;
+                    prevLeaf->nextLeaf = leaf;
                 }
-                prevLeaf = child;
+                leaf->prevLeaf = prevLeaf;
+                prevLeaf = leaf;
             }
         }
     }
@@ -451,50 +1473,89 @@ void BPlusTree::loadFromFile() {
     file.close();
     std::cout << "B+ tree loaded from file: " << indexFilename << std::endl;
 
+    // Internal nodes are stored without their per-child totals; derive them from the leaves
+    if (root) rebuildAggregates(root);
+
     tree_height = getHeight(root);
     _getTotalNodes();
 }
 
-void BPlusTree::writeNode(std::ofstream& file, std::shared_ptr<BPlusTreeNode> node) {
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::writeNode(std::ofstream& file, const std::shared_ptr<Node>& node) {
     file.write(reinterpret_cast<const char*>(&node->isLeaf), sizeof(node->isLeaf));
-    
-    size_t keyCount = node->keys.size();
+
+    uint16_t keyCount = node->keyCount;
     file.write(reinterpret_cast<const char*>(&keyCount), sizeof(keyCount));
-    file.write(reinterpret_cast<const char*>(node->keys.data()), keyCount * sizeof(float));
+    file.write(reinterpret_cast<const char*>(node->keys.data()), keyCount * sizeof(StoredKey));
 
     if (node->isLeaf) {
-        file.write(reinterpret_cast<const char*>(node->recordIds.data()), keyCount * sizeof(uint32_t));
-        
-        bool hasNextLeaf = (node->nextLeaf != nullptr);
+        auto leaf = std::static_pointer_cast<LeafNode>(node);
+        // Each posting list is its entry count, its byte length and the encoded gaps
+        for (int i = 0; i < keyCount; ++i) {
+            const auto& posting = leaf->postings[i];
+            uint32_t entries = posting.size();
+            uint32_t length = static_cast<uint32_t>(posting.bytes().size());
+            file.write(reinterpret_cast<const char*>(&entries), sizeof(entries));
+            file.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            file.write(reinterpret_cast<const char*>(posting.bytes().data()), length);
+        }
+        file.write(reinterpret_cast<const char*>(leaf->sums.data()), keyCount * sizeof(double));
+        file.write(reinterpret_cast<const char*>(leaf->payloadRows.data()), leaf->payloadRows.size());
+
+        bool hasNextLeaf = (leaf->nextLeaf != nullptr);
         file.write(reinterpret_cast<const char*>(&hasNextLeaf), sizeof(bool));
+        bool hasPrevLeaf = !leaf->prevLeaf.expired();
+        file.write(reinterpret_cast<const char*>(&hasPrevLeaf), sizeof(bool));
     }
 }
 
-std::shared_ptr<BPlusTreeNode> BPlusTree::readNode(std::ifstream& file) {
+template <typename Key, typename Value, int Order>
+std::shared_ptr<typename BPlusTree<Key, Value, Order>::Node>
+BPlusTree<Key, Value, Order>::readNode(std::ifstream& file) {
     if (file.peek() == EOF) return nullptr;
 
-    auto node = std::make_shared<BPlusTreeNode>();
-    
-    file.read(reinterpret_cast<char*>(&node->isLeaf), sizeof(node->isLeaf));
-    
-    size_t keyCount;
+    bool isLeaf;
+    file.read(reinterpret_cast<char*>(&isLeaf), sizeof(isLeaf));
+
+    uint16_t keyCount;
     file.read(reinterpret_cast<char*>(&keyCount), sizeof(keyCount));
-    node->keys.resize(keyCount);
-    file.read(reinterpret_cast<char*>(node->keys.data()), keyCount * sizeof(float));
+    if (keyCount >= Order) {
+        throw std::runtime_error("Corrupt index node in " + indexFilename);
+    }
 
-    if (node->isLeaf) {
-        node->recordIds.resize(keyCount);
-        file.read(reinterpret_cast<char*>(node->recordIds.data()), keyCount * sizeof(uint32_t));
+    std::shared_ptr<Node> node;
+    if (isLeaf) {
+        auto leaf = std::make_shared<LeafNode>();
+        file.read(reinterpret_cast<char*>(leaf->keys.data()), keyCount * sizeof(StoredKey));
+        for (int i = 0; i < keyCount; ++i) {
+            uint32_t entries = 0, length = 0;
+            file.read(reinterpret_cast<char*>(&entries), sizeof(entries));
+            file.read(reinterpret_cast<char*>(&length), sizeof(length));
+            std::vector<uint8_t> bytes(length);
+            file.read(reinterpret_cast<char*>(bytes.data()), length);
+            leaf->postings[i] = PostingList<Value>::fromBytes(entries, std::move(bytes));
+        }
+        file.read(reinterpret_cast<char*>(leaf->sums.data()), keyCount * sizeof(double));
+        leaf->payloadRows.resize(payloadOffset(*leaf, keyCount));
+        file.read(reinterpret_cast<char*>(leaf->payloadRows.data()), leaf->payloadRows.size());
 
-        bool hasNextLeaf;
+        bool hasNextLeaf, hasPrevLeaf;
         file.read(reinterpret_cast<char*>(&hasNextLeaf), sizeof(bool));
-        // Note: We'll set the nextLeaf pointer when we read the next leaf node
+        file.read(reinterpret_cast<char*>(&hasPrevLeaf), sizeof(bool));
+        // Note: We'll set the nextLeaf and prevLeaf pointers when we read the neighbouring leaf nodes
+        node = leaf;
+    } else {
+        auto internal = std::make_shared<InternalNode>();
+        file.read(reinterpret_cast<char*>(internal->keys.data()), keyCount * sizeof(StoredKey));
+        node = internal;
     }
+    node->keyCount = keyCount;
 
     return node;
 }
 
-void BPlusTree::verifyTree() {
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::verifyTree() {
     if (!root) {
         std::cout << "Tree is empty" << std::endl;
         return;
@@ -506,70 +1567,97 @@ void BPlusTree::verifyTree() {
         std::cout << "Error: Root node has a parent" << std::endl;
     }
 
-    std::queue<std::shared_ptr<BPlusTreeNode>> queue;
+    std::queue<std::shared_ptr<Node>> queue;
     queue.push(root);
 
     while (!queue.empty()) {
         auto node = queue.front();
         queue.pop();
 
-        if (node->isLeaf) {
-            if (!node->children.empty()) {
-                std::cout << "Error: Leaf node has children" << std::endl;
-            }
-            if (node->keys.size() != node->recordIds.size()) {
-                std::cout << "Error: Leaf node keys and recordIds size mismatch" << std::endl;
-            }
-        } else {
-            if (node->children.size() != node->keys.size() + 1) {
-                std::cout << "Error: Internal node keys and children size mismatch" << std::endl;
-            }
-            for (const auto& child : node->children) {
+        if (!node->isLeaf) {
+            auto internal = std::static_pointer_cast<InternalNode>(node);
+            for (int i = 0; i <= internal->keyCount; ++i) {
+                const auto& child = internal->children[i];
+                if (!child) {
+                    std::cout << "Error: Internal node keys and children size mismatch" << std::endl;
+                    continue;
+                }
                 if (child->parent.lock() != node) {
-
-                    std::cout << "child's parrent address: " << child->parent.lock() << std::endl;
-                    std::cout << "node's address: " << node << std::endl;
-                    std::cout << "children node's keys: ";
-                    for (float key: child->keys){
-                        std::cout << key << " ";
-                    }
-                    std::cout << std::endl;
-
-
                     std::cout << "Error: Child-parent link mismatch" << std::endl;
                 }
+                if (internal->childCounts[i] != nodeTotals(*child).first) {
+                    std::cout << "Error: Subtree count mismatch" << std::endl;
+                }
                 queue.push(child);
             }
         }
 
-        for (size_t i = 1; i < node->keys.size(); ++i) {
-            float epsilon = 0.000001; 
-            if (node->keys[i] <= node->keys[i-1] - epsilon) {
-                std::cout << "Error: Keys not in ascending order, key[" << i << "] = " << node->keys[i] 
-                          << ", key[" << (i-1) << "] = " << node->keys[i-1] << std::endl;
+        for (int i = 1; i < node->keyCount; ++i) {
+            if (!(node->keys[i-1] < node->keys[i])) {
+                // Leaf keys are unique, duplicates belong in a single posting list
+                std::cout << "Error: Keys not in strictly ascending order, key[" << i << "] = ";
+                printKey(std::cout, Codec::decode(node->keys[i]));
+                std::cout << ", key[" << (i-1) << "] = ";
+                printKey(std::cout, Codec::decode(node->keys[i-1]));
+                std::cout << std::endl;
             }
         }
 
-        if (node != root && (node->keys.size() < (order - 1) / 2 || node->keys.size() > order - 1)) {
-            std::cout << "Error: Node does not meet occupancy requirements" << std::endl;
+        if (node != root && (node->keyCount < (Order - 1) / 2 || node->keyCount > Order - 1)) {
+            // Leaves are also cut by bytes, so a leaf with few keys is only underfull while it would still fit
+            // in one page together with a neighbour
+            bool underfull = !node->isLeaf || node->keyCount > Order - 1;
+            if (!underfull) {
+                const auto& leaf = static_cast<const LeafNode&>(*node);
+                auto fitsWith = [&](const LeafNode* other) {
+                    return other && leaf.keyCount + other->keyCount <= Order - 1
+                           && leafBytes(leaf) + leafBytes(*other) - nodeHeaderSize <= INDEX_PAGE_SIZE;
+                };
+                underfull = fitsWith(leaf.nextLeaf.get()) || fitsWith(leaf.prevLeaf.lock().get());
+            }
+            if (underfull) {
+                std::cout << "Error: Node does not meet occupancy requirements" << std::endl;
+            }
+        }
+        if (node->isLeaf && node->keyCount > 1 && leafBytes(static_cast<const LeafNode&>(*node)) > INDEX_PAGE_SIZE) {
+            std::cout << "Error: Leaf holding several keys overflows its page" << std::endl;
+        }
+    }
+
+    // Leaf chain must read the same both ways
+    int unused = 0;
+    auto leaf = findLeaf(std::numeric_limits<StoredKey>::min(), unused);
+    if (!leaf->prevLeaf.expired()) {
+        std::cout << "Error: First leaf has a previous leaf" << std::endl;
+    }
+    for (; leaf->nextLeaf; leaf = leaf->nextLeaf) {
+        if (leaf->nextLeaf->prevLeaf.lock() != leaf) {
+            std::cout << "Error: Leaf chain link mismatch" << std::endl;
         }
     }
 
     std::cout << "B+ tree verification complete" << std::endl;
 }
 
-void BPlusTree::_getTotalNodes() {
+template <typename Key, typename Value, int Order>
+void BPlusTree<Key, Value, Order>::_getTotalNodes() const {
+    statsStale = false;
     if (!root) {
         std::cout << "Tree is empty. Total nodes: 0" << std::endl;
         return;
     }
 
-    std::queue<std::shared_ptr<BPlusTreeNode>> queue;
+    std::queue<std::shared_ptr<Node>> queue;
     queue.push(root);
 
     totalNodes = 0;
     internalNodes = 0;
     leafNodes = 0;
+    distinctKeys = 0;
+    totalEntries = 0;
+    postingBytes = 0;
+    payloadBytes = 0;
+    overflowPages = 0;
 
     while (!queue.empty()) {
         auto node = queue.front();
@@ -579,15 +1667,33 @@ void BPlusTree::_getTotalNodes() {
 
         if (node->isLeaf) {
             leafNodes++;
+            auto leaf = std::static_pointer_cast<LeafNode>(node);
+            distinctKeys += leaf->keyCount;
+            for (int i = 0; i < leaf->keyCount; ++i) {
+                totalEntries += leaf->postings[i].size();
+                postingBytes += leaf->postings[i].bytes().size();
+            }
+            payloadBytes += leaf->payloadRows.size();
+            size_t bytes = leafBytes(*leaf);
+            if (bytes > INDEX_PAGE_SIZE) overflowPages += (bytes - 1) / INDEX_PAGE_SIZE;
         } else {
             internalNodes++;
-            for (const auto& child : node->children) {
-                queue.push(child);
+            auto internal = std::static_pointer_cast<InternalNode>(node);
+            for (int i = 0; i <= internal->keyCount; ++i) {
+                queue.push(internal->children[i]);
             }
         }
     }
 }
 
-std::vector<int> BPlusTree::getNodeCounts() const {
+template <typename Key, typename Value, int Order>
+std::vector<int> BPlusTree<Key, Value, Order>::getNodeCounts() const {
+    if (statsStale) _getTotalNodes();
     return {internalNodes, leafNodes, totalNodes};
-}
\ No newline at end of file
+}
+
+// The engine is compiled once per supported key type
+template class BPlusTree<float, uint32_t>;
+template class BPlusTree<int, uint32_t>;
+template class BPlusTree<uint8_t, uint32_t>;
+template class BPlusTree<CompositeKey<int, int>, uint32_t>;
@@ -9,9 +9,6 @@ extern uint16_t MAX_USED_SPACE_PER_BLOCK = MAX_RECORDS_PER_BLOCK * (RECORD_SIZE
 extern uint16_t MIN_FREE_SPACE_PER_BLOCK = BLOCK_SIZE - MAX_USED_SPACE_PER_BLOCK;
 extern std::string DATABASE_FILENAME = "data.db";
 extern std::string INDEX_FILENAME = "index.dat";
-extern std::string DATA_FILENAME = "games.txt";
-
-extern uint16_t BPLUSTREE_ORDER = 100; // Increased order for better performance
-extern bool isEqual(float a, float b, float epsilon) {
-    return std::abs(a - b) < epsilon;
-};
\ No newline at end of file
+extern std::string GAMEDATE_INDEX_FILENAME = "index_gamedate.dat";
+extern std::string INDEX_CATALOG_FILENAME = "indexes.cat";
+extern std::string DATA_FILENAME = "games.txt";
\ No newline at end of file
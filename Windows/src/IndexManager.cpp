@@ -0,0 +1,396 @@
+#include "IndexManager.h"
+#include "SimdFilter.h"
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <numeric>
+#include <sstream>
+#include <type_traits>
+
+template <typename Key>
+static ColumnIndex makeTree(const std::string& indexFilename, Key (*keyOf)(const Record&),
+                            std::optional<Column> measure, const std::vector<Column>& payload) {
+    return ColumnIndex(std::in_place_type<BPlusTree<Key, uint32_t>>, indexFilename, keyOf, measure, payload);
+}
+
+static ColumnIndex makeColumnIndex(Column column, const std::string& indexFilename,
+                                   std::optional<Column> measure, const std::vector<Column>& payload) {
+    switch (column) {
+        case Column::GameDate:     return makeTree(indexFilename, gameDateKey, measure, payload);
+        case Column::TeamId:       return makeTree(indexFilename, teamIdKey, measure, payload);
+        case Column::PtsHome:      return makeTree(indexFilename, ptsHomeKey, measure, payload);
+        case Column::FgPctHome:    return makeTree(indexFilename, fgPctHomeKey, measure, payload);
+        case Column::FtPctHome:    return makeTree(indexFilename, ftPctHomeKey, measure, payload);
+        case Column::Fg3PctHome:   return makeTree(indexFilename, fg3PctHomeKey, measure, payload);
+        case Column::AstHome:      return makeTree(indexFilename, astHomeKey, measure, payload);
+        case Column::RebHome:      return makeTree(indexFilename, rebHomeKey, measure, payload);
+        case Column::HomeTeamWins: return makeTree(indexFilename, homeTeamWinsKey, measure, payload);
+    }
+    throw std::runtime_error("Unknown column");
+}
+
+static ColumnIndex makeColumnIndex(const std::vector<Column>& columns, const std::string& indexFilename,
+                                   std::optional<Column> measure, const std::vector<Column>& payload) {
+    if (columns.size() == 1) {
+        return makeColumnIndex(columns.front(), indexFilename, measure, payload);
+    }
+    if (columns == std::vector<Column>{Column::TeamId, Column::GameDate}) {
+        return makeTree(indexFilename, teamDateKey, measure, payload);
+    }
+    throw std::runtime_error("Unsupported composite index, only (team_id, game_date) is available");
+}
+
+static std::string columnList(const std::vector<Column>& columns) {
+    std::string result;
+    for (Column column : columns) {
+        if (!result.empty()) result += ",";
+        result += columnName(column);
+    }
+    return result;
+}
+
+static std::vector<Column> parseColumnList(const std::string& list) {
+    std::vector<Column> columns;
+    std::istringstream iss(list);
+    std::string name;
+    while (std::getline(iss, name, ',')) {
+        columns.push_back(parseColumn(name));
+    }
+    return columns;
+}
+
+// Narrows an inclusive [lower, upper] range to the key type of an index; false if no key can match
+template <typename Key>
+static bool toKeyRange(double lower, double upper, Key& lowKey, Key& highKey) {
+    if constexpr (std::is_floating_point_v<Key>) {
+        lowKey = static_cast<Key>(lower);
+        highKey = static_cast<Key>(upper);
+        return !(highKey < lowKey);
+    } else {
+        double low = std::max(std::ceil(lower), static_cast<double>(std::numeric_limits<Key>::min()));
+        double high = std::min(std::floor(upper), static_cast<double>(std::numeric_limits<Key>::max()));
+        if (low > high) return false;
+        lowKey = static_cast<Key>(low);
+        highKey = static_cast<Key>(high);
+        return true;
+    }
+}
+
+static SearchResult scanWhere(Storage& storage, const Predicate& predicate) {
+    SearchResult result = {0, 0, 0.0f, 0, {}};
+
+    // Each morsel's matches are collected by the thread that scanned it, then joined in block order
+    std::vector<std::vector<Record>> morselMatches(storage.morselCount());
+    ScanCounters counters = storage.scanMorsels(morselMatches.size(), predicate, [&](size_t morsel, const std::vector<Record>& records) {
+        morselMatches[morsel] = records;
+    });
+    result.dataBlocksAccessed = static_cast<int>(counters.blocksRead);
+    for (const auto& matches : morselMatches) {
+        result.found_records.insert(result.found_records.end(), matches.begin(), matches.end());
+    }
+
+    result.numberOfResults = result.found_records.size();
+    return result;
+}
+
+IndexManager::IndexManager(Storage& storage, const std::string& catalogFilename)
+    : storage(storage), catalogFilename(catalogFilename) {
+    loadCatalog();
+}
+
+IndexManager::~IndexManager() {
+    try {
+        flush();
+    } catch (...) {
+    }
+}
+
+void IndexManager::flush() {
+    for (auto& [name, info] : indexes) {
+        if (!info.unsaved) continue;
+        std::visit([](auto& tree) { tree.saveToFile(); }, info.tree);
+        info.unsaved = false;
+    }
+}
+
+void IndexManager::createIndex(const std::string& name, const std::vector<Column>& columns, const std::string& indexFilename,
+                               std::optional<Column> measure, const std::vector<Column>& payload) {
+    if (hasIndex(name)) {
+        throw std::runtime_error("Index already exists: " + name);
+    }
+
+    std::string filename = indexFilename.empty() ? "index_" + name + ".dat" : indexFilename;
+    std::cout << "Creating index " << name << " on " << columnList(columns) << "..." << std::endl;
+
+    IndexInfo info{name, columns, measure, payload, makeColumnIndex(columns, filename, measure, payload)};
+    std::visit([&](auto& tree) {
+        tree.buildFromStorage(storage);
+        tree.verifyTree();
+    }, info.tree);
+
+    indexes.emplace(name, std::move(info));
+    saveCatalog();
+}
+
+void IndexManager::ensureIndex(const std::string& name, const std::vector<Column>& columns, const std::string& indexFilename,
+                               std::optional<Column> measure, const std::vector<Column>& payload) {
+    if (!hasIndex(name)) {
+        createIndex(name, columns, indexFilename, measure, payload);
+    }
+}
+
+IndexInfo* IndexManager::findIndexOn(const std::vector<Column>& columns) {
+    for (auto& [name, info] : indexes) {
+        if (info.columns == columns) return &info;
+    }
+    return nullptr;
+}
+
+uint16_t IndexManager::insertRecord(const Record& record) {
+    uint16_t recordId = storage.insertRecord(record);
+    Record stored = storage.getRecord(recordId);
+
+    for (auto& [name, info] : indexes) {
+        std::visit([&](auto& tree) { tree.insertRecord(stored); }, info.tree);
+        info.unsaved = true;
+    }
+
+    return recordId;
+}
+
+std::vector<uint16_t> IndexManager::insertRecords(const std::vector<Record>& records) {
+    std::vector<uint16_t> recordIds = storage.insertRecords(records);
+    std::vector<Record> stored;
+    stored.reserve(recordIds.size());
+    for (uint16_t recordId : recordIds) {
+        stored.push_back(storage.getRecord(recordId));
+    }
+
+    for (auto& [name, info] : indexes) {
+        std::visit([&](auto& tree) {
+            tree.insertRecords(stored);
+            tree.saveToFile();
+        }, info.tree);
+        info.unsaved = false;
+    }
+
+    return recordIds;
+}
+
+SearchResult IndexManager::rangeSearch(Column column, double lower, double upper) {
+    IndexInfo* info = findIndexOn({column});
+    if (!info) {
+        // A composite index led by the column answers it with a prefix range
+        for (auto& [name, candidate] : indexes) {
+            if (candidate.columns.size() > 1 && candidate.columns.front() == column) {
+                info = &candidate;
+                break;
+            }
+        }
+    }
+    if (!info) {
+        return scan(column, lower, upper);
+    }
+
+    return std::visit([&](auto& tree) {
+        using Key = typename std::decay_t<decltype(tree)>::KeyType;
+        if constexpr (IsCompositeKey<Key>::value) {
+            using First = decltype(Key::first);
+            using Second = decltype(Key::second);
+            First lowKey, highKey;
+            if (!toKeyRange(lower, upper, lowKey, highKey)) {
+                return SearchResult{0, 0, 0.0f, 0, {}};
+            }
+            return tree.rangeSearch(prefixRange<First, Second>(lowKey).first,
+                                    prefixRange<First, Second>(highKey).second, storage);
+        } else {
+            Key lowKey, highKey;
+            if (!toKeyRange(lower, upper, lowKey, highKey)) {
+                return SearchResult{0, 0, 0.0f, 0, {}};
+            }
+            return tree.rangeSearch(lowKey, highKey, storage);
+        }
+    }, info->tree);
+}
+
+SearchResult IndexManager::scan(Column column, double lower, double upper) {
+    return scanWhere(storage, Predicate::between(column, lower, upper));
+}
+
+SearchResult IndexManager::coveredRangeSearch(Column column, double lower, double upper, const std::vector<Column>& needed) {
+    IndexInfo* info = findIndexOn({column});
+    bool covered = info && std::visit([&](const auto& tree) { return tree.covers(needed); }, info->tree);
+    if (!covered) {
+        return rangeSearch(column, lower, upper);
+    }
+
+    return std::visit([&](auto& tree) {
+        using Key = typename std::decay_t<decltype(tree)>::KeyType;
+        if constexpr (IsCompositeKey<Key>::value) {
+            return SearchResult{0, 0, 0.0f, 0, {}};
+        } else {
+            Key lowKey, highKey;
+            if (!toKeyRange(lower, upper, lowKey, highKey)) {
+                return SearchResult{0, 0, 0.0f, 0, {}};
+            }
+            return tree.rangeSearchCovered(lowKey, highKey);
+        }
+    }, info->tree);
+}
+
+SearchResult IndexManager::rangeSearch(Column first, double value, Column second, double lower, double upper) {
+    IndexInfo* info = findIndexOn({first, second});
+    if (!info) {
+        return scan(first, value, second, lower, upper);
+    }
+
+    return std::visit([&](auto& tree) {
+        using Key = typename std::decay_t<decltype(tree)>::KeyType;
+        if constexpr (IsCompositeKey<Key>::value) {
+            using First = decltype(Key::first);
+            using Second = decltype(Key::second);
+            First prefix, prefixHigh;
+            Second lowKey, highKey;
+            if (!toKeyRange(value, value, prefix, prefixHigh) || !toKeyRange(lower, upper, lowKey, highKey)) {
+                return SearchResult{0, 0, 0.0f, 0, {}};
+            }
+            return tree.rangeSearch(Key{prefix, lowKey}, Key{prefix, highKey}, storage);
+        } else {
+            return SearchResult{0, 0, 0.0f, 0, {}};
+        }
+    }, info->tree);
+}
+
+SearchResult IndexManager::scan(Column first, double value, Column second, double lower, double upper) {
+    return scanWhere(storage, Predicate::allOf({Predicate::equal(first, value), Predicate::between(second, lower, upper)}));
+}
+
+AggregateResult IndexManager::aggregate(Column column, double lower, double upper, Column measure) {
+    IndexInfo* info = findIndexOn({column});
+    if (!info || info->measure != measure) {
+        return scanAggregate(column, lower, upper, measure);
+    }
+
+    return std::visit([&](auto& tree) {
+        using Key = typename std::decay_t<decltype(tree)>::KeyType;
+        if constexpr (IsCompositeKey<Key>::value) {
+            return AggregateResult{0, 0, 0.0, 0.0f};
+        } else {
+            Key lowKey, highKey;
+            if (!toKeyRange(lower, upper, lowKey, highKey)) {
+                return AggregateResult{0, 0, 0.0, 0.0f};
+            }
+            return tree.rangeAggregate(lowKey, highKey);
+        }
+    }, info->tree);
+}
+
+AggregateResult IndexManager::scanAggregate(Column column, double lower, double upper, Column measure) {
+    AggregateResult result = {0, 0, 0.0, 0.0f};
+
+    // Partial count and sum per morsel, with no record kept, added up in block order so the sum does not
+    // depend on which thread took which morsel
+    std::vector<std::pair<uint32_t, double>> partials(storage.morselCount());
+    storage.scanMorselBlocks(partials.size(), [&](size_t morsel, size_t firstBlock, size_t endBlock) {
+        auto& [count, sum] = partials[morsel];
+        ColumnValues values, measures;
+        std::vector<uint64_t> mask;
+        for (size_t datablockId = firstBlock; datablockId < endBlock; ++datablockId) {
+            // Filter on the column, then pack the measures that passed to the front and add those up
+            size_t slots = storage.readColumn(static_cast<uint16_t>(datablockId), column, values);
+            mask.resize(selectionWords(slots));
+            selectColumnRange(values, slots, {column, lower, upper}, mask.data());
+            storage.readColumn(static_cast<uint16_t>(datablockId), measure, measures);
+            if (isFloatColumn(measure)) {
+                size_t selected = compactValues(measures.floats.data(), mask.data(), slots, measures.floats.data());
+                count += selected;
+                sum = std::accumulate(measures.floats.begin(), measures.floats.begin() + selected, sum);
+            } else {
+                size_t selected = compactValues(measures.ints.data(), mask.data(), slots, measures.ints.data());
+                count += selected;
+                sum = std::accumulate(measures.ints.begin(), measures.ints.begin() + selected, sum);
+            }
+        }
+    });
+    for (const auto& [count, sum] : partials) {
+        result.count += count;
+        result.sum += sum;
+    }
+    if (result.count > 0) {
+        result.average = static_cast<float>(result.sum / result.count);
+    }
+    return result;
+}
+
+void IndexManager::loadCatalog() {
+    std::ifstream file(catalogFilename);
+    if (!file.is_open()) {
+        return;
+    }
+
+    std::string line;
+    while (std::getline(file, line)) {
+        std::istringstream iss(line);
+        std::string name, columns, indexFilename, measureName, payloadList;
+        if (!(iss >> name >> columns >> indexFilename)) continue;
+
+        std::optional<Column> measure;
+        if (iss >> measureName && measureName != "-") measure = parseColumn(measureName);
+        std::vector<Column> payload;
+        if (iss >> payloadList) payload = parseColumnList(payloadList);
+
+        IndexInfo info{name, parseColumnList(columns), measure, payload,
+                       makeColumnIndex(parseColumnList(columns), indexFilename, measure, payload)};
+        std::visit([&](auto& tree) {
+            if (std::filesystem::exists(indexFilename)) {
+                std::cout << "Loading B+ tree from index file " << indexFilename << "..." << std::endl;
+                tree.loadFromFile();
+            } else {
+                std::cout << "Index file " << indexFilename << " missing, rebuilding from storage..." << std::endl;
+                tree.buildFromStorage(storage);
+            }
+            tree.verifyTree();
+        }, info.tree);
+
+        indexes.emplace(name, std::move(info));
+    }
+}
+
+void IndexManager::saveCatalog() const {
+    std::ofstream file(catalogFilename, std::ios::trunc);
+    if (!file.is_open()) {
+        throw std::runtime_error("Unable to open index catalog for writing: " + catalogFilename);
+    }
+
+    for (const auto& [name, info] : indexes) {
+        std::visit([&](const auto& tree) {
+            file << name << " " << columnList(info.columns) << " " << tree.getIndexFilename();
+            if (info.measure || !info.payload.empty()) file << " " << (info.measure ? columnName(*info.measure) : "-");
+            if (!info.payload.empty()) file << " " << columnList(info.payload);
+            file << "\n";
+        }, info.tree);
+    }
+}
+
+void IndexManager::printStatistics() const {
+    std::cout << "------------------ Secondary Indexes -----------------" << std::endl;
+    std::cout << std::left << std::setw(16) << "Name" << std::setw(24) << "Columns"
+              << std::setw(8) << "Height" << std::setw(8) << "Nodes" << std::setw(16) << "Measure"
+              << std::setw(26) << "Covered" << std::setw(10) << "Bytes" << "File" << std::endl;
+    for (const auto& [name, info] : indexes) {
+        std::visit([&](const auto& tree) {
+            std::cout << std::left << std::setw(16) << name << std::setw(24) << columnList(info.columns)
+                      << std::setw(8) << tree.getTreeHeight() << std::setw(8) << tree.getNodeCounts()[2]
+                      << std::setw(16) << (info.measure ? columnName(*info.measure) : "-")
+                      << std::setw(26) << (info.payload.empty() ? "-" : columnList(info.payload))
+                      << std::setw(10) << (std::filesystem::exists(tree.getIndexFilename()) ? std::filesystem::file_size(tree.getIndexFilename()) : 0)
+                      << tree.getIndexFilename() << std::endl;
+        }, info.tree);
+    }
+    std::cout << std::right;
+    std::cout << "------------------------------------------------------" << std::endl;
+}
@@ -0,0 +1,374 @@
+#include "SimdFilter.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SIMD_FILTER_X86 1
+#include <immintrin.h>
+#else
+#define SIMD_FILTER_X86 0
+#endif
+
+namespace {
+// Highest level asked for; the kernels run with this or the detected level, whichever is lower
+std::atomic<int> requestedLevel{static_cast<int>(SimdLevel::AVX512)};
+
+// Tests values from..count one at a time: the whole scalar kernel, and the tail the vector kernels leave over
+template <typename T, typename Test>
+void selectScalar(const T* values, size_t from, size_t count, uint64_t* mask, Test test) {
+    for (size_t i = from; i < count; ++i) {
+        mask[i / 64] |= static_cast<uint64_t>(test(values[i]) ? 1 : 0) << (i % 64);
+    }
+}
+
+// Stores every value and moves the output on only past selected ones, so there is no branch to mispredict;
+// n never passes i, which is what makes compacting in place safe
+template <typename T, typename Load>
+size_t compactScalar(const uint64_t* mask, size_t from, size_t count, size_t n, T* out, Load load) {
+    for (size_t i = from; i < count; ++i) {
+        out[n] = load(i);
+        n += (mask[i / 64] >> (i % 64)) & 1;
+    }
+    return n;
+}
+
+#if SIMD_FILTER_X86
+// Positions 0..7 of the set bits of every byte, front-packed, for compacting eight 32-bit lanes with AVX2
+struct CompactionTable {
+    alignas(32) std::array<std::array<int32_t, 8>, 256> lanes{};
+
+    CompactionTable() {
+        for (int bits = 0; bits < 256; ++bits) {
+            int n = 0;
+            for (int lane = 0; lane < 8; ++lane) {
+                if (bits & (1 << lane)) lanes[bits][n++] = lane;
+            }
+        }
+    }
+};
+const CompactionTable compactionTable;
+
+// The vector kernels OR their bits into a zeroed mask and return how many values they covered, a multiple of
+// their width; 8 and 16 both divide 64, so a register's bits never straddle two words
+
+__attribute__((target("avx2"))) size_t rangeAvx2(const float* values, size_t count, float lower, float upper,
+                                                 uint64_t* mask) {
+    const __m256 low = _mm256_set1_ps(lower), high = _mm256_set1_ps(upper);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(values + i);
+        __m256 in = _mm256_and_ps(_mm256_cmp_ps(v, low, _CMP_GE_OQ), _mm256_cmp_ps(v, high, _CMP_LE_OQ));
+        mask[i / 64] |= static_cast<uint64_t>(_mm256_movemask_ps(in)) << (i % 64);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t rangeAvx2(const int32_t* values, size_t count, int32_t lower, int32_t upper,
+                                                 uint64_t* mask) {
+    const __m256i low = _mm256_set1_epi32(lower), high = _mm256_set1_epi32(upper);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        // AVX2 has only a greater-than for integers, so test for lying outside and invert
+        __m256i out = _mm256_or_si256(_mm256_cmpgt_epi32(low, v), _mm256_cmpgt_epi32(v, high));
+        uint64_t bits = ~_mm256_movemask_ps(_mm256_castsi256_ps(out)) & 0xFF;
+        mask[i / 64] |= bits << (i % 64);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t inAvx2(const float* values, size_t count, const float* set, size_t setSize,
+                                              uint64_t* mask) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(values + i);
+        __m256 in = _mm256_setzero_ps();
+        for (size_t s = 0; s < setSize; ++s) {
+            in = _mm256_or_ps(in, _mm256_cmp_ps(v, _mm256_set1_ps(set[s]), _CMP_EQ_OQ));
+        }
+        mask[i / 64] |= static_cast<uint64_t>(_mm256_movemask_ps(in)) << (i % 64);
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) size_t inAvx2(const int32_t* values, size_t count, const int32_t* set, size_t setSize,
+                                              uint64_t* mask) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(values + i));
+        __m256i in = _mm256_setzero_si256();
+        for (size_t s = 0; s < setSize; ++s) {
+            in = _mm256_or_si256(in, _mm256_cmpeq_epi32(v, _mm256_set1_epi32(set[s])));
+        }
+        mask[i / 64] |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_castsi256_ps(in))) << (i % 64);
+    }
+    return i;
+}
+
+// Compaction writes whole registers at the output position, which never passes the input position, so the
+// lanes past the selected ones land on values already read or on room the caller provided
+__attribute__((target("avx2"))) size_t compactSelectedAvx2(const uint64_t* mask, size_t count, uint32_t* out,
+                                                           size_t& n) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        if (i % 64 == 0 && i + 64 <= count && mask[i / 64] == 0) {
+            i += 56;
+            continue;
+        }
+        unsigned bits = (mask[i / 64] >> (i % 64)) & 0xFF;
+        __m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(compactionTable.lanes[bits].data()));
+        __m256i positions = _mm256_add_epi32(lanes, _mm256_set1_epi32(static_cast<int32_t>(i)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + n), positions);
+        n += std::bitset<8>(bits).count();
+    }
+    return i;
+}
+
+// 32-bit values of either type, moved as integers
+__attribute__((target("avx2"))) size_t compactValuesAvx2(const void* values, const uint64_t* mask, size_t count,
+                                                         void* out, size_t& n) {
+    const int32_t* in = static_cast<const int32_t*>(values);
+    int32_t* to = static_cast<int32_t*>(out);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        if (i % 64 == 0 && i + 64 <= count && mask[i / 64] == 0) {
+            i += 56;
+            continue;
+        }
+        unsigned bits = (mask[i / 64] >> (i % 64)) & 0xFF;
+        __m256i lanes = _mm256_load_si256(reinterpret_cast<const __m256i*>(compactionTable.lanes[bits].data()));
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(to + n), _mm256_permutevar8x32_epi32(v, lanes));
+        n += std::bitset<8>(bits).count();
+    }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t rangeAvx512(const float* values, size_t count, float lower, float upper,
+                                                     uint64_t* mask) {
+    const __m512 low = _mm512_set1_ps(lower), high = _mm512_set1_ps(upper);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 v = _mm512_loadu_ps(values + i);
+        __mmask16 in = _mm512_cmp_ps_mask(v, low, _CMP_GE_OQ) & _mm512_cmp_ps_mask(v, high, _CMP_LE_OQ);
+        mask[i / 64] |= static_cast<uint64_t>(in) << (i % 64);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t rangeAvx512(const int32_t* values, size_t count, int32_t lower,
+                                                     int32_t upper, uint64_t* mask) {
+    const __m512i low = _mm512_set1_epi32(lower), high = _mm512_set1_epi32(upper);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i v = _mm512_loadu_si512(values + i);
+        __mmask16 in = _mm512_cmpge_epi32_mask(v, low) & _mm512_cmple_epi32_mask(v, high);
+        mask[i / 64] |= static_cast<uint64_t>(in) << (i % 64);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t inAvx512(const float* values, size_t count, const float* set,
+                                                  size_t setSize, uint64_t* mask) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512 v = _mm512_loadu_ps(values + i);
+        __mmask16 in = 0;
+        for (size_t s = 0; s < setSize; ++s) {
+            in |= _mm512_cmp_ps_mask(v, _mm512_set1_ps(set[s]), _CMP_EQ_OQ);
+        }
+        mask[i / 64] |= static_cast<uint64_t>(in) << (i % 64);
+    }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t inAvx512(const int32_t* values, size_t count, const int32_t* set,
+                                                  size_t setSize, uint64_t* mask) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m512i v = _mm512_loadu_si512(values + i);
+        __mmask16 in = 0;
+        for (size_t s = 0; s < setSize; ++s) {
+            in |= _mm512_cmpeq_epi32_mask(v, _mm512_set1_epi32(set[s]));
+        }
+        mask[i / 64] |= static_cast<uint64_t>(in) << (i % 64);
+    }
+    return i;
+}
+
+// AVX-512 compresses in one instruction and stores only the selected lanes
+__attribute__((target("avx512f"))) size_t compactSelectedAvx512(const uint64_t* mask, size_t count, uint32_t* out,
+                                                               size_t& n) {
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __mmask16 bits = static_cast<__mmask16>(mask[i / 64] >> (i % 64));
+        if (bits == 0) continue;
+        __m512i positions = _mm512_add_epi32(lanes, _mm512_set1_epi32(static_cast<int32_t>(i)));
+        _mm512_mask_compressstoreu_epi32(out + n, bits, positions);
+        n += std::bitset<16>(bits).count();
+    }
+    return i;
+}
+
+__attribute__((target("avx512f"))) size_t compactValuesAvx512(const void* values, const uint64_t* mask, size_t count,
+                                                             void* out, size_t& n) {
+    const int32_t* in = static_cast<const int32_t*>(values);
+    int32_t* to = static_cast<int32_t*>(out);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __mmask16 bits = static_cast<__mmask16>(mask[i / 64] >> (i % 64));
+        if (bits == 0) continue;
+        _mm512_mask_compressstoreu_epi32(to + n, bits, _mm512_loadu_si512(in + i));
+        n += std::bitset<16>(bits).count();
+    }
+    return i;
+}
+#endif
+
+template <typename T>
+void selectRangeWith(const T* values, size_t count, T lower, T upper, uint64_t* mask) {
+    std::fill(mask, mask + selectionWords(count), 0);
+    size_t done = 0;
+#if SIMD_FILTER_X86
+    switch (activeSimdLevel()) {
+        case SimdLevel::AVX512: done = rangeAvx512(values, count, lower, upper, mask); break;
+        case SimdLevel::AVX2:   done = rangeAvx2(values, count, lower, upper, mask); break;
+        case SimdLevel::Scalar: break;
+    }
+#endif
+    selectScalar(values, done, count, mask, [&](T value) { return value >= lower && value <= upper; });
+}
+
+template <typename T>
+void selectInWith(const T* values, size_t count, const T* set, size_t setSize, uint64_t* mask) {
+    std::fill(mask, mask + selectionWords(count), 0);
+    size_t done = 0;
+#if SIMD_FILTER_X86
+    switch (activeSimdLevel()) {
+        case SimdLevel::AVX512: done = inAvx512(values, count, set, setSize, mask); break;
+        case SimdLevel::AVX2:   done = inAvx2(values, count, set, setSize, mask); break;
+        case SimdLevel::Scalar: break;
+    }
+#endif
+    selectScalar(values, done, count, mask, [&](T value) { return std::find(set, set + setSize, value) != set + setSize; });
+}
+
+template <typename T>
+size_t compactValuesWith(const T* values, const uint64_t* mask, size_t count, T* out) {
+    static_assert(sizeof(T) == sizeof(int32_t), "the vector kernels move 32-bit lanes");
+    size_t n = 0, done = 0;
+#if SIMD_FILTER_X86
+    switch (activeSimdLevel()) {
+        case SimdLevel::AVX512: done = compactValuesAvx512(values, mask, count, out, n); break;
+        case SimdLevel::AVX2:   done = compactValuesAvx2(values, mask, count, out, n); break;
+        case SimdLevel::Scalar: break;
+    }
+#endif
+    return compactScalar(mask, done, count, n, out, [values](size_t i) { return values[i]; });
+}
+}
+
+SimdLevel detectedSimdLevel() {
+#if SIMD_FILTER_X86
+    static const SimdLevel level = []() {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return SimdLevel::AVX512;
+        if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+        return SimdLevel::Scalar;
+    }();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel activeSimdLevel() {
+    return static_cast<SimdLevel>(std::min(requestedLevel.load(std::memory_order_relaxed),
+                                           static_cast<int>(detectedSimdLevel())));
+}
+
+void setSimdLevel(SimdLevel level) {
+    requestedLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+std::string simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Scalar: return "scalar";
+        case SimdLevel::AVX2:   return "AVX2";
+        case SimdLevel::AVX512: return "AVX-512";
+    }
+    return "unknown";
+}
+
+void selectRange(const float* values, size_t count, float lower, float upper, uint64_t* mask) {
+    selectRangeWith(values, count, lower, upper, mask);
+}
+
+void selectRange(const int32_t* values, size_t count, int32_t lower, int32_t upper, uint64_t* mask) {
+    selectRangeWith(values, count, lower, upper, mask);
+}
+
+// Equality is the range [value, value]; the second compare costs less than a kernel of its own would
+void selectEqual(const float* values, size_t count, float value, uint64_t* mask) {
+    selectRangeWith(values, count, value, value, mask);
+}
+
+void selectEqual(const int32_t* values, size_t count, int32_t value, uint64_t* mask) {
+    selectRangeWith(values, count, value, value, mask);
+}
+
+void selectIn(const float* values, size_t count, const float* set, size_t setSize, uint64_t* mask) {
+    selectInWith(values, count, set, setSize, mask);
+}
+
+void selectIn(const int32_t* values, size_t count, const int32_t* set, size_t setSize, uint64_t* mask) {
+    selectInWith(values, count, set, setSize, mask);
+}
+
+void selectAll(uint64_t* mask, size_t count) {
+    std::fill(mask, mask + selectionWords(count), ~uint64_t{0});
+    if (count % 64 != 0) mask[count / 64] = (uint64_t{1} << (count % 64)) - 1;
+}
+
+void intersectSelection(uint64_t* mask, const uint64_t* other, size_t count) {
+    for (size_t word = 0; word < selectionWords(count); ++word) {
+        mask[word] &= other[word];
+    }
+}
+
+void uniteSelection(uint64_t* mask, const uint64_t* other, size_t count) {
+    for (size_t word = 0; word < selectionWords(count); ++word) {
+        mask[word] |= other[word];
+    }
+}
+
+size_t countSelected(const uint64_t* mask, size_t count) {
+    size_t selected = 0;
+    for (size_t word = 0; word < selectionWords(count); ++word) {
+        selected += std::bitset<64>(mask[word]).count();
+    }
+    return selected;
+}
+
+size_t compactSelected(const uint64_t* mask, size_t count, uint32_t* out) {
+    size_t n = 0, done = 0;
+#if SIMD_FILTER_X86
+    switch (activeSimdLevel()) {
+        case SimdLevel::AVX512: done = compactSelectedAvx512(mask, count, out, n); break;
+        case SimdLevel::AVX2:   done = compactSelectedAvx2(mask, count, out, n); break;
+        case SimdLevel::Scalar: break;
+    }
+#endif
+    return compactScalar(mask, done, count, n, out, [](size_t i) { return static_cast<uint32_t>(i); });
+}
+
+size_t compactValues(const float* values, const uint64_t* mask, size_t count, float* out) {
+    return compactValuesWith(values, mask, count, out);
+}
+
+size_t compactValues(const int32_t* values, const uint64_t* mask, size_t count, int32_t* out) {
+    return compactValuesWith(values, mask, count, out);
+}
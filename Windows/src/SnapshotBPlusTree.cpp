@@ -0,0 +1,242 @@
+#include "SnapshotBPlusTree.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <unordered_set>
+
+namespace {
+// Slot numbers are shared by every epoch manager. A thread claims the first free one when it first needs one and
+// gives it back when it exits, so the limit is on threads alive at once, not on threads ever started.
+std::array<std::atomic<bool>, EpochManager::maxThreads> slotTaken{};
+
+struct SlotClaim {
+    int slot = -1;
+    ~SlotClaim() {
+        if (slot >= 0) slotTaken[slot].store(false, std::memory_order_release);
+    }
+};
+}
+
+int EpochManager::threadSlot() {
+    thread_local SlotClaim claim;
+    for (int slot = 0; claim.slot < 0 && slot < maxThreads; ++slot) {
+        bool taken = false;
+        if (slotTaken[slot].compare_exchange_strong(taken, true, std::memory_order_acquire)) claim.slot = slot;
+    }
+    if (claim.slot < 0) {
+        throw std::runtime_error("Too many reader threads for the epoch manager");
+    }
+    return claim.slot;
+}
+
+void EpochManager::enter() {
+    Slot& slot = slots[threadSlot()];
+    if (slot.depth++ == 0) {
+        // Sequentially consistent, so a writer that misses this announcement published its root before it
+        slot.epoch.store(globalEpoch.load());
+    }
+}
+
+void EpochManager::leave() {
+    Slot& slot = slots[threadSlot()];
+    if (--slot.depth == 0) {
+        slot.epoch.store(0, std::memory_order_release);
+    }
+}
+
+uint64_t EpochManager::oldestActive() const {
+    uint64_t oldest = globalEpoch.load();
+    for (const Slot& slot : slots) {
+        uint64_t epoch = slot.epoch.load();
+        if (epoch != 0) oldest = std::min(oldest, epoch);
+    }
+    return oldest;
+}
+
+template <typename Key, typename Value, int Order>
+SnapshotBPlusTree<Key, Value, Order>::Snapshot::Snapshot(Snapshot&& other) noexcept
+    : epochs(other.epochs), current(other.current) {
+    other.epochs = nullptr;
+}
+
+template <typename Key, typename Value, int Order>
+SnapshotBPlusTree<Key, Value, Order>::Snapshot::~Snapshot() {
+    if (epochs) epochs->leave();
+}
+
+template <typename Key, typename Value, int Order>
+std::vector<Value> SnapshotBPlusTree<Key, Value, Order>::Snapshot::rangeSearch(Key lower, Key upper) const {
+    std::vector<Value> result;
+    collect(current->root, {Codec::encode(lower), std::numeric_limits<Value>::lowest()},
+            {Codec::encode(upper), std::numeric_limits<Value>::max()}, result);
+    return result;
+}
+
+template <typename Key, typename Value, int Order>
+SnapshotBPlusTree<Key, Value, Order>::SnapshotBPlusTree() {
+    published.store(new Version{new Node(true), 0, 0});
+}
+
+template <typename Key, typename Value, int Order>
+SnapshotBPlusTree<Key, Value, Order>::~SnapshotBPlusTree() {
+    // No snapshot may outlive the tree, so everything can go
+    const Version* current = published.load();
+    freeTree(current->root);
+    delete current;
+    for (const auto& retired : limbo) {
+        delete retired.node;
+        delete retired.version;
+    }
+}
+
+template <typename Key, typename Value, int Order>
+typename SnapshotBPlusTree<Key, Value, Order>::Snapshot SnapshotBPlusTree<Key, Value, Order>::snapshot() const {
+    epochs.enter();
+    return Snapshot(&epochs, published.load());
+}
+
+template <typename Key, typename Value, int Order>
+void SnapshotBPlusTree<Key, Value, Order>::collect(const Node* node, const EntryKey& lower, const EntryKey& upper,
+                                                  std::vector<Value>& out) {
+    if (node->isLeaf) {
+        auto it = std::lower_bound(node->keys.begin(), node->keys.end(), lower);
+        for (; it != node->keys.end() && !(upper < *it); ++it) {
+            out.push_back(it->second);
+        }
+        return;
+    }
+    // Children first..last are the ones whose key ranges meet [lower, upper]
+    size_t first = std::upper_bound(node->keys.begin(), node->keys.end(), lower) - node->keys.begin();
+    size_t last = std::upper_bound(node->keys.begin(), node->keys.end(), upper) - node->keys.begin();
+    for (size_t i = first; i <= last; ++i) {
+        collect(node->children[i], lower, upper, out);
+    }
+}
+
+template <typename Key, typename Value, int Order>
+void SnapshotBPlusTree<Key, Value, Order>::insert(Key key, Value value) {
+    insertBatch({{key, value}});
+}
+
+template <typename Key, typename Value, int Order>
+void SnapshotBPlusTree<Key, Value, Order>::insertBatch(const std::vector<std::pair<Key, Value>>& entries) {
+    std::lock_guard<std::mutex> guard(writerMutex);
+    const Version* previous = published.load();
+
+    // Nodes copied for this version are private to the writer until it publishes, so they change in place
+    std::unordered_set<const Node*> fresh;
+    std::vector<const Node*> replaced;
+    auto writable = [&](const Node* node) {
+        if (fresh.count(node)) return const_cast<Node*>(node);
+        Node* copy = new Node(*node);
+        fresh.insert(copy);
+        replaced.push_back(node);
+        return copy;
+    };
+
+    Node* root = writable(previous->root);
+    size_t added = 0;
+    for (const auto& [rawKey, value] : entries) {
+        EntryKey entry{Codec::encode(rawKey), value};
+
+        // Copy the path down, pointing each copied parent at its copied child
+        std::vector<std::pair<Node*, size_t>> path;   // (inner node, child index taken)
+        Node* node = root;
+        while (!node->isLeaf) {
+            size_t index = std::upper_bound(node->keys.begin(), node->keys.end(), entry) - node->keys.begin();
+            Node* child = writable(node->children[index]);
+            node->children[index] = child;
+            path.emplace_back(node, index);
+            node = child;
+        }
+
+        auto position = std::lower_bound(node->keys.begin(), node->keys.end(), entry);
+        if (position != node->keys.end() && *position == entry) continue;   // the same pair is stored once
+        node->keys.insert(position, entry);
+        added++;
+
+        // Split upwards while a node overflows; every node on the path is already a private copy
+        while (node->keys.size() > static_cast<size_t>(Order - 1)) {
+            Node* sibling = new Node(node->isLeaf);
+            fresh.insert(sibling);
+            size_t mid = node->keys.size() / 2;
+            EntryKey separator = node->keys[mid];
+            if (node->isLeaf) {
+                sibling->keys.assign(node->keys.begin() + mid, node->keys.end());
+                node->keys.resize(mid);
+            } else {
+                sibling->keys.assign(node->keys.begin() + mid + 1, node->keys.end());
+                sibling->children.assign(node->children.begin() + mid + 1, node->children.end());
+                node->keys.resize(mid);
+                node->children.resize(mid + 1);
+            }
+
+            if (path.empty()) {
+                Node* newRoot = new Node(false);
+                fresh.insert(newRoot);
+                newRoot->keys = {separator};
+                newRoot->children = {node, sibling};
+                root = newRoot;
+                break;
+            }
+            auto [parent, index] = path.back();
+            path.pop_back();
+            parent->keys.insert(parent->keys.begin() + index, separator);
+            parent->children.insert(parent->children.begin() + index + 1, sibling);
+            node = parent;
+        }
+    }
+
+    // Readers switch to the new version with one store; the old path stays readable until their epochs pass
+    published.store(new Version{root, previous->number + 1, previous->entries + added});
+    uint64_t epoch = epochs.advance();
+    for (const Node* node : replaced) {
+        limbo.push_back({epoch, node, nullptr});
+    }
+    limbo.push_back({epoch, nullptr, previous});
+    retiredNodes += replaced.size();
+    reclaim();
+}
+
+template <typename Key, typename Value, int Order>
+void SnapshotBPlusTree<Key, Value, Order>::reclaimRetired() {
+    std::lock_guard<std::mutex> guard(writerMutex);
+    reclaim();
+}
+
+template <typename Key, typename Value, int Order>
+void SnapshotBPlusTree<Key, Value, Order>::reclaim() {
+    uint64_t oldest = epochs.oldestActive();
+    auto reclaimable = [oldest](const Retired& retired) { return retired.epoch < oldest; };
+    for (const auto& retired : limbo) {
+        if (!reclaimable(retired)) continue;
+        if (retired.node) reclaimedNodes++;
+        delete retired.node;
+        delete retired.version;
+    }
+    limbo.erase(std::remove_if(limbo.begin(), limbo.end(), reclaimable), limbo.end());
+}
+
+template <typename Key, typename Value, int Order>
+void SnapshotBPlusTree<Key, Value, Order>::freeTree(const Node* node) {
+    for (const Node* child : node->children) {
+        freeTree(child);
+    }
+    delete node;
+}
+
+template <typename Key, typename Value, int Order>
+int SnapshotBPlusTree<Key, Value, Order>::getTreeHeight() const {
+    Snapshot current = snapshot();
+    int height = 1;
+    for (const Node* node = current.current->root; !node->isLeaf; node = node->children.front()) {
+        height++;
+    }
+    return height;
+}
+
+// Compiled for the same key types as BPlusTree
+template class SnapshotBPlusTree<float, uint32_t>;
+template class SnapshotBPlusTree<int, uint32_t>;
+template class SnapshotBPlusTree<uint8_t, uint32_t>;
+template class SnapshotBPlusTree<CompositeKey<int, int>, uint32_t>;
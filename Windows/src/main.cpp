@@ -7,6 +7,14 @@
 #include <fstream>
 #include "Storage.h"
 #include "BPlusTree.h"
+#include "IndexManager.h"
+#include "Hardware.h"
+#include "ConcurrentBPlusTree.h"
+#include "SnapshotBPlusTree.h"
+#include "SimdFilter.h"
+#include "QueryEngine.h"
+#include "ThreadPool.h"
+#include <thread>
 #include <numeric>
 
 
@@ -20,35 +28,26 @@ void getAverage(SearchResult& result) {
     }
 }
 
-SearchResult linearSearch(Storage& storage, float lower, float upper) {
-    SearchResult result;
-    auto recordLocationsMap = storage.getRecordLocationsMap();
-    result.dataBlocksAccessed = recordLocationsMap.size();
-
-    std::vector<Record> resulting_records;
-
-    for (const auto& [datablockID, records] : recordLocationsMap) {
-        std::vector<uint16_t> recordIds;
-        for (const auto& [recordId, location] : records) {
-            recordIds.push_back(recordId);
-        }
-        
-        auto ingested_records = storage.bulkRead(recordIds);
-        
-        for (const auto& record : ingested_records) {
-            if (record.fgPctHome >= lower && record.fgPctHome <= upper) {
-                resulting_records.push_back(record);
-            }
-        }
-    }
-
-    result.numberOfResults = resulting_records.size();
-    result.found_records = resulting_records;
+// Full scan as a plan per morsel of blocks, the morsels claimed by the pool's threads: the scan reads the one
+// column of every block, the filter tests it with the SIMD kernels, and only the matches are read whole. Nothing
+// is pushed into the scan, so no zone map prunes a block: this is the brute-force baseline the indexes are
+// compared against (Task 19 shows the pruned scans)
+SearchResult linearSearch(Storage& storage, Column column, double lower, double upper) {
+    return collectMorsels(storage, [&](size_t firstBlock, size_t endBlock) -> OperatorPtr {
+        OperatorPtr scan = std::make_unique<Scan>(storage, std::vector<Column>{column}, firstBlock, endBlock);
+        return std::make_unique<Filter>(std::move(scan), ColumnRange{column, lower, upper});
+    });
+}
 
-    return result;
+// Date-range query over the gameDate index, dates given as dd/mm/yyyy (inclusive)
+SearchResult dateRangeSearch(GameDateIndex& dateIndex, const std::string& from, const std::string& to, Storage& storage) {
+    return dateIndex.rangeSearch(encodeGameDate(from), encodeGameDate(to), storage);
 }
 
-int main() {
+int main(int argc, char* argv[]) {
+    // Tasks 1-4 are the lab tasks; the benchmarks after them take minutes and only run when asked for
+    bool runBenchmarks = argc > 1 && std::string(argv[1]) == "--bench";
+
     try {
         // Task 1: Storage component
         Storage storage(DATABASE_FILENAME);
@@ -63,18 +62,18 @@ int main() {
         }
 
         // Task 2: B+ tree indexing
-        int order = 100; // Increased order for better performance
-        BPlusTree bTree(order, INDEX_FILENAME);
-
-        if (std::filesystem::exists(INDEX_FILENAME)) {
-            std::cout << "Loading B+ tree from index file..." << std::endl;
-            bTree.loadFromFile();
-            bTree.verifyTree();
-        } else {
-            std::cout << "Building B+ tree from storage..." << std::endl;
-            bTree.buildFromStorage(storage);
-            bTree.verifyTree();
+        IndexManager indexes(storage, INDEX_CATALOG_FILENAME);
+        indexes.ensureIndex("fg_pct_home", {Column::FgPctHome}, INDEX_FILENAME, Column::Fg3PctHome,
+                            {Column::Fg3PctHome, Column::TeamId});
+        indexes.ensureIndex("game_date", {Column::GameDate}, GAMEDATE_INDEX_FILENAME);
+        for (Column column : {Column::TeamId, Column::PtsHome, Column::FtPctHome,
+                              Column::Fg3PctHome, Column::AstHome, Column::RebHome}) {
+            indexes.ensureIndex(columnName(column), {column});
         }
+        indexes.ensureIndex("team_date", {Column::TeamId, Column::GameDate});
+
+        auto& bTree = indexes.getIndex<FgPctHomeIndex>("fg_pct_home");
+        auto& dateTree = indexes.getIndex<GameDateIndex>("game_date");
 
         // Task 3: Search and comparison
         float lower = 0.5f;
@@ -82,20 +81,112 @@ int main() {
         
         std::cout << "\nPerforming range search for " << lower << " <= FG_PCT_home <= " << upper << std::endl;
         
-        // B+ Tree search
+        // B+ Tree search, as a plan: the index range scan fetches a batch of records at a time in block order
         auto start = std::chrono::high_resolution_clock::now();
-        auto result = bTree.rangeSearch(lower, upper, storage);
+        auto result = Collect(std::make_unique<IndexRangeScan<float>>(bTree, lower, upper, storage)).run();
         auto end = std::chrono::high_resolution_clock::now();
         auto bpTreeDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
         getAverage(result);
+        // The plan must read no more blocks than the tree's own range search
+        SearchResult treeResult = bTree.rangeSearch(lower, upper, storage);
 
         // Linear search
         start = std::chrono::high_resolution_clock::now();
-        SearchResult linearResult = linearSearch(storage, lower, upper);
+        SearchResult linearResult = linearSearch(storage, Column::FgPctHome, lower, upper);
         getAverage(linearResult);
         end = std::chrono::high_resolution_clock::now();
         auto linearDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
 
+        // Same range streamed through a record cursor: the average in constant memory, and a LIMIT that stops early
+        start = std::chrono::high_resolution_clock::now();
+        auto streamCursor = bTree.openRecordCursor(lower, upper, storage);
+        double streamedTotal = 0.0;
+        int streamedCount = 0;
+        for (; streamCursor.valid(); streamCursor.next()) {
+            streamedTotal += streamCursor.record().fg3PctHome;
+            streamedCount++;
+        }
+        end = std::chrono::high_resolution_clock::now();
+        auto streamDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        const size_t limit = 5;
+        std::vector<Record> limitedRecords;
+        auto limitCursor = bTree.openRecordCursor(lower, upper, storage);
+        for (; limitCursor.valid() && limitedRecords.size() < limit; limitCursor.next()) {
+            limitedRecords.push_back(limitCursor.record());
+        }
+
+        // Best and worst shooting nights straight off the ends of the leaf chain
+        const size_t topCount = 10;
+        start = std::chrono::high_resolution_clock::now();
+        auto bestNights = bTree.topK(topCount, storage, true);
+        end = std::chrono::high_resolution_clock::now();
+        auto bestDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        auto worstNights = bTree.topK(topCount, storage, false);
+
+        // Same query answered from the covered fg3_pct_home values in the leaves
+        start = std::chrono::high_resolution_clock::now();
+        auto coveredResult = bTree.rangeSearchCovered(lower, upper);
+        getAverage(coveredResult);
+        end = std::chrono::high_resolution_clock::now();
+        auto coveredDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        // Same average from the subtree sums kept in the index, without reading any records
+        start = std::chrono::high_resolution_clock::now();
+        auto aggregateResult = bTree.rangeAggregate(lower, upper);
+        end = std::chrono::high_resolution_clock::now();
+        auto aggregateDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        // Season-window query on the gameDate index: 2021-22 regular season (Oct to Apr)
+        std::string seasonStart = "01/10/2021";
+        std::string seasonEnd = "30/04/2022";
+
+        start = std::chrono::high_resolution_clock::now();
+        auto seasonResult = dateRangeSearch(dateTree, seasonStart, seasonEnd, storage);
+        getAverage(seasonResult);
+        end = std::chrono::high_resolution_clock::now();
+        auto seasonDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        start = std::chrono::high_resolution_clock::now();
+        SearchResult seasonLinearResult = linearSearch(storage, Column::GameDate, encodeGameDate(seasonStart), encodeGameDate(seasonEnd));
+        getAverage(seasonLinearResult);
+        end = std::chrono::high_resolution_clock::now();
+        auto seasonLinearDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        // Per-team timeline: one team's home games in the same season window, via the (team_id, game_date) index
+        int timelineTeam = 1610612744;
+
+        start = std::chrono::high_resolution_clock::now();
+        auto timelineResult = indexes.rangeSearch(Column::TeamId, timelineTeam, Column::GameDate,
+                                                  encodeGameDate(seasonStart), encodeGameDate(seasonEnd));
+        getAverage(timelineResult);
+        end = std::chrono::high_resolution_clock::now();
+        auto timelineDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        // The brute-force baseline reads every block, so zone maps are off for it
+        storage.setZoneMapsEnabled(false);
+        start = std::chrono::high_resolution_clock::now();
+        auto timelineScanResult = indexes.scan(Column::TeamId, timelineTeam, Column::GameDate,
+                                               encodeGameDate(seasonStart), encodeGameDate(seasonEnd));
+        end = std::chrono::high_resolution_clock::now();
+        storage.setZoneMapsEnabled(true);
+        auto timelineScanDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        // Column filters through whichever secondary index covers the column
+        struct ColumnQuery {
+            Column column;
+            double lower;
+            double upper;
+        };
+        std::vector<ColumnQuery> columnQueries = {
+            {Column::TeamId, 1610612744, 1610612744},
+            {Column::PtsHome, 130, 200},
+            {Column::AstHome, 35, 255},
+            {Column::RebHome, 60, 255},
+            {Column::FtPctHome, 0.95, 1.0},
+            {Column::Fg3PctHome, 0.6, 1.0},
+        };
+
         // Task 1: Print Storage Statistics
         std::cout << "\n\n======================= Task 1 ====================== " << std::endl;
         storage.printStatistics();
@@ -121,8 +212,77 @@ int main() {
         std::cout << "Average FG3_PCT_home: " << linearResult.avgFG3PctHome << std::endl;
         std::cout << "Running time: " << linearDuration.count() << " microseconds" << std::endl;
         std::cout << "------------------------------------------------------" << std::endl;
+
+        std::cout << "\n-------------- B+ Tree Streaming Cursor --------------" << std::endl;
+        std::cout << "Number of index nodes accessed (internal, non-leaf node): " << streamCursor.indexNodesAccessed() << std::endl;
+        std::cout << "Number of data block reads: " << streamCursor.dataBlocksAccessed() << std::endl;
+        std::cout << "Number of results: " << streamedCount << std::endl;
+        std::cout << "Average FG3_PCT_home: " << (streamedCount ? streamedTotal / streamedCount : 0.0) << std::endl;
+        std::cout << "Running time: " << streamDuration.count() << " microseconds" << std::endl;
+        std::cout << "LIMIT " << limit << " (" << limitCursor.dataBlocksAccessed() << " data block reads):" << std::endl;
+        for (const auto& record : limitedRecords) {
+            std::cout << "  " << decodeGameDate(record.gameDate) << "  team " << record.teamId
+                      << "  FG_PCT_home " << record.fgPctHome << std::endl;
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        std::cout << "\n------------- Best / Worst Shooting Nights ------------" << std::endl;
+        std::cout << "ORDER BY FG_PCT_home DESC LIMIT " << topCount << " (" << bestNights.indexNodesAccessed
+                  << " index nodes, " << bestNights.dataBlocksAccessed << " data blocks, "
+                  << bestDuration.count() << " microseconds):" << std::endl;
+        for (const auto& record : bestNights.found_records) {
+            std::cout << "  " << decodeGameDate(record.gameDate) << "  team " << record.teamId
+                      << "  FG_PCT_home " << record.fgPctHome << std::endl;
+        }
+        std::cout << "ORDER BY FG_PCT_home ASC LIMIT " << topCount << ":" << std::endl;
+        for (const auto& record : worstNights.found_records) {
+            std::cout << "  " << decodeGameDate(record.gameDate) << "  team " << record.teamId
+                      << "  FG_PCT_home " << record.fgPctHome << std::endl;
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        std::cout << "\n------------ B+ Tree Covering Index Search -----------" << std::endl;
+        std::cout << "Number of index nodes accessed (internal, non-leaf node): " << coveredResult.indexNodesAccessed << std::endl;
+        std::cout << "Number of data blocks accessed: " << coveredResult.dataBlocksAccessed << std::endl;
+        std::cout << "Number of results: " << coveredResult.numberOfResults << std::endl;
+        std::cout << "Average FG3_PCT_home: " << coveredResult.avgFG3PctHome << std::endl;
+        std::cout << "Running time: " << coveredDuration.count() << " microseconds" << std::endl;
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        std::cout << "\n------------ B+ Tree Aggregate (index only) ----------" << std::endl;
+        std::cout << "Number of index nodes accessed (internal, non-leaf node): " << aggregateResult.indexNodesAccessed << std::endl;
+        std::cout << "Number of data blocks accessed: 0" << std::endl;
+        std::cout << "Number of results: " << aggregateResult.count << std::endl;
+        std::cout << "Average FG3_PCT_home: " << aggregateResult.average << std::endl;
+        std::cout << "Running time: " << aggregateDuration.count() << " microseconds" << std::endl;
+        std::cout << "------------------------------------------------------" << std::endl;
         std::cout << "======================================================\n\n" << std::endl;
 
+        std::cout << "\n======================= Task 4 ======================= " << std::endl;
+        std::cout << "------------ Season Window (gameDate index) -----------" << std::endl;
+        std::cout << "Games between " << seasonStart << " and " << seasonEnd << std::endl;
+        std::cout << "Number of index nodes accessed (internal, non-leaf node): " << seasonResult.indexNodesAccessed << std::endl;
+        std::cout << "Number of data blocks accessed: " << seasonResult.dataBlocksAccessed << std::endl;
+        std::cout << "Number of results: " << seasonResult.numberOfResults << std::endl;
+        std::cout << "Average FG3_PCT_home: " << seasonResult.avgFG3PctHome << std::endl;
+        std::cout << "Running time: " << seasonDuration.count() << " microseconds" << std::endl;
+        std::cout << "Linear scan: " << seasonLinearResult.numberOfResults << " results, "
+                  << seasonLinearResult.dataBlocksAccessed << " data blocks, "
+                  << seasonLinearDuration.count() << " microseconds" << std::endl;
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        std::cout << "------------ Team Timeline (team_id, game_date) ------" << std::endl;
+        std::cout << "Home games of team " << timelineTeam << " between " << seasonStart << " and " << seasonEnd << std::endl;
+        std::cout << "Number of index nodes accessed (internal, non-leaf node): " << timelineResult.indexNodesAccessed << std::endl;
+        std::cout << "Number of data blocks accessed: " << timelineResult.dataBlocksAccessed << std::endl;
+        std::cout << "Number of results: " << timelineResult.numberOfResults << std::endl;
+        std::cout << "Average FG3_PCT_home: " << timelineResult.avgFG3PctHome << std::endl;
+        std::cout << "Running time: " << timelineDuration.count() << " microseconds" << std::endl;
+        std::cout << "Linear scan: " << timelineScanResult.numberOfResults << " results, "
+                  << timelineScanResult.dataBlocksAccessed << " data blocks, "
+                  << timelineScanDuration.count() << " microseconds" << std::endl;
+        std::cout << "------------------------------------------------------" << std::endl;
+
         // Compare results
         if (result.numberOfResults != linearResult.numberOfResults) {
             std::cout << "\nWarning: Discrepancy in number of results!" << std::endl;
@@ -130,7 +290,838 @@ int main() {
         } else {
             std::cout << "\nNumber of results match between B+ Tree and Linear search." << std::endl;
         }
+        if (result.numberOfResults != treeResult.numberOfResults || result.dataBlocksAccessed != treeResult.dataBlocksAccessed) {
+            std::cout << "Warning: Discrepancy between the index plan and rangeSearch! Plan: " << result.numberOfResults
+                      << " results, " << result.dataBlocksAccessed << " blocks; rangeSearch: " << treeResult.numberOfResults
+                      << " results, " << treeResult.dataBlocksAccessed << " blocks" << std::endl;
+        }
+        if (streamedCount != linearResult.numberOfResults) {
+            std::cout << "Warning: Discrepancy in streamed results! Cursor: " << streamedCount
+                      << ", Linear: " << linearResult.numberOfResults << std::endl;
+        }
+        if (coveredResult.numberOfResults != linearResult.numberOfResults) {
+            std::cout << "Warning: Discrepancy in covering index results! Covered: " << coveredResult.numberOfResults
+                      << ", Linear: " << linearResult.numberOfResults << std::endl;
+        }
+        if (aggregateResult.count != static_cast<uint32_t>(linearResult.numberOfResults)) {
+            std::cout << "Warning: Discrepancy in aggregate count! B+ Tree aggregate: " << aggregateResult.count
+                      << ", Linear: " << linearResult.numberOfResults << std::endl;
+        }
+
+        if (!runBenchmarks) {
+            std::cout << "\nTasks 5-19 are benchmarks; run with --bench (or make bench) to include them." << std::endl;
+            return 0;
+        }
+
+        std::cout << "\n======================= Task 5 ======================= " << std::endl;
+        indexes.printStatistics();
+        std::cout << "---------------- Secondary Index Queries -------------" << std::endl;
+        for (const auto& query : columnQueries) {
+            start = std::chrono::high_resolution_clock::now();
+            auto indexResult = indexes.rangeSearch(query.column, query.lower, query.upper);
+            end = std::chrono::high_resolution_clock::now();
+            auto indexDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+            start = std::chrono::high_resolution_clock::now();
+            auto scanResult = indexes.scan(query.column, query.lower, query.upper);
+            end = std::chrono::high_resolution_clock::now();
+            auto scanDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+            std::cout << std::defaultfloat << std::setprecision(10) << query.lower << " <= " << columnName(query.column)
+                      << " <= " << query.upper << std::fixed << std::setprecision(6) << std::endl;
+            std::cout << "  Index: " << indexResult.numberOfResults << " results, "
+                      << indexResult.dataBlocksAccessed << " data blocks, "
+                      << indexDuration.count() << " microseconds" << std::endl;
+            std::cout << "  Scan:  " << scanResult.numberOfResults << " results, "
+                      << scanResult.dataBlocksAccessed << " data blocks, "
+                      << scanDuration.count() << " microseconds" << std::endl;
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 6: report-style workloads of many small probes, one call each vs one batch
+        std::cout << "\n======================= Task 6 ======================= " << std::endl;
+        std::cout << "------------------ Batched Lookups -------------------" << std::endl;
+        std::vector<std::pair<float, float>> fgRanges;
+        for (int i = 0; i < 2000; ++i) {
+            float from = 0.300f + static_cast<float>((i * 37) % 400) / 1000.0f;
+            fgRanges.emplace_back(from, from + 0.004f);
+        }
+        std::vector<int> gameDates;
+        for (int day = 0; day < 1000; ++day) {
+            gameDates.push_back(encodeGameDate(seasonStart) + (day * 7) % 365);
+        }
+
+        auto reportBatch = [](const std::string& label, size_t probes, long long loopResults, int loopBlocks,
+                              std::chrono::microseconds loopDuration, const BatchSearchResult& batch,
+                              std::chrono::microseconds batchDuration) {
+            long long batchResults = 0;
+            for (const auto& result : batch.results) batchResults += result.numberOfResults;
+            auto perSecond = [probes](std::chrono::microseconds duration) {
+                return duration.count() > 0 ? static_cast<long long>(probes * 1000000.0 / duration.count()) : 0;
+            };
+            std::cout << label << " (" << probes << " probes)" << std::endl;
+            std::cout << "  Per call: " << loopResults << " results, " << loopBlocks << " data block reads, "
+                      << loopDuration.count() << " microseconds, " << perSecond(loopDuration) << " probes/s" << std::endl;
+            std::cout << "  Batched:  " << batchResults << " results, " << batch.dataBlocksAccessed << " data block reads, "
+                      << batch.descents << " descents, " << batchDuration.count() << " microseconds, "
+                      << perSecond(batchDuration) << " probes/s" << std::endl;
+            if (batchResults != loopResults) {
+                std::cout << "  Warning: Discrepancy between batched and per-call results!" << std::endl;
+            }
+        };
+
+        {
+            long long loopResults = 0;
+            int loopBlocks = 0;
+            start = std::chrono::high_resolution_clock::now();
+            for (const auto& [from, to] : fgRanges) {
+                auto probe = bTree.rangeSearch(from, to, storage);
+                loopResults += probe.numberOfResults;
+                loopBlocks += probe.dataBlocksAccessed;
+            }
+            end = std::chrono::high_resolution_clock::now();
+            auto loopDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+            start = std::chrono::high_resolution_clock::now();
+            auto batch = bTree.rangeSearchBatch(fgRanges, storage);
+            end = std::chrono::high_resolution_clock::now();
+            reportBatch("FG_PCT_home ranges", fgRanges.size(), loopResults, loopBlocks, loopDuration, batch,
+                        std::chrono::duration_cast<std::chrono::microseconds>(end - start));
+        }
+        {
+            long long loopResults = 0;
+            int loopBlocks = 0;
+            start = std::chrono::high_resolution_clock::now();
+            for (int date : gameDates) {
+                auto probe = dateTree.rangeSearch(date, date, storage);
+                loopResults += probe.numberOfResults;
+                loopBlocks += probe.dataBlocksAccessed;
+            }
+            end = std::chrono::high_resolution_clock::now();
+            auto loopDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+            start = std::chrono::high_resolution_clock::now();
+            auto batch = dateTree.lookupBatch(gameDates, storage);
+            end = std::chrono::high_resolution_clock::now();
+            reportBatch("game_date point lookups", gameDates.size(), loopResults, loopBlocks, loopDuration, batch,
+                        std::chrono::duration_cast<std::chrono::microseconds>(end - start));
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 7: a nightly append of the newest games into a game_date index over the older ones,
+        // on scratch trees so the persisted indexes are left untouched
+        std::cout << "\n======================= Task 7 ======================= " << std::endl;
+        std::cout << "------------------ Batch Insertion -------------------" << std::endl;
+        std::vector<uint16_t> allRecordIds;
+        for (uint16_t recordId = 0; recordId < storage.getTotalRecords(); ++recordId) {
+            allRecordIds.push_back(recordId);
+        }
+        int unusedBlocks = 0;
+        std::vector<Record> allRecords = storage.bulkReadInBlockOrder(allRecordIds, unusedBlocks);
+        std::sort(allRecords.begin(), allRecords.end(), [](const Record& a, const Record& b) {
+            return a.gameDate < b.gameDate;
+        });
+        size_t historyCount = allRecords.size() - allRecords.size() / 10;
+        std::vector<Record> appended(allRecords.begin() + historyCount, allRecords.end());
+        std::vector<GameDateIndex::Entry> history;
+        for (size_t i = 0; i < historyCount; ++i) {
+            history.push_back({allRecords[i].gameDate, allRecords[i].recordId, 0.0, {}});
+        }
+
+        GameDateIndex perKeyTree("", gameDateKey);
+        GameDateIndex batchTree("", gameDateKey);
+        perKeyTree.bulkLoad(history);
+        batchTree.bulkLoad(std::move(history));
+
+        start = std::chrono::high_resolution_clock::now();
+        for (const auto& record : appended) {
+            perKeyTree.insertRecord(record);
+        }
+        end = std::chrono::high_resolution_clock::now();
+        auto perKeyDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        start = std::chrono::high_resolution_clock::now();
+        batchTree.insertRecords(appended);
+        end = std::chrono::high_resolution_clock::now();
+        auto batchDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+        auto everything = [](GameDateIndex& tree) {
+            return tree.rangeAggregate(std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max()).count;
+        };
+        std::cout << "Appended " << appended.size() << " records onto " << historyCount << std::endl;
+        std::cout << "  Per key: " << perKeyDuration.count() << " microseconds, tree height " << perKeyTree.getTreeHeight()
+                  << ", " << perKeyTree.getNodeCounts()[2] << " nodes, " << everything(perKeyTree) << " entries" << std::endl;
+        std::cout << "  Batched: " << batchDuration.count() << " microseconds, tree height " << batchTree.getTreeHeight()
+                  << ", " << batchTree.getNodeCounts()[2] << " nodes, " << everything(batchTree) << " entries" << std::endl;
+        batchTree.verifyTree();
+        if (everything(batchTree) != allRecords.size() || everything(perKeyTree) != allRecords.size()) {
+            std::cout << "  Warning: Discrepancy in entry count after insertion!" << std::endl;
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
 
+        // Task 8: point lookups on a synthetic index whose nodes far outgrow the last-level cache, one probe at
+        // a time against groups of probes descending in lockstep with prefetching
+        std::cout << "\n======================= Task 8 ======================= " << std::endl;
+        std::cout << "------------- Interleaved Point Lookups --------------" << std::endl;
+        const int syntheticKeys = 2000000;
+        const int lookupCount = 1000000;
+        BPlusTree<int, uint32_t> lookupTree("", gameDateKey);
+        {
+            // Values are real record ids, so range scans over the index also read data blocks
+            std::vector<BPlusTree<int, uint32_t>::Entry> synthetic;
+            synthetic.reserve(syntheticKeys);
+            for (int i = 0; i < syntheticKeys; ++i) {
+                uint32_t recordId = allRecordIds[static_cast<size_t>(i) * 7919 % allRecordIds.size()];
+                synthetic.push_back({i * 2, recordId, 0.0, {}});
+            }
+            lookupTree.bulkLoad(std::move(synthetic));
+        }
+        // Uniform over twice the key range, so about half the probes miss
+        std::vector<int> lookupKeys(lookupCount);
+        uint32_t state = 12345;
+        for (int& key : lookupKeys) {
+            state = state * 1664525u + 1013904223u;
+            key = static_cast<int>(state % (2u * syntheticKeys));
+        }
+        auto perSecond = [](size_t lookups, std::chrono::microseconds duration) {
+            return duration.count() > 0 ? static_cast<long long>(lookups * 1000000.0 / duration.count()) : 0;
+        };
+        std::cout << syntheticKeys << " keys, height " << lookupTree.getTreeHeight() << ", "
+                  << lookupTree.getNodeCounts()[1] << " leaves, " << lookupCount << " lookups" << std::endl;
+
+        long long sequentialHits = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for (int key : lookupKeys) {
+            sequentialHits += lookupTree.count(key);
+        }
+        end = std::chrono::high_resolution_clock::now();
+        auto sequentialDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+        std::cout << "  Sequential:        " << sequentialHits << " hits, " << sequentialDuration.count()
+                  << " microseconds, " << perSecond(lookupCount, sequentialDuration) << " lookups/s" << std::endl;
+
+        for (size_t groupSize : {4, 8, 16, 32}) {
+            start = std::chrono::high_resolution_clock::now();
+            auto counts = lookupTree.countBatch(lookupKeys, groupSize);
+            end = std::chrono::high_resolution_clock::now();
+            auto groupDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+            long long hits = std::accumulate(counts.begin(), counts.end(), 0LL);
+            std::cout << "  Groups of " << std::setw(2) << groupSize << ":      " << hits
+                      << " hits, " << groupDuration.count() << " microseconds, " << perSecond(lookupCount, groupDuration)
+                      << " lookups/s" << std::endl;
+            if (hits != sequentialHits) {
+                std::cout << "  Warning: Discrepancy between interleaved and sequential lookups!" << std::endl;
+            }
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 9: range scans over the synthetic index at increasing prefetch distances; each distance scans
+        // its own stretch of keys, so no run finds leaves left in cache by an earlier one
+        std::cout << "\n======================= Task 9 ======================= " << std::endl;
+        std::cout << "--------------- Prefetching Range Scans --------------" << std::endl;
+        const std::vector<int> prefetchDistances = {0, 1, 2, 4, 8, 16};
+        int savedTreeDistance = lookupTree.getPrefetchDistance();
+        size_t savedStorageDistance = storage.getPrefetchDistance();
+        const int scansPerDistance = 10;
+        const int scanWidth = 2 * 10000;   // keys are even, so 10000 entries per scan
+        const int scanStride = 2 * syntheticKeys / static_cast<int>(prefetchDistances.size() * scansPerDistance);
+        PerfCounters counters;
+        std::cout << scansPerDistance << " scans of " << scanWidth / 2 << " entries per distance" << std::endl;
+        if (!counters.available()) std::cout << "(" << counters.summary() << ")" << std::endl;
+        for (size_t run = 0; run < prefetchDistances.size(); ++run) {
+            int distance = prefetchDistances[run];
+            lookupTree.setPrefetchDistance(distance);
+            storage.setPrefetchDistance(distance);
+            long long scanned = 0;
+            counters.start();
+            start = std::chrono::high_resolution_clock::now();
+            for (int scan = 0; scan < scansPerDistance; ++scan) {
+                int from = static_cast<int>(run * scansPerDistance + scan) * scanStride;
+                scanned += lookupTree.rangeSearch(from, from + scanWidth - 1, storage).numberOfResults;
+            }
+            end = std::chrono::high_resolution_clock::now();
+            counters.stop();
+            std::cout << "  Distance " << std::setw(2) << distance << ": " << scanned << " entries, "
+                      << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " microseconds";
+            if (counters.available()) std::cout << ", " << counters.summary();
+            std::cout << std::endl;
+            if (scanned != static_cast<long long>(scansPerDistance) * scanWidth / 2) {
+                std::cout << "  Warning: Discrepancy in scanned entries!" << std::endl;
+            }
+        }
+        lookupTree.setPrefetchDistance(savedTreeDistance);
+        storage.setPrefetchDistance(savedStorageDistance);
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 10: game_date range searches served while new games are inserted, on a concurrent index
+        // preloaded with every game; the same total work is split over more and more threads
+        std::cout << "\n======================= Task 10 ====================== " << std::endl;
+        std::cout << "------------- Concurrent Search and Insert -----------" << std::endl;
+        const int concurrentOps = 100000;
+        const int firstDate = allRecords.front().gameDate;
+        const int dateSpan = allRecords.back().gameDate - firstDate + 1;
+        std::cout << concurrentOps << " operations per run, 4 in 5 a 7-day range search, 1 in 5 an insert, on "
+                  << std::thread::hardware_concurrency() << " hardware threads" << std::endl;
+        for (int threads : {1, 2, 4, 8, 16, 32, 64}) {
+            ConcurrentBPlusTree<int, uint32_t> concurrentTree;
+            for (const auto& record : allRecords) {
+                concurrentTree.insert(record.gameDate, record.recordId);
+            }
+
+            const int opsPerThread = concurrentOps / threads;
+            std::atomic<long long> searched{0};
+            std::atomic<int> inserted{0};
+            std::vector<std::thread> workers;
+            start = std::chrono::high_resolution_clock::now();
+            for (int t = 0; t < threads; ++t) {
+                workers.emplace_back([&, t]() {
+                    uint32_t state = 2654435761u * (t + 1);
+                    long long found = 0;
+                    int added = 0;
+                    for (int i = 0; i < opsPerThread; ++i) {
+                        state = state * 1664525u + 1013904223u;
+                        int date = firstDate + static_cast<int>((state >> 8) % dateSpan);
+                        if (state % 5 == 0) {
+                            // Ids past any stored record, unique per thread and operation
+                            concurrentTree.insert(date, static_cast<uint32_t>(100000 + t * opsPerThread + i));
+                            added++;
+                        } else {
+                            found += concurrentTree.rangeSearch(date, date + 6).size();
+                        }
+                    }
+                    searched += found;
+                    inserted += added;
+                });
+            }
+            for (auto& worker : workers) worker.join();
+            end = std::chrono::high_resolution_clock::now();
+            auto concurrentDuration = std::chrono::duration_cast<std::chrono::microseconds>(end - start);
+
+            long long totalOps = static_cast<long long>(opsPerThread) * threads;
+            std::cout << "  " << std::setw(2) << threads << " threads: " << concurrentDuration.count() << " microseconds, "
+                      << (concurrentDuration.count() > 0 ? totalOps * 1000000 / concurrentDuration.count() : 0)
+                      << " ops/s, " << inserted << " inserts, " << searched << " entries found" << std::endl;
+            if (concurrentTree.size() != allRecords.size() + static_cast<size_t>(inserted)) {
+                std::cout << "  Warning: Discrepancy in concurrent tree size!" << std::endl;
+            }
+            if (threads == 64) concurrentTree.verifyTree();
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 11: analytics readers scanning whole snapshots of a game_date index while the newest games
+        // arrive in nightly batches, each batch published as a new version
+        std::cout << "\n======================= Task 11 ====================== " << std::endl;
+        std::cout << "------------- Snapshot Scans During Ingest -----------" << std::endl;
+        SnapshotBPlusTree<int, uint32_t> snapshotTree;
+        {
+            std::vector<std::pair<int, uint32_t>> preload;
+            for (size_t i = 0; i < historyCount; ++i) {
+                preload.emplace_back(allRecords[i].gameDate, allRecords[i].recordId);
+            }
+            snapshotTree.insertBatch(preload);
+        }
+
+        const int snapshotReaders = 2;
+        const size_t nightlyBatch = 100;
+        std::atomic<bool> ingesting{true};
+        std::atomic<int> snapshotScans{0};
+        std::atomic<int> inconsistentScans{0};
+        std::vector<std::thread> readers;
+        for (int r = 0; r < snapshotReaders; ++r) {
+            readers.emplace_back([&]() {
+                while (ingesting) {
+                    auto snapshot = snapshotTree.snapshot();
+                    auto scanned = snapshot.rangeSearch(std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max());
+                    if (scanned.size() != snapshot.size()) inconsistentScans++;
+                    snapshotScans++;
+                }
+            });
+        }
+
+        long long slowestBatch = 0;
+        start = std::chrono::high_resolution_clock::now();
+        for (size_t from = 0; from < appended.size(); from += nightlyBatch) {
+            std::vector<std::pair<int, uint32_t>> batch;
+            for (size_t i = from; i < std::min(from + nightlyBatch, appended.size()); ++i) {
+                batch.emplace_back(appended[i].gameDate, appended[i].recordId);
+            }
+            auto batchStart = std::chrono::high_resolution_clock::now();
+            snapshotTree.insertBatch(batch);
+            auto batchEnd = std::chrono::high_resolution_clock::now();
+            slowestBatch = std::max<long long>(slowestBatch,
+                std::chrono::duration_cast<std::chrono::microseconds>(batchEnd - batchStart).count());
+        }
+        end = std::chrono::high_resolution_clock::now();
+        ingesting = false;
+        for (auto& reader : readers) reader.join();
+        size_t reclaimedDuringIngest = snapshotTree.getReclaimedNodes();
+        snapshotTree.reclaimRetired();
+
+        auto finalSnapshot = snapshotTree.snapshot();
+        std::cout << appended.size() << " records in batches of " << nightlyBatch << " onto " << historyCount
+                  << ", " << snapshotReaders << " readers scanning whole snapshots" << std::endl;
+        std::cout << "  Ingest: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()
+                  << " microseconds, slowest batch " << slowestBatch << " microseconds, version "
+                  << finalSnapshot.version() << ", tree height " << snapshotTree.getTreeHeight() << std::endl;
+        std::cout << "  Scans:  " << snapshotScans << " full scans completed during ingest" << std::endl;
+        std::cout << "  Nodes:  " << snapshotTree.getRetiredNodes() << " copied away and retired, "
+                  << reclaimedDuringIngest << " reclaimed while readers ran, " << snapshotTree.getReclaimedNodes()
+                  << " once they finished" << std::endl;
+        if (inconsistentScans > 0 || finalSnapshot.size() != allRecords.size()) {
+            std::cout << "  Warning: Discrepancy in snapshot contents!" << std::endl;
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 12: many threads reading records out of the shared storage at once, then readers alongside a
+        // writer appending to a scratch storage so the persisted database is left untouched
+        std::cout << "\n======================= Task 12 ====================== " << std::endl;
+        std::cout << "--------------- Concurrent Storage Reads -------------" << std::endl;
+        long long expectedIdSum = std::accumulate(allRecordIds.begin(), allRecordIds.end(), 0LL);
+        for (int threadCount : {1, 2, 4, 8}) {
+            std::atomic<long long> idSum{0};
+            std::atomic<int> wrongRecords{0};
+            std::vector<std::thread> workers;
+            start = std::chrono::high_resolution_clock::now();
+            for (int t = 0; t < threadCount; ++t) {
+                workers.emplace_back([&, t]() {
+                    long long localSum = 0;
+                    for (size_t i = t; i < allRecordIds.size(); i += threadCount) {
+                        Record record = storage.getRecord(allRecordIds[i]);
+                        if (record.recordId != allRecordIds[i]) wrongRecords++;
+                        localSum += record.recordId;
+                    }
+                    idSum += localSum;
+                });
+            }
+            for (auto& worker : workers) worker.join();
+            end = std::chrono::high_resolution_clock::now();
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+            std::cout << std::setw(2) << threadCount << " threads: " << allRecordIds.size() << " point reads in "
+                      << elapsed << " microseconds (" << std::fixed << std::setprecision(0)
+                      << allRecordIds.size() * 1e6 / std::max<long long>(elapsed, 1) << " reads/s)" << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            if (idSum != expectedIdSum || wrongRecords > 0) {
+                std::cout << "  Warning: Discrepancy in concurrent reads!" << std::endl;
+            }
+        }
+
+        {
+            std::string scratchFile = (std::filesystem::temp_directory_path() / "task12_storage.db").string();
+            std::filesystem::remove(scratchFile);
+            Storage scratch(scratchFile);
+            const size_t scratchRecords = 2 * MAX_RECORDS_PER_BLOCK + 7;
+            std::atomic<bool> appending{true};
+            std::atomic<int> concurrentReads{0};
+            std::atomic<int> wrongRecords{0};
+            std::vector<std::thread> scratchReaders;
+            for (int r = 0; r < 2; ++r) {
+                scratchReaders.emplace_back([&, r]() {
+                    while (appending) {
+                        size_t visible = scratch.getTotalRecords();
+                        for (size_t id = r; id < visible; id += 2) {
+                            if (scratch.getRecord(static_cast<uint16_t>(id)).recordId != id) wrongRecords++;
+                            concurrentReads++;
+                        }
+                        std::this_thread::yield();
+                    }
+                });
+            }
+            // The first half goes in a record at a time, the rest as one batch that writes its pages once
+            std::vector<Record> appendBatch;
+            for (size_t i = 0; i < scratchRecords; ++i) {
+                Record record = allRecords[i % allRecords.size()];
+                if (i < scratchRecords / 2) {
+                    scratch.insertRecord(record);
+                } else {
+                    appendBatch.push_back(record);
+                }
+            }
+            scratch.insertRecords(appendBatch);
+            appending = false;
+            for (auto& reader : scratchReaders) reader.join();
+
+            int scratchBlocks = 0;
+            std::vector<uint16_t> scratchIds(scratch.getTotalRecords());
+            std::iota(scratchIds.begin(), scratchIds.end(), 0);
+            size_t readBack = scratch.bulkReadInBlockOrder(scratchIds, scratchBlocks).size();
+            std::cout << "Scratch storage: " << scratchRecords << " appends into " << scratch.getDatablockCount()
+                      << " blocks while 2 readers made " << concurrentReads << " reads" << std::endl;
+            if (wrongRecords > 0 || readBack != scratchRecords || scratchBlocks != scratch.getDatablockCount()) {
+                std::cout << "  Warning: Discrepancy in reads during appends!" << std::endl;
+            }
+            // Each append wrote only the pages it changed, so the file must read back as the whole table
+            Storage reloaded(scratchFile);
+            reloaded.loadDatablocks();
+            Record lastAppended = scratch.getRecord(static_cast<uint16_t>(scratchRecords - 1));
+            if (reloaded.getTotalRecords() != scratchRecords || reloaded.getDatablockCount() != scratch.getDatablockCount()
+                || reloaded.getRecord(static_cast<uint16_t>(scratchRecords - 1)).gameDate != lastAppended.gameDate) {
+                std::cout << "  Warning: Discrepancy in the database file after appends!" << std::endl;
+            }
+            std::filesystem::remove(scratchFile);
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 13: ingest, reload, index build and full scan on the shared work-stealing pool at several sizes,
+        // ingesting into a scratch database so the persisted one is left untouched
+        std::cout << "\n======================= Task 13 ====================== " << std::endl;
+        std::cout << "------------------- Parallel Phases ------------------" << std::endl;
+        ThreadPool& pool = ThreadPool::shared();
+        size_t defaultThreads = pool.threadCount();
+        std::string parallelFile = (std::filesystem::temp_directory_path() / "task13_storage.db").string();
+        auto microsecondsSince = [](std::chrono::high_resolution_clock::time_point from) {
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - from).count();
+        };
+        std::cout << "Threads   Ingest (us)   Load (us)   Build (us)   Scan (us)" << std::endl;
+        for (size_t threads : {1, 2, 4, 8}) {
+            pool.resize(threads);
+            pool.resetStats();
+
+            std::filesystem::remove(parallelFile);
+            auto phaseStart = std::chrono::high_resolution_clock::now();
+            {
+                Storage ingested(parallelFile);
+                ingested.ingestData(DATA_FILENAME);
+            }
+            auto ingestTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            Storage loaded(parallelFile);
+            loaded.loadDatablocks();
+            auto loadTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            std::vector<GameDateIndex::Entry> buildEntries;
+            for (const auto& record : loaded.getAllRecords()) {
+                buildEntries.push_back({record.gameDate, record.recordId, 0.0, {}});
+            }
+            GameDateIndex parallelTree("", gameDateKey);
+            parallelTree.bulkLoad(std::move(buildEntries));
+            auto buildTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            SearchResult parallelScan = linearSearch(loaded, Column::FgPctHome, lower, upper);
+            auto scanTime = microsecondsSince(phaseStart);
+
+            std::cout << std::setw(7) << threads << std::setw(14) << ingestTime << std::setw(12) << loadTime
+                      << std::setw(13) << buildTime << std::setw(12) << scanTime << std::endl;
+            if (loaded.getTotalRecords() != storage.getTotalRecords()
+                || parallelTree.rangeAggregate(std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max()).count != storage.getTotalRecords()
+                || parallelScan.numberOfResults != linearResult.numberOfResults) {
+                std::cout << "  Warning: Discrepancy in parallel results!" << std::endl;
+            }
+        }
+        std::cout << "Per-task timings at " << pool.threadCount() << " threads:" << std::endl;
+        pool.printStats();
+        pool.resize(defaultThreads);
+        std::filesystem::remove(parallelFile);
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 14: full-table scans with the same filter and AVG, morsels of blocks claimed by 1 to 8 threads
+        std::cout << "\n======================= Task 14 ====================== " << std::endl;
+        std::cout << "---------------- Morsel-Driven Scans -----------------" << std::endl;
+        std::cout << "Threads   Scan (us)   AVG (us)   Matches   AVG(FG3_PCT_home)" << std::endl;
+        AggregateResult serialAggregate{0, 0, 0.0, 0.0f};
+        for (size_t threads : {1, 2, 4, 8}) {
+            pool.resize(threads);
+            auto phaseStart = std::chrono::high_resolution_clock::now();
+            SearchResult morselScan = indexes.scan(Column::FgPctHome, lower, upper);
+            auto scanTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            AggregateResult morselAggregate = indexes.scanAggregate(Column::FgPctHome, lower, upper, Column::Fg3PctHome);
+            auto aggregateTime = microsecondsSince(phaseStart);
+            if (threads == 1) serialAggregate = morselAggregate;
+
+            std::cout << std::setw(7) << threads << std::setw(12) << scanTime << std::setw(11) << aggregateTime
+                      << std::setw(10) << morselAggregate.count << std::setw(20) << morselAggregate.average << std::endl;
+            if (morselScan.numberOfResults != linearResult.numberOfResults
+                || morselAggregate.count != static_cast<uint32_t>(linearResult.numberOfResults)
+                || morselAggregate.sum != serialAggregate.sum) {
+                std::cout << "  Warning: Discrepancy in morsel scan results!" << std::endl;
+            }
+        }
+        std::cout << storage.morselCount() << " morsels of up to 8 blocks; partial sums are combined in block order, "
+                  << "so every thread count gives the same AVG" << std::endl;
+        pool.resize(defaultThreads);
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 15: the wide FG_PCT_home range split into sub-ranges walked and fetched on separate threads
+        std::cout << "\n======================= Task 15 ====================== " << std::endl;
+        std::cout << "---------------- Parallel Range Search ---------------" << std::endl;
+        std::cout << "Threads   Serial (us)   Parallel (us)   Key-ordered (us)   Blocks" << std::endl;
+        for (size_t threads : {1, 2, 4, 8}) {
+            pool.resize(threads);
+            auto phaseStart = std::chrono::high_resolution_clock::now();
+            SearchResult serialRange = bTree.rangeSearch(lower, upper, storage);
+            auto serialTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            SearchResult parallelRange = bTree.rangeSearchParallel(lower, upper, storage);
+            auto parallelTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            SearchResult orderedRange = bTree.rangeSearchParallel(lower, upper, storage, true);
+            auto orderedTime = microsecondsSince(phaseStart);
+
+            std::cout << std::setw(7) << threads << std::setw(14) << serialTime << std::setw(16) << parallelTime
+                      << std::setw(19) << orderedTime << std::setw(9) << parallelRange.dataBlocksAccessed << std::endl;
+            bool inKeyOrder = std::is_sorted(orderedRange.found_records.begin(), orderedRange.found_records.end(),
+                                             [](const Record& a, const Record& b) { return a.fgPctHome < b.fgPctHome; });
+            if (parallelRange.numberOfResults != serialRange.numberOfResults
+                || orderedRange.numberOfResults != serialRange.numberOfResults || !inKeyOrder) {
+                std::cout << "  Warning: Discrepancy in parallel range search results!" << std::endl;
+            }
+        }
+        pool.resize(defaultThreads);
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 16: bottom-up bulk build of a synthetic index, grouping, leaves and every inner level split across
+        // 1 to 8 threads; each build must come out node for node the same
+        std::cout << "\n======================= Task 16 ====================== " << std::endl;
+        std::cout << "--------------- Parallel Bulk Building ---------------" << std::endl;
+        const int buildEntryCount = 500000;
+        std::vector<BPlusTree<int, uint32_t>::Entry> buildSource;
+        buildSource.reserve(buildEntryCount);
+        for (int i = 0; i < buildEntryCount; ++i) {
+            // About four entries per key, in no particular order
+            buildSource.push_back({static_cast<int>(static_cast<uint32_t>(i) * 2654435761u % (buildEntryCount / 4)),
+                                   allRecordIds[static_cast<size_t>(i) % allRecordIds.size()], 1.0, {}});
+        }
+        std::cout << "Threads   Build (us)   Height   Nodes" << std::endl;
+        std::vector<int> serialNodeCounts;
+        for (size_t threads : {1, 2, 4, 8}) {
+            pool.resize(threads);
+            BPlusTree<int, uint32_t> builtTree("", gameDateKey);
+            auto phaseStart = std::chrono::high_resolution_clock::now();
+            builtTree.bulkLoad(buildSource);
+            auto buildTime = microsecondsSince(phaseStart);
+
+            std::vector<int> nodeCounts = builtTree.getNodeCounts();
+            if (threads == 1) serialNodeCounts = nodeCounts;
+            std::cout << std::setw(7) << threads << std::setw(13) << buildTime << std::setw(9) << builtTree.getTreeHeight()
+                      << std::setw(8) << nodeCounts[2] << std::endl;
+            if (nodeCounts != serialNodeCounts
+                || builtTree.rangeAggregate(std::numeric_limits<int>::lowest(), std::numeric_limits<int>::max()).count
+                   != static_cast<uint32_t>(buildEntryCount)) {
+                std::cout << "  Warning: Discrepancy in parallel build results!" << std::endl;
+            }
+        }
+        pool.resize(defaultThreads);
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 17: the scan filter run by the scalar, AVX2 and AVX-512 kernels, as far as this CPU goes, on the
+        // table and on one large synthetic column
+        std::cout << "\n======================= Task 17 ====================== " << std::endl;
+        std::cout << "---------------- SIMD Filter Kernels -----------------" << std::endl;
+        const SimdLevel detectedLevel = detectedSimdLevel();
+        std::cout << "Kernels available up to " << simdLevelName(detectedLevel) << std::endl;
+        std::vector<float> syntheticColumn(1 << 24);
+        for (size_t i = 0; i < syntheticColumn.size(); ++i) {
+            syntheticColumn[i] = static_cast<float>(static_cast<uint32_t>(i) * 2654435761u % 1000) / 1000.0f;
+        }
+        std::vector<uint64_t> syntheticMask(selectionWords(syntheticColumn.size()));
+        std::vector<float> syntheticMatches(syntheticColumn.size());
+
+        // IN and equality together: home wins of three teams, counted block by block from the raw columns
+        std::vector<int32_t> teams;
+        for (const auto& record : storage.getAllRecords()) {
+            if (std::find(teams.begin(), teams.end(), record.teamId) == teams.end()) teams.push_back(record.teamId);
+            if (teams.size() == 3) break;
+        }
+        size_t expectedWins = 0;
+        for (const auto& record : storage.getAllRecords()) {
+            if (record.homeTeamWins && std::find(teams.begin(), teams.end(), record.teamId) != teams.end()) expectedWins++;
+        }
+
+        std::cout << "Kernels   Scan (us)   AVG (us)   Column (us)   Column (GB/s)   Wins of 3 teams" << std::endl;
+        size_t syntheticSelected = 0;
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::AVX2, SimdLevel::AVX512}) {
+            if (level > detectedLevel) break;
+            setSimdLevel(level);
+            auto phaseStart = std::chrono::high_resolution_clock::now();
+            SearchResult kernelScan = linearSearch(storage, Column::FgPctHome, lower, upper);
+            auto scanTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            AggregateResult kernelAggregate = indexes.scanAggregate(Column::FgPctHome, lower, upper, Column::Fg3PctHome);
+            auto aggregateTime = microsecondsSince(phaseStart);
+
+            phaseStart = std::chrono::high_resolution_clock::now();
+            selectRange(syntheticColumn.data(), syntheticColumn.size(), lower, upper, syntheticMask.data());
+            size_t selected = compactValues(syntheticColumn.data(), syntheticMask.data(), syntheticColumn.size(),
+                                            syntheticMatches.data());
+            auto columnTime = microsecondsSince(phaseStart);
+            if (level == SimdLevel::Scalar) syntheticSelected = selected;
+
+            size_t wins = 0;
+            ColumnValues teamValues, winValues;
+            std::vector<uint64_t> teamMask, winMask;
+            for (uint16_t datablockId = 0; datablockId < storage.getDatablockCount(); ++datablockId) {
+                size_t slots = storage.readColumn(datablockId, Column::TeamId, teamValues);
+                storage.readColumn(datablockId, Column::HomeTeamWins, winValues);
+                teamMask.resize(selectionWords(slots));
+                winMask.resize(selectionWords(slots));
+                selectIn(teamValues.ints.data(), slots, teams.data(), teams.size(), teamMask.data());
+                selectEqual(winValues.ints.data(), slots, 1, winMask.data());
+                intersectSelection(teamMask.data(), winMask.data(), slots);
+                wins += countSelected(teamMask.data(), slots);
+            }
+
+            double gigabytesPerSecond = syntheticColumn.size() * sizeof(float) / (columnTime * 1000.0);
+            std::cout << std::setw(7) << simdLevelName(level) << std::setw(12) << scanTime << std::setw(11)
+                      << aggregateTime << std::setw(14) << columnTime << std::setw(16) << std::fixed
+                      << std::setprecision(2) << gigabytesPerSecond << std::setw(18) << wins << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            std::cout << std::setprecision(6);
+            bool compacted = std::all_of(syntheticMatches.begin(), syntheticMatches.begin() + selected,
+                                         [&](float value) { return value >= lower && value <= upper; });
+            if (kernelScan.numberOfResults != linearResult.numberOfResults
+                || kernelAggregate.count != static_cast<uint32_t>(linearResult.numberOfResults)
+                || kernelAggregate.sum != serialAggregate.sum || selected != syntheticSelected || !compacted
+                || wins != expectedWins) {
+                std::cout << "  Warning: Discrepancy in SIMD filter results!" << std::endl;
+            }
+        }
+        setSimdLevel(detectedLevel);
+        std::cout << syntheticSelected << " of " << syntheticColumn.size() << " synthetic values in range; "
+                  << expectedWins << " wins expected" << std::endl;
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 18: query shapes written as plans of batch-at-a-time operators, checked against the hand-written paths
+        std::cout << "\n======================= Task 18 ====================== " << std::endl;
+        std::cout << "------------- Vectorized Query Plans -----------------" << std::endl;
+        const int minimumPoints = 120;
+
+        // The B+ tree search again, with and without the plan
+        auto phaseStart = std::chrono::high_resolution_clock::now();
+        SearchResult directRange = bTree.rangeSearch(lower, upper, storage);
+        auto directTime = microsecondsSince(phaseStart);
+        std::cout << "IndexRangeScan -> Collect: " << result.numberOfResults << " records, " << result.dataBlocksAccessed
+                  << " block reads in batches of " << Batch::capacity << " (rangeSearch: " << directRange.numberOfResults
+                  << " records, " << directRange.dataBlocksAccessed << " block reads, " << directTime << " us)" << std::endl;
+
+        // High-scoring good shooting nights: two filters, then only four columns carried to the top
+        phaseStart = std::chrono::high_resolution_clock::now();
+        OperatorPtr nightsPlan = std::make_unique<Scan>(storage, std::vector<Column>{Column::FgPctHome, Column::PtsHome,
+                                                                                    Column::GameDate, Column::TeamId});
+        nightsPlan = std::make_unique<Filter>(std::move(nightsPlan), ColumnRange{Column::FgPctHome, lower, upper});
+        nightsPlan = std::make_unique<Filter>(std::move(nightsPlan), ColumnRange{Column::PtsHome, minimumPoints, 255});
+        nightsPlan = std::make_unique<Project>(std::move(nightsPlan),
+                                               std::vector<Column>{Column::GameDate, Column::TeamId, Column::PtsHome, Column::FgPctHome});
+        SearchResult nights = Collect(std::move(nightsPlan)).run();
+        auto nightsTime = microsecondsSince(phaseStart);
+        size_t expectedNights = std::count_if(linearResult.found_records.begin(), linearResult.found_records.end(),
+                                              [&](const Record& record) { return record.ptsHome >= minimumPoints; });
+        std::cout << "Scan -> Filter -> Filter -> Project -> Collect: " << nights.numberOfResults << " nights with "
+                  << minimumPoints << "+ points (" << nights.dataBlocksAccessed << " blocks, " << nightsTime << " us)" << std::endl;
+        // Team ids are the widest ints a batch carries; each one must come out of the plan exactly as stored
+        std::unordered_map<uint16_t, int32_t> storedTeams;
+        for (const auto& record : linearResult.found_records) {
+            storedTeams[record.recordId] = record.teamId;
+        }
+        bool teamsIntact = std::all_of(nights.found_records.begin(), nights.found_records.end(),
+                                       [&](const Record& record) { return storedTeams.at(record.recordId) == record.teamId; });
+
+        // The same nights with a LIMIT, which stops the scan as soon as it is met
+        OperatorPtr firstNightsPlan = std::make_unique<Scan>(storage, std::vector<Column>{Column::FgPctHome, Column::PtsHome,
+                                                                                         Column::GameDate, Column::TeamId});
+        firstNightsPlan = std::make_unique<Filter>(std::move(firstNightsPlan), ColumnRange{Column::PtsHome, minimumPoints, 255});
+        firstNightsPlan = std::make_unique<Filter>(std::move(firstNightsPlan), ColumnRange{Column::FgPctHome, lower, upper});
+        firstNightsPlan = std::make_unique<Limit>(std::move(firstNightsPlan), 3);
+        SearchResult firstNights = Collect(std::move(firstNightsPlan)).run();
+        std::cout << "... -> Limit 3 -> Collect (" << firstNights.dataBlocksAccessed << " blocks):" << std::endl;
+        for (const auto& record : firstNights.found_records) {
+            std::cout << "  " << decodeGameDate(record.gameDate) << "  team " << record.teamId << "  " << int(record.ptsHome)
+                      << " points  FG_PCT_home " << record.fgPctHome << std::endl;
+        }
+
+        // AVG(FG3_PCT_home) over the range, one plan per morsel on the pool
+        phaseStart = std::chrono::high_resolution_clock::now();
+        AggregateResult planAggregate = aggregateMorsels(storage, [&](size_t firstBlock, size_t endBlock) -> OperatorPtr {
+            OperatorPtr plan = std::make_unique<Scan>(storage, std::vector<Column>{Column::FgPctHome, Column::Fg3PctHome},
+                                                      firstBlock, endBlock);
+            return std::make_unique<Filter>(std::move(plan), ColumnRange{Column::FgPctHome, lower, upper});
+        }, Column::Fg3PctHome);
+        auto planAggregateTime = microsecondsSince(phaseStart);
+        std::cout << "Scan -> Filter -> Aggregate, per morsel: AVG(FG3_PCT_home) " << planAggregate.average << " over "
+                  << planAggregate.count << " records (" << planAggregateTime << " us)" << std::endl;
+
+        // A season's high-scoring nights through the date index, aggregated without collecting a record
+        phaseStart = std::chrono::high_resolution_clock::now();
+        OperatorPtr seasonPlan = std::make_unique<IndexRangeScan<int>>(dateTree, encodeGameDate(seasonStart),
+                                                                       encodeGameDate(seasonEnd), storage);
+        seasonPlan = std::make_unique<Filter>(std::move(seasonPlan), ColumnRange{Column::PtsHome, minimumPoints, 255});
+        AggregateResult seasonAggregate = Aggregate(std::move(seasonPlan), Column::FgPctHome).run();
+        auto seasonPlanTime = microsecondsSince(phaseStart);
+        size_t expectedSeasonNights = std::count_if(seasonResult.found_records.begin(), seasonResult.found_records.end(),
+                                                    [&](const Record& record) { return record.ptsHome >= minimumPoints; });
+        std::cout << "IndexRangeScan -> Filter -> Aggregate: " << seasonAggregate.count << " nights with " << minimumPoints
+                  << "+ points in " << seasonStart << " - " << seasonEnd << ", AVG(FG_PCT_home) " << seasonAggregate.average
+                  << " (" << seasonAggregate.indexNodesAccessed << " index nodes, " << seasonPlanTime << " us)" << std::endl;
+
+        if (result.numberOfResults != directRange.numberOfResults || result.dataBlocksAccessed != directRange.dataBlocksAccessed
+            || nights.numberOfResults != static_cast<int>(expectedNights)
+            || !teamsIntact
+            || firstNights.numberOfResults != static_cast<int>(std::min<size_t>(3, expectedNights))
+            || planAggregate.count != static_cast<uint32_t>(linearResult.numberOfResults)
+            || planAggregate.sum != serialAggregate.sum || seasonAggregate.count != expectedSeasonNights) {
+            std::cout << "  Warning: Discrepancy in query plan results!" << std::endl;
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
+
+        // Task 19: multi-column predicates pushed into the scan, with and without zone maps, against decoding every
+        // record and testing it afterwards
+        std::cout << "\n======================= Task 19 ====================== " << std::endl;
+        std::cout << "----------------- Predicate Pushdown -----------------" << std::endl;
+        const std::vector<Predicate> pushedPredicates = {
+            Predicate::allOf({Predicate::between(Column::FgPctHome, lower, upper),
+                              Predicate::anyOf({Predicate::atLeast(Column::PtsHome, minimumPoints),
+                                                Predicate::atLeast(Column::AstHome, 30)}),
+                              Predicate::equal(Column::HomeTeamWins, 1)}),
+            Predicate::allOf({Predicate::between(Column::GameDate, encodeGameDate(seasonStart), encodeGameDate(seasonEnd)),
+                              Predicate::in(Column::TeamId, std::vector<double>(teams.begin(), teams.end()))}),
+            Predicate::anyOf({Predicate::less(Column::FgPctHome, 0.35),
+                              Predicate::allOf({Predicate::equal(Column::HomeTeamWins, 0), Predicate::atMost(Column::PtsHome, 80)})}),
+        };
+        for (const auto& predicate : pushedPredicates) {
+            std::cout << predicate.toString() << std::endl;
+
+            // Every record decoded, then tested
+            phaseStart = std::chrono::high_resolution_clock::now();
+            std::vector<Record> decoded = storage.getAllRecords();
+            size_t expectedMatches = std::count_if(decoded.begin(), decoded.end(),
+                                                   [&](const Record& record) { return predicate.matches(record); });
+            auto postFilterTime = microsecondsSince(phaseStart);
+            std::cout << "  Post-filter:     " << std::setw(6) << expectedMatches << " matches, " << std::setw(4)
+                      << storage.getDatablockCount() << " blocks read,    0 skipped, " << std::setw(6) << std::fixed
+                      << std::setprecision(2) << static_cast<double>(RECORD_SIZE) << " bytes/row, " << postFilterTime
+                      << " us" << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            std::cout << std::setprecision(6);
+
+            for (bool zoneMaps : {true, false}) {
+                storage.setZoneMapsEnabled(zoneMaps);
+                std::vector<size_t> morselMatches(storage.morselCount());
+                phaseStart = std::chrono::high_resolution_clock::now();
+                ScanCounters counters = storage.scanMorsels(morselMatches.size(), predicate,
+                                                            [&](size_t morsel, const std::vector<Record>& records) {
+                    morselMatches[morsel] = records.size();
+                });
+                auto pushdownTime = microsecondsSince(phaseStart);
+                size_t matches = std::accumulate(morselMatches.begin(), morselMatches.end(), size_t{0});
+                std::cout << (zoneMaps ? "  Zone maps on:    " : "  Zone maps off:   ") << std::setw(6) << matches
+                          << " matches, " << std::setw(4) << counters.blocksRead << " blocks read, " << std::setw(4)
+                          << counters.blocksSkipped << " skipped, " << std::setw(6) << std::fixed << std::setprecision(2)
+                          << static_cast<double>(counters.bytesRead) / decoded.size() << " bytes/row, " << pushdownTime
+                          << " us" << std::endl;
+                std::cout.unsetf(std::ios::fixed);
+                std::cout << std::setprecision(6);
+                if (matches != expectedMatches) {
+                    std::cout << "  Warning: Discrepancy in pushed-down predicate results!" << std::endl;
+                }
+            }
+            storage.setZoneMapsEnabled(true);
+        }
+        std::cout << "------------------------------------------------------" << std::endl;
     } catch (const std::exception& e) {
         std::cerr << "Error: " << e.what() << std::endl;
     } catch (...) {